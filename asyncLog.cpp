@@ -0,0 +1,143 @@
+#include <string.h>
+#include <algorithm>
+
+#include "Logger.h"
+#include "asyncLog.h"
+#include "latencyHistogram.h"
+
+// ------------------------------------------------------------------------------------------------
+
+AsyncLog::ThreadRingHandle::~ThreadRingHandle()
+{
+    // whatever is still queued is drained as usual, then another thread can have the ring
+    if (pring) pring->inUse.store(false, std::memory_order_release);
+}
+
+// ------------------------------------------------------------------------------------------------
+
+AsyncLog::AsyncLog() :
+    CstdThread(this)
+{
+    drained.reserve(ASYNCLOG_RINGSIZE);
+    CstdThread::init(true);
+}
+
+AsyncLog& AsyncLog::instance(void)
+{
+    // never destroyed, so threads can still log during process exit
+    static AsyncLog* pasyncLog = new AsyncLog();
+    return *pasyncLog;
+}
+
+int AsyncLog::addSite(const char* method, const char* message, ASYNCLOG_LEVEL level)
+{
+    std::lock_guard<std::mutex> lock(sitesLock);
+    int siteId = numSites.load(std::memory_order_relaxed);
+    if (siteId >= ASYNCLOG_MAXSITES) {
+        LOG_WARNING("AsyncLog::addSite()", std::string("too many sites, not logging ") + method, ASYNCLOG_MAXSITES);
+        return -1;
+    }
+    sites[siteId].method = method;
+    sites[siteId].message = message;
+    sites[siteId].level = level;
+    numSites.store(siteId + 1, std::memory_order_release);
+    return siteId;
+}
+
+AsyncLog::ThreadRing& AsyncLog::findThreadRing(void)
+{
+    std::lock_guard<std::mutex> lock(ringsLock);
+    for (auto& rpring : rings) {
+        bool inUse = false;
+        if (rpring->inUse.compare_exchange_strong(inUse, true, std::memory_order_acquire)) return *rpring;
+    }
+    rings.emplace_back(new ThreadRing());
+    return *rings.back();
+}
+
+void AsyncLog::log(int siteId, int value, const char* ptext, size_t textLength)
+{
+    if (siteId < 0) return;
+    AsyncLogRecord record;
+    record.timestampNs = latencyNowNs();
+    record.siteId = siteId;
+    record.value = value;
+    record.textLength = (int)std::min(textLength, (size_t)ASYNCLOG_TEXTSIZE);
+    if (record.textLength > 0) memcpy(record.text, ptext, record.textLength);
+    if (!async) {
+        emit(record);
+        return;
+    }
+    ThreadRing& rthreadRing = threadRing();
+    if (rthreadRing.ring.push(record)) {
+        rthreadRing.numLogged.store(rthreadRing.numLogged.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+    rthreadRing.numDropped.store(rthreadRing.numDropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void AsyncLog::emit(const AsyncLogRecord& rrecord)
+{
+    const Site& rsite = sites[rrecord.siteId];
+    std::string line = rsite.message;
+    line.append(rrecord.text, rrecord.textLength);
+    if (rsite.level == ASYNCLOG_LEVEL::WARNING) LOG_WARNING(rsite.method, line, rrecord.value);
+    else LOG_INFO(rsite.method, line, rrecord.value);
+}
+
+/// empties every ring and formats the records oldest first, so the log keeps the order of
+/// events across threads
+void AsyncLog::drain(void)
+{
+    std::lock_guard<std::mutex> lock(drainLock);
+    uint64_t numDropped = 0;
+    {
+        std::lock_guard<std::mutex> ringsGuard(ringsLock);
+        for (auto& rpring : rings) {
+            // one pass, a thread that keeps logging can not hold the formatter here
+            rpring->ring.popMany(ASYNCLOG_RINGSIZE, [this](AsyncLogRecord& rrecord) { drained.push_back(rrecord); });
+            numDropped += rpring->numDropped.load(std::memory_order_relaxed);
+        }
+    }
+    std::stable_sort(drained.begin(), drained.end(), [](const AsyncLogRecord& ra, const AsyncLogRecord& rb) {
+        return ra.timestampNs < rb.timestampNs;
+    });
+    for (const AsyncLogRecord& rrecord : drained) emit(rrecord);
+    numFlushed += drained.size();
+    drained.clear();
+    if (numDropped > numDroppedReported) {
+        LOG_WARNING("AsyncLog::drain()", "log records dropped, a ring was full", (int)(numDropped - numDroppedReported));
+        numDroppedReported = numDropped;
+    }
+}
+
+void AsyncLog::flush(void)
+{
+    drain();
+}
+
+bool AsyncLog::threadFunction(void)
+{
+    while (!checkIfShouldExit()) {
+        eventFlush.waitUntil(ASYNCLOG_FLUSHMS);
+        drain();
+    }
+    exiting();
+    return true;
+}
+
+AsyncLogStats AsyncLog::getStats(void)
+{
+    AsyncLogStats stats;
+    {
+        std::lock_guard<std::mutex> lock(ringsLock);
+        for (auto& rpring : rings) {
+            stats.numLogged += rpring->numLogged.load(std::memory_order_relaxed);
+            stats.numDropped += rpring->numDropped.load(std::memory_order_relaxed);
+        }
+        stats.numRings = rings.size();
+    }
+    std::lock_guard<std::mutex> lock(drainLock);
+    stats.numFlushed = numFlushed;
+    return stats;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+#include "sthread.h"
+#include "packetQ.h"
+
+#define ASYNCLOG_RINGSIZE 1024          // records each thread can have waiting, a power of 2
+#define ASYNCLOG_MAXSITES 1024          // distinct ALOG_ call sites
+#define ASYNCLOG_TEXTSIZE 100           // bytes of a record's text kept, the rest is cut
+#define ASYNCLOG_FLUSHMS 20             // how often the formatter thread drains the rings
+
+enum class ASYNCLOG_LEVEL {
+    INFO,
+    WARNING,
+};
+
+/// One log call as it is queued, fixed size and nothing allocated. The method, message and
+/// level live in the call site, only its id is recorded
+struct AsyncLogRecord {
+    int64_t timestampNs = 0;
+    int siteId = 0;
+    int value = 0;
+    int textLength = 0;
+    char text[ASYNCLOG_TEXTSIZE];
+};
+
+struct AsyncLogStats {
+    uint64_t numLogged = 0;         // records queued
+    uint64_t numDropped = 0;        // records lost to a full ring
+    uint64_t numFlushed = 0;        // records formatted and handed to the logger
+    uint64_t numRings = 0;          // threads that have logged, rings are reused after a thread exits
+};
+
+// ------------------------------------------------------------------------------------------------
+
+/// Logging off the calling thread. A call site registers its method and message once, then each
+/// call copies a timestamp, the site id, an int and an optional bit of text into the calling
+/// thread's own SpscRing. No strings are built and no lock is taken. A background thread drains
+/// every ring every ASYNCLOG_FLUSHMS, puts the records back in time order, formats them and
+/// hands them to LOG_INFO/LOG_WARNING. When a ring is full the record is dropped and counted,
+/// the formatter logs how many were lost. Never destroyed, like PacketPool. Use the ALOG_ macros
+class AsyncLog : CstdThread {
+    struct Site {
+        const char* method = 0;
+        const char* message = 0;
+        ASYNCLOG_LEVEL level = ASYNCLOG_LEVEL::INFO;
+    };
+    struct ThreadRing {
+        SpscRing<AsyncLogRecord, ASYNCLOG_RINGSIZE> ring;
+        std::atomic<bool> inUse{ true };
+        std::atomic<uint64_t> numLogged{ 0 };      // written by the owning thread only
+        std::atomic<uint64_t> numDropped{ 0 };
+    };
+    /// gives the thread's ring back when the thread exits
+    struct ThreadRingHandle {
+        ThreadRing* pring = 0;
+        ~ThreadRingHandle();
+    };
+
+    Site sites[ASYNCLOG_MAXSITES];
+    std::atomic<int> numSites{ 0 };
+    std::mutex sitesLock;
+    std::mutex ringsLock;
+    std::vector<std::unique_ptr<ThreadRing>> rings;
+    std::mutex drainLock;           // the rings have one consumer, whoever holds this
+    std::vector<AsyncLogRecord> drained;
+    uint64_t numFlushed = 0;
+    uint64_t numDroppedReported = 0;
+    std::atomic<bool> async{ true };
+    CstdConditional eventFlush;
+
+    AsyncLog();
+    virtual bool threadFunction(void);
+    ThreadRing& findThreadRing(void);
+    ThreadRing& threadRing(void) {
+        static thread_local ThreadRingHandle handle;
+        if (!handle.pring) handle.pring = &findThreadRing();
+        return *handle.pring;
+    }
+    void emit(const AsyncLogRecord& rrecord);
+    void drain(void);
+
+public:
+    static AsyncLog& instance(void);
+
+    /// once per call site, returns its id. method and message must outlive the process, literals
+    int addSite(const char* method, const char* message, ASYNCLOG_LEVEL level);
+    /// the message is the site's, followed by text if any
+    void log(int siteId, int value, const char* ptext = 0, size_t textLength = 0);
+    void log(int siteId, int value, const std::string& text) { log(siteId, value, text.data(), text.size()); }
+    /// format everything queued so far on this thread before returning, at shutdown say
+    void flush(void);
+    /// false formats and logs on the calling thread, in order with plain LOG_INFO calls. For debugging
+    void setAsync(bool _async) { async = _async; }
+    AsyncLogStats getStats(void);
+};
+
+/// Each expands to a function local static holding the site id, so the site is registered
+/// on its first call and every call after that only queues a record
+#define ALOG(level, method, message, value, ...) do { \
+        static const int asyncLogSiteId = AsyncLog::instance().addSite(method, message, level); \
+        AsyncLog::instance().log(asyncLogSiteId, value, ##__VA_ARGS__); \
+    } while (0)
+#define ALOG_INFO(method, message, value, ...) ALOG(ASYNCLOG_LEVEL::INFO, method, message, value, ##__VA_ARGS__)
+#define ALOG_WARNING(method, message, value, ...) ALOG(ASYNCLOG_LEVEL::WARNING, method, message, value, ##__VA_ARGS__)
@@ -1,79 +1,110 @@
 #include <stdio.h>
+#include <unistd.h>
+#include <iostream>
 
+#include "Logger.h"
 #include "EConnection.h"
 #include "ThreadMgr.h"
 #include "tcp.h"
 #include "TcpStringClientServer.h"
 #include "hyperCubeClient.h"
+#include "echoWindow.h"
+#include "clockGetTime.h"
+#include "MsgExt.h"
 #include "kbhit.h"
 
-
+using namespace std;
 
 class HyperCubeClientShell : public HyperCubeClient
 {
+    std::string dataString;
+    double totalTime = 0;
+    int totalTests = 0;
+    int msgNum = 0;
+
+    bool printRcvdPackets(void);
+public:
     bool doShell(void);
     bool doEchoTest(void);
+    bool doWindowedEchoTest(void);
+};
+
+/// print whatever data packets have arrived
+bool HyperCubeClientShell::printRcvdPackets(void)
+{
+    Packet packet;
+    bool received = false;
+    while (getPacket(packet)) {
+        cout << "received " << packet.getLength() << " bytes\n";
+        received = true;
+    }
+    return received;
 }
 
+/// stop and wait echoes. hyperCubeClientBench has the full set of scenarios
 bool HyperCubeClientShell::doEchoTest(void)
 {
     cout << "Echo Test \n";
 
     // TODO increase this to 10000 to cause errors
     int dataStringBytes = 1000;
-    for (int i = 0; i < dataStringBytes; i++) {
-        dataString += "D";
-    }
-
-    static int msgNum = 0;
+    dataString.assign(dataStringBytes, 'D');
 
     ClockGetTime cgt;
     double numTests = 50;
-    static int totalTests = 0;
+    uint64_t bytesSentBefore = getSendStats().numBytesSent;
+    double testTime = 0;
     for (int i = 0; i < (int)numTests; i++) {
+        Packet packet;
         cgt.start();
         string command = "ECHO"; command += dataString + std::to_string(msgNum++);
         MsgCmd cmdMsg(command);
-        sendMsg(cmdMsg);
-        while (!recvPackets()) {
-            usleep(1);
+        sendMsgOut(cmdMsg);
+        if (!waitForPacket(packet, 1000)) {
+            LOG_WARNING("HyperCubeClientShell::doEchoTest()", "no echo", i);
+            return false;
         }
         cgt.end();
-        totalTime += cgt.change();
-        printRcvdMsgCmds(command);
+        testTime += cgt.change();
     }
+    totalTime += testTime;
     totalTests += (int)numTests;
+    uint64_t bytesSent = getSendStats().numBytesSent - bytesSentBefore;
     double avgTime = (totalTime / totalTests) * 1000000;
-    double avgBytes = ((double)totalBytesSent / (double)totalTests);
-    double totalBPS = ((double)(totalBytesSent * 8) / totalTime) / 1000000.0;
-    LOG_INFO("HyperCubeClient::doEchoTest()", "Avg time per test (us): " + std::to_string(avgTime), 0);
-    LOG_INFO("HyperCubeClient::doEchoTest()", "Avg bytes per test : " + std::to_string((int)avgBytes), 0);
-    LOG_INFO("HyperCubeClient::doEchoTest()", "MBps: " + std::to_string(totalBPS), 0);
+    double avgBytes = ((double)bytesSent / numTests);
+    double totalBPS = ((double)(bytesSent * 8) / testTime) / 1000000.0;
+    LOG_INFO("HyperCubeClientShell::doEchoTest()", "Avg time per test (us): " + std::to_string(avgTime), 0);
+    LOG_INFO("HyperCubeClientShell::doEchoTest()", "Avg bytes per test : " + std::to_string((int)avgBytes), 0);
+    LOG_INFO("HyperCubeClientShell::doEchoTest()", "MBps: " + std::to_string(totalBPS), 0);
     return true;
 }
 
-bool HyperCubeClientShell::doShell(void)
+/// same echoes, 16 in flight at a time
+bool HyperCubeClientShell::doWindowedEchoTest(void)
 {
-    client.init();
+    cout << "Windowed Echo Test \n";
+    EchoWindow echoWindow(*this, 16, 1000);
+    EchoWindowResult result = echoWindow.run(5000, 1000);
+    LOG_INFO("HyperCubeClientShell::doWindowedEchoTest()", "msgs/s: " + std::to_string((int)result.msgsPerSec), 0);
+    LOG_INFO("HyperCubeClientShell::doWindowedEchoTest()", "MBps: " + std::to_string(result.mbPerSec), 0);
+    LOG_INFO("HyperCubeClientShell::doWindowedEchoTest()", "latency " + result.latency.to_string(), 0);
+    return !result.timedOut;
+}
 
-    if (!client.connect(serverIpAddress, SERVER_PORT)) {
+bool HyperCubeClientShell::doShell(void)
+{
+    for (int waited = 0; !isConnected() && (waited < 10000); waited += 100) usleep(100000);
+    if (!isConnected()) {
         std::cout << "HyperCubeClient(): Server not available\n\r";
         return false;
     }
     bool exitNow = false;
 
     std::cout << "Client Interactive Mode\n\r";
-    cout << "q/ESC - quit, x - exit, e - echo, s - send, r - recv, l - echo loop\n\r";
-#ifdef _WIN64
-    DWORD processID = GetCurrentProcessId();
-    cout << "ProcessId: " << processID << endl;
-#endif
+    cout << "q/ESC - quit, x - exit, e - echo test, w - windowed echo test, p - ping, s - send, l - echo loop\n\r";
 
     std::string dataString = "Hi There:";
 
-    Msg inMsg;
-    int msgNum = 0;
-
     while (!exitNow) {
         if (kbhit()) {
             char ch = getchar();
@@ -83,47 +114,37 @@ bool HyperCubeClientShell::doShell(void)
                 exitNow = true;
                 break;
             case 'p':
-                publish();
+                remotePing();
                 break;
             case 's':
-                subscribe();
-                break;
-            case 'c':
-                createGroup("Test groupName ");
-                break;
-            case 'r':
             {
                 cout << "Sent SEND\n";
                 string command = "SEND "; command += dataString + std::to_string(msgNum++);
                 MsgCmd cmdMsg(command);
-                sendMsg(cmdMsg);
+                sendMsgOut(cmdMsg);
             }
             break;
             case 'e':
-                sendEcho();
-                //                    doEchoTest();
-                                    /*
-                                    {
-                                        cout << "Sent ";
-                                        string command = "ECHO"; command += dataString + std::to_string(msgNum++);
-                                        MsgCmd cmdMsg(command);
-                                        sendMsg(cmdMsg);
-                                    }*/
+                doEchoTest();
+                break;
+            case 'w':
+                doWindowedEchoTest();
                 break;
             case 'x':
             {
                 exitNow = true;
                 MsgCmd cmdMsg("EXIT");
-                sendMsg(cmdMsg);
+                sendMsgOut(cmdMsg);
                 usleep(100000);
             }
             break;
             case 'l':
             {
                 string command = "ECHO"; command += to_string(100) + ",";
-                while (true) {
+                while (!kbhit()) {
                     MsgCmd cmdMsg(command);
-                    sendMsg(cmdMsg);
+                    sendMsgOut(cmdMsg);
+                    printRcvdPackets();
                     usleep(100000);
                 }
             }
@@ -132,14 +153,11 @@ bool HyperCubeClientShell::doShell(void)
 
         }
 
-        recvPackets();
-
-        printRcvdMsgCmds("");
+        printRcvdPackets();
 
         usleep(10000);
     }
 
-    client.deinit();
     return true;
 }
 
@@ -156,5 +174,5 @@ int main() {
     cout << "Connecting to " << ipAddress << endl;
     client.init(ipAddress);
     client.doShell();
-
+    client.deinit();
 }
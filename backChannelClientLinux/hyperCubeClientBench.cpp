@@ -0,0 +1,1501 @@
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <sys/epoll.h>
+
+#include "Packet.h"
+#include "packetQ.h"
+#include "packetPool.h"
+#include "hyperCubeClient.h"
+#include "sigCodec.h"
+#include "lzCodec.h"
+#include "clockGetTime.h"
+#include "latencyHistogram.h"
+#include "echoWindow.h"
+#include "hyperCubeStandInServer.h"
+#include "hyperCubeClientPool.h"
+#include "hyperCubeAwait.h"
+#include "metricsRegistry.h"
+#include "asyncLog.h"
+#include "packetClassifier.h"
+#include "msgDispatcher.h"
+#include "mserdes.h"
+#include "Logger.h"
+
+using namespace std;
+
+// ------------------------------------------------------------------------------------------------
+// Packet queue microbenchmark. Producers push a fixed set of packets through the queue and a
+// single consumer pops them, the same shape as sendMsgOut() -> SendActivity.
+
+static const int QBENCH_NUMPACKETS = 1 << 16;
+static const int QBENCH_NUMROUNDS = 32;
+
+template <class Q>
+static double benchPacketQ(Q& q, int numProducers)
+{
+    std::vector<Packet::UniquePtr> packets(QBENCH_NUMPACKETS);
+    for (auto& ppacket : packets) ppacket = Packet::create();
+    // the consumer pops into its own vector, packets belongs to the producers until they are joined
+    std::vector<Packet::UniquePtr> popped(QBENCH_NUMPACKETS);
+
+    ClockGetTime cgt;
+    cgt.start();
+    for (int round = 0; round < QBENCH_NUMROUNDS; round++) {
+        std::vector<std::thread> producers;
+        const int perProducer = QBENCH_NUMPACKETS / numProducers;
+        for (int p = 0; p < numProducers; p++) {
+            producers.emplace_back([&q, &packets, p, perProducer]() {
+                for (int i = p * perProducer; i < (p + 1) * perProducer; i++) {
+                    while (!q.push(packets[i])) std::this_thread::yield();
+                }
+            });
+        }
+        int numPopped = 0;
+        Packet::UniquePtr ppacket = 0;
+        while (numPopped < perProducer * numProducers) {
+            if (q.pop(ppacket)) popped[numPopped++] = std::move(ppacket);
+        }
+        for (auto& producer : producers) producer.join();
+        packets.swap(popped);
+    }
+    cgt.end();
+    double numOps = (double)QBENCH_NUMPACKETS * QBENCH_NUMROUNDS;
+    return (cgt.change() / numOps) * 1000000000.0;
+}
+
+static bool runQueueBench(void)
+{
+    cout << "Packet queue benchmark, ns per push+pop\n";
+    for (int numProducers : { 1, 4 }) {
+        auto pqLock = std::make_unique<PacketQWithLock>();
+        auto pqMpsc = std::make_unique<PacketQMpsc>();
+        cout << "  producers " << numProducers << "\n";
+        cout << "    PacketQWithLock : " << benchPacketQ(*pqLock, numProducers) << "\n";
+        if (numProducers == 1) {
+            auto pqSpsc = std::make_unique<PacketQSpsc>();
+            cout << "    PacketQSpsc     : " << benchPacketQ(*pqSpsc, numProducers) << "\n";
+        }
+        cout << "    PacketQMpsc     : " << benchPacketQ(*pqMpsc, numProducers) << "\n";
+    }
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Packet allocation benchmark. One thread creates packets and hands them to a second thread
+// that retires them, as sendMsgOut() and SendActivity do.
+
+static double benchPacketAlloc(bool usePool)
+{
+    auto pq = std::make_unique<PacketQSpsc>();
+    ClockGetTime cgt;
+    cgt.start();
+    std::thread consumer([&pq, usePool]() {
+        Packet::UniquePtr ppacket = 0;
+        int numRetired = 0;
+        while (numRetired < QBENCH_NUMPACKETS * QBENCH_NUMROUNDS) {
+            if (!pq->pop(ppacket)) continue;
+            if (usePool) PacketPool::instance().recycle(ppacket);
+            else ppacket.reset();
+            numRetired++;
+        }
+    });
+    for (int i = 0; i < QBENCH_NUMPACKETS * QBENCH_NUMROUNDS; i++) {
+        Packet::UniquePtr ppacket = usePool ? PacketPool::instance().acquire() : Packet::create();
+        while (!pq->push(ppacket)) std::this_thread::yield();
+    }
+    consumer.join();
+    cgt.end();
+    double numOps = (double)QBENCH_NUMPACKETS * QBENCH_NUMROUNDS;
+    return (cgt.change() / numOps) * 1000000000.0;
+}
+
+static bool runPoolBench(void)
+{
+    cout << "Packet allocation benchmark, ns per create+retire\n";
+    cout << "  Packet::create   : " << benchPacketAlloc(false) << "\n";
+    cout << "  PacketPool       : " << benchPacketAlloc(true) << "\n";
+    PacketPoolStats stats = PacketPool::instance().getStats();
+    cout << "  pool hits " << stats.hits << " misses " << stats.misses << " freed " << stats.freed
+        << " highWater " << stats.highWater << "\n";
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Signalling command encode+decode cost and size, JSON vs SigCodec
+
+static const int CODECBENCH_NUMITERATIONS = 100000;
+
+/// a command encoded with SigCodec must decode to what went in, with and without a correlation id
+static bool checkSigCodec(const char* name, HYPERCUBECOMMANDS command, CommonInfoBase& commonInfoBase)
+{
+    for (bool ack : { false, true }) {
+        for (uint32_t sentCorrelationId : { (uint32_t)0, (uint32_t)0x12345678 }) {
+            bool status = !ack;
+            std::string data;
+            HyperCubeCommand decoded(HYPERCUBECOMMANDS::NONE, NULL, true);
+            uint32_t correlationId = 0;
+            bool stat = SigCodec::encode(command, commonInfoBase, ack, status, data, sentCorrelationId)
+                && SigCodec::decode(data, decoded, correlationId)
+                && (decoded.command == command) && (decoded.ack == ack) && (decoded.status == status)
+                && (correlationId == sentCorrelationId) && (decoded.getJsonData() == commonInfoBase.to_json());
+            if (!stat) {
+                cout << "  " << name << " : FAILED round trip, ack " << ack << " correlationId " << sentCorrelationId << "\n";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool benchSigCodec(const char* name, HYPERCUBECOMMANDS command, CommonInfoBase& commonInfoBase)
+{
+    if (!checkSigCodec(name, command, commonInfoBase)) return false;
+
+    ClockGetTime cgt;
+    size_t jsonBytes = 0;
+    cgt.start();
+    for (int i = 0; i < CODECBENCH_NUMITERATIONS; i++) {
+        HyperCubeCommand hyperCubeCommand(command, commonInfoBase.to_json(), true);
+        std::string data = hyperCubeCommand.to_json().dump();
+        HyperCubeCommand decoded(HYPERCUBECOMMANDS::NONE, NULL, true);
+        decoded.from_json(json::parse(data));
+        jsonBytes = data.size();
+    }
+    cgt.end();
+    double jsonNs = (cgt.change() / CODECBENCH_NUMITERATIONS) * 1000000000.0;
+
+    size_t binaryBytes = 0;
+    std::string data;
+    int numFailed = 0;
+    cgt.start();
+    for (int i = 0; i < CODECBENCH_NUMITERATIONS; i++) {
+        SigCodec::encode(command, commonInfoBase, false, true, data);
+        HyperCubeCommand decoded(HYPERCUBECOMMANDS::NONE, NULL, true);
+        uint32_t correlationId = 0;
+        if (!SigCodec::decode(data, decoded, correlationId)) numFailed++;
+        binaryBytes = data.size();
+    }
+    cgt.end();
+    double binaryNs = (cgt.change() / CODECBENCH_NUMITERATIONS) * 1000000000.0;
+
+    cout << "  " << name << " : json " << jsonNs << " ns " << jsonBytes << " bytes, binary "
+        << binaryNs << " ns " << binaryBytes << " bytes\n";
+    return numFailed == 0;
+}
+
+static bool runSigCodecBench(void)
+{
+    cout << "Signalling codec benchmark, encode+decode per command\n";
+    bool stat = true;
+    StringInfo stringInfo;
+    stringInfo.data = "remotePingFromMatrix";
+    stat &= benchSigCodec("REMOTEPING", HYPERCUBECOMMANDS::REMOTEPING, stringInfo);
+    GroupInfo groupInfo;
+    groupInfo.groupName = "TeamPegasus";
+    stat &= benchSigCodec("CREATEGROUP", HYPERCUBECOMMANDS::CREATEGROUP, groupInfo);
+    return stat;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Receive classification, per packet. Reading subSys and command from the header against
+// decoding the packet into a Msg, and into the MsgCmd it carries, for a data and a signalling packet
+
+static const int CLASSIFYBENCH_NUMITERATIONS = 1000000;
+static volatile int classifyBenchSink = 0;      // keeps the loops from being optimised away
+
+static void benchClassify(const char* name, Msg& msg)
+{
+    MSerDes mserdes;
+    Packet::UniquePtr ppacket = Packet::create();
+    mserdes.msgToPacket(msg, ppacket);
+    int subSysTotal = 0;
+    ClockGetTime cgt;
+    cgt.start();
+    for (int i = 0; i < CLASSIFYBENCH_NUMITERATIONS; i++) {
+        int subSys = 0;
+        int command = 0;
+        PacketClassifier::instance().classify(*ppacket, subSys, command);
+        subSysTotal += subSys;
+    }
+    cgt.end();
+    double headerNs = (cgt.change() / CLASSIFYBENCH_NUMITERATIONS) * 1000000000.0;
+    cgt.start();
+    for (int i = 0; i < CLASSIFYBENCH_NUMITERATIONS; i++) {
+        Msg decoded;
+        mserdes.packetToMsg(ppacket.get(), decoded);
+        subSysTotal += decoded.subSys;
+    }
+    cgt.end();
+    double msgNs = (cgt.change() / CLASSIFYBENCH_NUMITERATIONS) * 1000000000.0;
+    cgt.start();
+    for (int i = 0; i < CLASSIFYBENCH_NUMITERATIONS; i++) {
+        MsgCmd decoded("");
+        mserdes.packetToMsg(ppacket.get(), decoded);
+        subSysTotal += decoded.subSys;
+    }
+    cgt.end();
+    double msgCmdNs = (cgt.change() / CLASSIFYBENCH_NUMITERATIONS) * 1000000000.0;
+    cout << "  " << name << " " << ppacket->getLength() << "B : header " << headerNs << " ns, Msg " << msgNs
+        << " ns, MsgCmd " << msgCmdNs << " ns\n";
+    classifyBenchSink = subSysTotal;
+}
+
+static bool runClassifyBench(void)
+{
+    cout << "Receive classification benchmark, header only "
+        << (PacketClassifier::instance().isHeaderOnly() ? "on" : "off, MSerDes layout not recognised") << "\n";
+    MsgCmd dataMsg(std::string(1024, 'D'));
+    benchClassify("data", dataMsg);
+    SigMsg sigMsg("{\"command\":\"REMOTEPING\",\"jsonData\":{\"data\":\"remotePingFromMatrix\"}}");
+    benchClassify("signalling", sigMsg);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Receive dispatch, per packet. A MsgDispatcher route decoding into the handler's MsgCmd, against
+// the queue hop it replaces: inPacketQ push and pop, then the application's own decode and switch
+
+static const int DISPATCHBENCH_NUMITERATIONS = 1000000;
+static volatile int dispatchBenchSink = 0;
+
+static bool runDispatchBench(void)
+{
+    MSerDes mserdes;
+    MsgCmd dataMsg(std::string(256, 'D'));
+    Packet::UniquePtr ppacket = Packet::create();
+    mserdes.msgToPacket(dataMsg, ppacket);
+    int subSys = 0;
+    int command = 0;
+    PacketClassifier::instance().classify(*ppacket, subSys, command);
+    int total = 0;
+
+    MsgDispatcher dispatcher;
+    dispatcher.addMsgRoute<MsgCmd>(subSys, command, [&total](MsgCmd& rmsgCmd) { total += rmsgCmd.subSys; });
+    ClockGetTime cgt;
+    cgt.start();
+    for (int i = 0; i < DISPATCHBENCH_NUMITERATIONS; i++) {
+        int packetSubSys = 0;
+        int packetCommand = 0;
+        PacketClassifier::instance().classify(*ppacket, packetSubSys, packetCommand);
+        MsgDispatcher::RouteHandler* proute = dispatcher.findRoute(packetSubSys, packetCommand);
+        if (proute) dispatcher.dispatch(*proute, ppacket);
+    }
+    cgt.end();
+    double routedNs = (cgt.change() / DISPATCHBENCH_NUMITERATIONS) * 1000000000.0;
+
+    PacketQSpsc q;
+    q.init();
+    cgt.start();
+    for (int i = 0; i < DISPATCHBENCH_NUMITERATIONS; i++) {
+        q.push(ppacket);
+        q.pop(ppacket);
+        MsgCmd msgCmd("");
+        mserdes.packetToMsg(ppacket.get(), msgCmd);
+        switch (msgCmd.subSys) {
+            case SUBSYS_CMD:
+                total += msgCmd.command;
+                break;
+            default:
+                total += msgCmd.subSys;
+                break;
+        }
+    }
+    cgt.end();
+    double queuedNs = (cgt.change() / DISPATCHBENCH_NUMITERATIONS) * 1000000000.0;
+    dispatchBenchSink = total;
+    cout << "Receive dispatch benchmark, " << ppacket->getLength() << "B packets\n";
+    cout << "  routed " << routedNs << " ns, queued then decoded " << queuedNs << " ns, dispatched "
+        << dispatcher.getNumDispatched() << " decode failures " << dispatcher.getNumDecodeFailures() << "\n";
+    return dispatcher.getNumDecodeFailures() == 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Payload compression, ratio and cost per KB of LzCodec on the kinds of payload the client sends
+
+static const int LZBENCH_NUMBYTES = 64 * 1024 * 1024;      // per payload type and direction
+
+static void benchLzCodec(const char* name, const std::string& payload)
+{
+    int numIterations = std::max(1, LZBENCH_NUMBYTES / (int)payload.size());
+    std::string compressed;
+    std::string decompressed;
+    ClockGetTime cgt;
+    cgt.start();
+    for (int i = 0; i < numIterations; i++) LzCodec::compress(payload, compressed);
+    cgt.end();
+    double compressSeconds = cgt.change();
+    cgt.start();
+    for (int i = 0; i < numIterations; i++) LzCodec::decompress(compressed, decompressed);
+    cgt.end();
+    double decompressSeconds = cgt.change();
+    double numKB = (double)payload.size() * numIterations / 1024.0;
+    cout << "  " << name << " " << payload.size() << "B : ratio " << (double)payload.size() / compressed.size()
+        << ", compress " << compressSeconds * 1e9 / numKB << " ns/KB, decompress " << decompressSeconds * 1e9 / numKB
+        << " ns/KB" << (decompressed == payload ? "" : " MISMATCH") << "\n";
+}
+
+static bool runLzCodecBench(void)
+{
+    cout << "Payload compression benchmark\n";
+    // the shell's echo test pads with one repeated character
+    benchLzCodec("padded", "ECHO" + std::string(10000, 'D'));
+    json groups = json::array();
+    for (int i = 0; i < 64; i++) {
+        groups.push_back({ { "groupName", "TeamPegasus" + std::to_string(i) }, { "connectionId", 1000 + i * 7 }, { "subscribers", i % 9 } });
+    }
+    benchLzCodec("json", groups.dump());
+    std::string random(4096, ' ');
+    std::mt19937 generator(1);
+    for (char& rch : random) rch = (char)generator();
+    benchLzCodec("random", random);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Round trip latency through a HyperCube server that echoes data messages, for each threading
+// mode and each way of delivering the reply to the application.
+
+enum class DELIVERY {
+    POLL,       // getPacket() + usleep(), the old way
+    WAIT,       // waitForPacket()
+    EVENTFD,    // epoll on getPacketReadyFd()
+    HANDLER,    // setPacketHandler()
+};
+
+static const char* deliveryName(DELIVERY delivery)
+{
+    switch (delivery) {
+        case DELIVERY::POLL: return "poll";
+        case DELIVERY::WAIT: return "wait";
+        case DELIVERY::EVENTFD: return "eventfd";
+        case DELIVERY::HANDLER: return "handler";
+    }
+    return "";
+}
+
+class BenchClient : public HyperCubeClient
+{
+    std::atomic<bool> handled = false;
+    std::chrono::steady_clock::time_point handledTime;
+    int epollFd = -1;
+
+public:
+    using HyperCubeClientCore::sendMsgOut;
+    static int serverPort(void) { return SERVER_PORT; }
+    std::atomic<int> numSendQueueHigh = 0;
+    std::atomic<int> numSendQueueLow = 0;
+
+    virtual void onSendQueueHigh(void) { numSendQueueHigh++; }
+    virtual void onSendQueueLow(void) { numSendQueueLow++; }
+
+    ~BenchClient() {
+        if (epollFd >= 0) close(epollFd);
+    }
+
+    bool waitForConnection(int timeoutMs) {
+        for (int waited = 0; !isConnected() && (waited < timeoutMs); waited += 10) usleep(10000);
+        return isConnected();
+    }
+
+    void setDelivery(DELIVERY delivery) {
+        if (delivery == DELIVERY::HANDLER) {
+            setPacketHandler([this](Packet::UniquePtr& rppacket) {
+                handledTime = std::chrono::steady_clock::now();
+                handled = true;
+            });
+        }
+        if (delivery == DELIVERY::EVENTFD) {
+            epollFd = epoll_create1(0);
+            struct epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.fd = getPacketReadyFd();
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, event.data.fd, &event);
+        }
+    }
+
+    bool receive(DELIVERY delivery, Packet& packet, int timeoutMs) {
+        switch (delivery) {
+            case DELIVERY::POLL:
+                for (int spins = 0; !getPacket(packet); spins++) {
+                    if (spins > timeoutMs * 1000) return false;
+                    usleep(1);
+                }
+                return true;
+            case DELIVERY::WAIT:
+                return waitForPacket(packet, timeoutMs);
+            case DELIVERY::EVENTFD:
+                while (!getPacket(packet)) {
+                    struct epoll_event event;
+                    if (epoll_wait(epollFd, &event, 1, timeoutMs) <= 0) return false;
+                    uint64_t count = 0;
+                    if (read(event.data.fd, &count, sizeof(count)) < 0) {}
+                }
+                return true;
+            case DELIVERY::HANDLER:
+                for (int spins = 0; !handled; spins++) {
+                    if (spins > timeoutMs * 1000) return false;
+                    usleep(1);
+                }
+                handled = false;
+                return true;
+        }
+        return false;
+    }
+
+    /// send and wait for the echo, returns round trip time in seconds or < 0 on timeout
+    double echo(DELIVERY delivery, const std::string& data, int timeoutMs) {
+        Packet packet;
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        MsgCmd cmdMsg(data);
+        if (!sendMsgOut(cmdMsg)) return -1;
+        if (!receive(delivery, packet, timeoutMs)) return -1;
+        std::chrono::steady_clock::time_point endTime = (delivery == DELIVERY::HANDLER) ? handledTime : std::chrono::steady_clock::now();
+        return std::chrono::duration<double>(endTime - startTime).count();
+    }
+};
+
+static const int RTTBENCH_NUMECHOES = 1000;
+
+static bool runRttBench(const std::string& serverIpAddress, HYPERCUBE_THREADINGMODE threadingMode, DELIVERY delivery)
+{
+    std::string modeName = (threadingMode == HYPERCUBE_THREADINGMODE::EVENTLOOP) ? "eventloop" : "threaded";
+    modeName += std::string("/") + deliveryName(delivery);
+    BenchClient client;
+    client.setDelivery(delivery);
+    client.init(serverIpAddress, true, threadingMode);
+    if (!client.waitForConnection(10000)) {
+        cout << "  " << modeName << " : server " << serverIpAddress << " not available\n";
+        client.deinit();
+        return false;
+    }
+    std::vector<double> rtts;
+    std::string data = "ECHO" + std::string(100, 'D');
+    for (int i = 0; i < RTTBENCH_NUMECHOES; i++) {
+        double rtt = client.echo(delivery, data, 1000);
+        if (rtt < 0) break;
+        rtts.push_back(rtt * 1000000.0);
+    }
+    std::string latencyReport = client.latencyReport();
+    client.deinit();
+    if (rtts.empty()) {
+        cout << "  " << modeName << " : no echoes received\n";
+        return false;
+    }
+    std::sort(rtts.begin(), rtts.end());
+    double total = 0;
+    for (double rtt : rtts) total += rtt;
+    cout << "  " << modeName << " : n " << rtts.size() << " avg " << total / rtts.size()
+        << " p50 " << rtts[rtts.size() / 2] << " p99 " << rtts[(rtts.size() * 99) / 100] << " (us)\n";
+    cout << latencyReport;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Send queue backpressure. Floods a connected client with a small queue cap under each policy
+// and reports how many messages were accepted, dropped, refused or had to wait, and how often
+// and for how long the socket itself was full.
+
+static const int BPBENCH_NUMMSGS = 200000;
+static const int BPBENCH_MSGSIZE = 1024;
+
+static const char* policyName(HYPERCUBE_BACKPRESSURE policy)
+{
+    switch (policy) {
+        case HYPERCUBE_BACKPRESSURE::BLOCK: return "block";
+        case HYPERCUBE_BACKPRESSURE::FAILFAST: return "failfast";
+        case HYPERCUBE_BACKPRESSURE::DROPOLDEST: return "dropoldest";
+        case HYPERCUBE_BACKPRESSURE::DROPNEWEST: return "dropnewest";
+    }
+    return "";
+}
+
+static bool runBackpressureBench(const std::string& serverIpAddress, HYPERCUBE_BACKPRESSURE policy, HyperCubeStandInServer* pstandInServer)
+{
+    // a server echoing everything back would stall on a client that is not reading
+    if (pstandInServer) pstandInServer->setEchoData(false);
+    BenchClient client;
+    HyperCubeSendQueueLimits limits;
+    limits.maxBytes = 1024 * 1024;
+    limits.maxPackets = 1024;
+    limits.policy = policy;
+    limits.highWatermarkBytes = limits.maxBytes / 4 * 3;
+    limits.lowWatermarkBytes = limits.maxBytes / 4;
+    client.setSendQueueLimits(limits);
+    client.init(serverIpAddress);
+    if (!client.waitForConnection(10000)) {
+        cout << "  " << policyName(policy) << " : server " << serverIpAddress << " not available\n";
+        client.deinit();
+        return false;
+    }
+    std::string data = "SEND " + std::string(BPBENCH_MSGSIZE, 'D');
+    int numAccepted = 0;
+    uint64_t maxQueuedBytes = 0;
+    ClockGetTime clock;
+    clock.start();
+    for (int i = 0; i < BPBENCH_NUMMSGS; i++) {
+        MsgCmd cmdMsg(data);
+        if (client.sendMsgOut(cmdMsg)) numAccepted++;
+        if ((i & 1023) == 0) maxQueuedBytes = std::max(maxQueuedBytes, client.getSendStats().queuedBytes);
+    }
+    clock.end();
+    HyperCubeSendStats sendStats = client.getSendStats();
+    client.deinit();
+    cout << "  " << policyName(policy) << " : " << (int)(BPBENCH_NUMMSGS / clock.change()) << " msgs/s"
+        << " accepted " << numAccepted << " dropped " << sendStats.numDropped
+        << " rejected " << sendStats.numRejected << " blocked " << sendStats.numBlocked
+        << " high/low " << client.numSendQueueHigh << "/" << client.numSendQueueLow
+        << " max queued " << maxQueuedBytes / 1024 << "KB"
+        << " socket full " << sendStats.numWouldBlock << " for " << sendStats.stallNs / 1000000 << "ms\n";
+    if (pstandInServer) pstandInServer->setEchoData(true);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Benchmark suite. Fixed scenarios at several message sizes, each adding one result to a JSON
+// report so builds can be compared. Data messages are MsgCmd("ECHO...") that the server echoes,
+// except in the flood where the stand-in server only counts them.
+
+#define SUITE_MAXMSGSIZE (COMMON_PACKETSIZE_MAX - 1024)    // leave room for the packet and message headers
+static const int SUITE_MSGSIZES[] = { 64, 1024, 16384, SUITE_MAXMSGSIZE };
+static const int SUITE_WINDOW = 32;                 // echoes in flight in the pipelined scenarios
+static const int SUITE_WINDOWS[] = { 1, 4, 16, 64, 256 };   // swept at 1024B in the window scenario
+static const int SUITE_PINGEVERY = 100;             // data messages per signalling ping in the mixed scenario
+static const int64_t SUITE_BYTESPERRUN = 64 * 1024 * 1024;
+static const int SUITE_TIMEOUTMS = 5000;
+
+struct SuiteContext {
+    BenchClient& rclient;
+    HyperCubeStandInServer* pstandInServer;
+    std::string threadingMode;
+    json results = json::array();
+};
+
+static int suiteNumMsgs(int msgSize, int maxMsgs)
+{
+    return (int)std::max((int64_t)100, std::min((int64_t)maxMsgs, SUITE_BYTESPERRUN / msgSize));
+}
+
+static std::string suitePayload(const char* prefix, int msgSize)
+{
+    std::string payload = prefix;
+    payload.resize(std::max(msgSize, (int)payload.size()), 'D');
+    return payload;
+}
+
+static void suiteDrain(BenchClient& rclient)
+{
+    Packet packet;
+    while (rclient.waitForPacket(packet, 100)) {}
+}
+
+static json latencyToJson(const LatencySnapshot& latency)
+{
+    return {
+        { "count", latency.count },
+        { "p50Us", latency.p50Ns / 1000.0 },
+        { "p99Us", latency.p99Ns / 1000.0 },
+        { "p999Us", latency.p999Ns / 1000.0 },
+        { "maxUs", latency.maxNs / 1000.0 },
+        { "meanUs", latency.meanNs / 1000.0 },
+    };
+}
+
+static void suiteAddResult(SuiteContext& rcontext, const char* scenario, int msgSize, int numMsgs, double seconds,
+    const LatencySnapshot* platency, const LatencySnapshot* psignallingLatency = 0)
+{
+    json result = {
+        { "scenario", scenario },
+        { "threadingMode", rcontext.threadingMode },
+        { "msgSize", msgSize },
+        { "numMsgs", numMsgs },
+        { "seconds", seconds },
+        { "msgsPerSec", (seconds > 0) ? numMsgs / seconds : 0 },
+        { "mbPerSec", (seconds > 0) ? ((double)numMsgs * msgSize) / seconds / 1000000.0 : 0 },
+    };
+    if (platency) result["latency"] = latencyToJson(*platency);
+    if (psignallingLatency) result["signallingLatency"] = latencyToJson(*psignallingLatency);
+    rcontext.results.push_back(result);
+    cout << "  " << rcontext.threadingMode << " " << scenario << " " << msgSize << "B : "
+        << (int)result["msgsPerSec"].get<double>() << " msgs/s " << result["mbPerSec"].get<double>() << " MB/s";
+    if (platency) cout << " p50 " << platency->p50Ns / 1000.0 << " p99 " << platency->p99Ns / 1000.0 << " (us)";
+    cout << "\n";
+}
+
+/// stop and wait, one echo at a time
+static bool suitePingPong(SuiteContext& rcontext, int msgSize)
+{
+    BenchClient& rclient = rcontext.rclient;
+    int numMsgs = suiteNumMsgs(msgSize, 2000);
+    std::string payload = suitePayload("ECHO", msgSize);
+    LatencyHistogram latency;
+    Packet packet;
+    int64_t startNs = latencyNowNs();
+    for (int i = 0; i < numMsgs; i++) {
+        int64_t sentNs = latencyNowNs();
+        MsgCmd cmdMsg(payload);
+        if (!rclient.sendMsgOut(cmdMsg)) return false;
+        if (!rclient.waitForPacket(packet, SUITE_TIMEOUTMS)) return false;
+        latency.record(latencyNowNs() - sentNs);
+    }
+    double seconds = (latencyNowNs() - startNs) / 1e9;
+    LatencySnapshot snapshot = latency.snapshot();
+    suiteAddResult(rcontext, "pingpong", msgSize, numMsgs, seconds, &snapshot);
+    return true;
+}
+
+/// keeps SUITE_WINDOW echoes in flight through EchoWindow. With pingEvery > 0 a signalling
+/// ping goes out every pingEvery messages as well
+static bool suitePipelined(SuiteContext& rcontext, const char* scenario, int msgSize, int pingEvery, int windowSize = SUITE_WINDOW)
+{
+    BenchClient& rclient = rcontext.rclient;
+    int numMsgs = suiteNumMsgs(msgSize, 100000);
+    rclient.resetLatencies();
+    EchoWindow echoWindow(rclient, windowSize, msgSize);
+    echoWindow.setPingEvery(pingEvery);
+    EchoWindowResult result = echoWindow.run(numMsgs, SUITE_TIMEOUTMS);
+    if (result.timedOut) return false;
+    LatencySnapshot signallingSnapshot = rclient.getLatency(HYPERCUBE_LATENCY::SIGNALLINGRTT);
+    suiteAddResult(rcontext, scenario, msgSize, numMsgs, result.seconds, &result.latency, (pingEvery > 0) ? &signallingSnapshot : 0);
+    if (windowSize != SUITE_WINDOW) rcontext.results.back()["window"] = windowSize;
+    return true;
+}
+
+/// one way, as fast as the send queue takes them. Done when the stand-in server has them all,
+/// or against a real server, when the last one is handed to the socket
+static bool suiteFlood(SuiteContext& rcontext, int msgSize)
+{
+    BenchClient& rclient = rcontext.rclient;
+    HyperCubeStandInServer* pstandInServer = rcontext.pstandInServer;
+    int numMsgs = suiteNumMsgs(msgSize, 200000);
+    std::string payload = suitePayload("SEND ", msgSize);
+    if (pstandInServer) {
+        pstandInServer->setEchoData(false);
+        pstandInServer->resetCounts();
+    }
+    int64_t startNs = latencyNowNs();
+    for (int i = 0; i < numMsgs; i++) {
+        MsgCmd cmdMsg(payload);
+        if (!rclient.sendMsgOut(cmdMsg)) break;
+    }
+    int64_t deadlineNs = latencyNowNs() + (int64_t)SUITE_TIMEOUTMS * 1000000;
+    bool done = false;
+    while (!done && (latencyNowNs() < deadlineNs)) {
+        done = pstandInServer ? (pstandInServer->getNumDataPackets() >= (uint64_t)numMsgs) : (rclient.getSendStats().queuedPackets == 0);
+        if (!done) usleep(100);
+    }
+    double seconds = (latencyNowNs() - startNs) / 1e9;
+    if (pstandInServer) pstandInServer->setEchoData(true);
+    if (!done) return false;
+    LatencySnapshot dwell = rclient.getLatency(HYPERCUBE_LATENCY::SENDDWELL);
+    suiteAddResult(rcontext, "flood", msgSize, numMsgs, seconds, &dwell);
+    return true;
+}
+
+static bool runSuite(const std::string& serverIpAddress, HyperCubeStandInServer* pstandInServer, HYPERCUBE_THREADINGMODE threadingMode, json& rresults)
+{
+    BenchClient client;
+    HyperCubeSendQueueLimits limits;
+    limits.policy = HYPERCUBE_BACKPRESSURE::BLOCK;
+    limits.blockTimeoutMs = SUITE_TIMEOUTMS;
+    client.setSendQueueLimits(limits);
+    client.init(serverIpAddress, true, threadingMode);
+    SuiteContext context{ client, pstandInServer, (threadingMode == HYPERCUBE_THREADINGMODE::EVENTLOOP) ? "eventloop" : "threaded" };
+    if (!client.waitForConnection(10000)) {
+        cout << "  " << context.threadingMode << " : server " << serverIpAddress << " not available\n";
+        client.deinit();
+        return false;
+    }
+    for (int msgSize : SUITE_MSGSIZES) {
+        if (!suitePingPong(context, msgSize)) cout << "  pingpong " << msgSize << "B timed out\n";
+        suiteDrain(client);
+        if (!suitePipelined(context, "pipelined", msgSize, 0)) cout << "  pipelined " << msgSize << "B timed out\n";
+        suiteDrain(client);
+        client.resetLatencies();
+        if (!suiteFlood(context, msgSize)) cout << "  flood " << msgSize << "B timed out\n";
+        suiteDrain(client);
+        if (!suitePipelined(context, "mixed", msgSize, SUITE_PINGEVERY)) cout << "  mixed " << msgSize << "B timed out\n";
+        suiteDrain(client);
+    }
+    // how throughput and latency move with the number of echoes in flight on one connection
+    for (int windowSize : SUITE_WINDOWS) {
+        if (!suitePipelined(context, "window", 1024, 0, windowSize)) cout << "  window " << windowSize << " timed out\n";
+        suiteDrain(client);
+    }
+    client.deinit();
+    for (auto& rresult : context.results) rresults.push_back(rresult);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Send lanes. Pings through the server while a bulk flood fills the send queue, for each lane
+// schedule. The ping RTT should stay near the idle one however deep the DATA lane gets.
+
+static const int LANEBENCH_NUMMSGS = 20000;
+static const int LANEBENCH_MSGSIZE = 16384;
+static const int LANEBENCH_PINGEVERY = 200;
+
+static const char* laneName(HYPERCUBE_LANE lane)
+{
+    switch (lane) {
+        case HYPERCUBE_LANE::URGENT: return "urgent";
+        case HYPERCUBE_LANE::SIGNALLING: return "signalling";
+        case HYPERCUBE_LANE::DATA: return "data";
+        default: return "";
+    }
+}
+
+static bool runLaneBench(const std::string& serverIpAddress, HYPERCUBE_LANESCHEDULE schedule, HyperCubeStandInServer* pstandInServer)
+{
+    const char* scheduleName = (schedule == HYPERCUBE_LANESCHEDULE::STRICT) ? "strict" : "weighted";
+    if (pstandInServer) pstandInServer->setEchoData(false);
+    BenchClient client;
+    HyperCubeSendQueueLimits limits;
+    limits.policy = HYPERCUBE_BACKPRESSURE::BLOCK;
+    client.setSendQueueLimits(limits);
+    HyperCubeLaneSchedule laneSchedule;
+    laneSchedule.schedule = schedule;
+    client.setLaneSchedule(laneSchedule);
+    client.init(serverIpAddress);
+    if (!client.waitForConnection(10000)) {
+        cout << "  " << scheduleName << " : server " << serverIpAddress << " not available\n";
+        client.deinit();
+        if (pstandInServer) pstandInServer->setEchoData(true);
+        return false;
+    }
+    // idle RTT first, to compare against
+    client.resetLatencies();
+    for (int i = 0; i < 20; i++) {
+        client.remotePing();
+        usleep(1000);
+    }
+    usleep(100000);
+    LatencySnapshot idle = client.getLatency(HYPERCUBE_LATENCY::SIGNALLINGRTT);
+    client.resetLatencies();
+    std::string payload = suitePayload("SEND ", LANEBENCH_MSGSIZE);
+    for (int i = 0; i < LANEBENCH_NUMMSGS; i++) {
+        MsgCmd cmdMsg(payload);
+        if (!client.sendMsgOut(cmdMsg)) break;
+        if ((i % LANEBENCH_PINGEVERY) == 0) client.remotePing();
+    }
+    for (int waited = 0; (client.getSendStats().queuedPackets > 0) && (waited < 10000); waited++) usleep(1000);
+    usleep(100000);
+    cout << "  " << scheduleName << " : ping rtt idle " << idle.to_string() << "\n";
+    cout << "  " << scheduleName << " : ping rtt under flood " << client.getLatency(HYPERCUBE_LATENCY::SIGNALLINGRTT).to_string() << "\n";
+    for (HYPERCUBE_LANE lane : { HYPERCUBE_LANE::URGENT, HYPERCUBE_LANE::SIGNALLING, HYPERCUBE_LANE::DATA }) {
+        HyperCubeLaneStats laneStats = client.getLaneStats(lane);
+        cout << "  " << scheduleName << " " << laneName(lane) << " : sent " << laneStats.numPacketsSent
+            << " dwell " << laneStats.dwell.to_string() << "\n";
+    }
+    client.deinit();
+    if (pstandInServer) pstandInServer->setEchoData(true);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Sharded connections. The same load through HyperCubeClientPool with 1, 2, 4 and 8 shards.
+// flood: SHARDBENCH_NUMPRODUCERS threads send keyed messages, spread over SHARDBENCH_NUMKEYS
+// keys, until the stand-in server has counted them all.
+// echo: an EchoWindow per shard, each on its own thread, aggregate echoes per second.
+
+static const int SHARDBENCH_SHARDS[] = { 1, 2, 4, 8 };
+static const int SHARDBENCH_NUMPRODUCERS = 4;
+static const int SHARDBENCH_NUMKEYS = 256;
+static const int SHARDBENCH_NUMMSGS = 400000;
+static const int SHARDBENCH_NUMECHOES = 50000;     // per shard
+static const int SHARDBENCH_MSGSIZE = 1024;
+
+static bool shardFlood(HyperCubeClientPool& rpool, HyperCubeStandInServer* pstandInServer, double& rmsgsPerSec)
+{
+    std::string payload = suitePayload("SEND ", SHARDBENCH_MSGSIZE);
+    pstandInServer->setEchoData(false);
+    pstandInServer->resetCounts();
+    int64_t startNs = latencyNowNs();
+    std::vector<std::thread> producers;
+    for (int p = 0; p < SHARDBENCH_NUMPRODUCERS; p++) {
+        producers.emplace_back([&rpool, &payload, p]() {
+            for (int i = p; i < SHARDBENCH_NUMMSGS; i += SHARDBENCH_NUMPRODUCERS) {
+                MsgCmd cmdMsg(payload);
+                if (!rpool.sendMsgOut((uint64_t)(i % SHARDBENCH_NUMKEYS), cmdMsg)) break;
+            }
+        });
+    }
+    for (auto& rproducer : producers) rproducer.join();
+    int64_t deadlineNs = latencyNowNs() + (int64_t)SUITE_TIMEOUTMS * 1000000;
+    while ((pstandInServer->getNumDataPackets() < (uint64_t)SHARDBENCH_NUMMSGS) && (latencyNowNs() < deadlineNs)) usleep(100);
+    double seconds = (latencyNowNs() - startNs) / 1e9;
+    pstandInServer->setEchoData(true);
+    rmsgsPerSec = pstandInServer->getNumDataPackets() / seconds;
+    return pstandInServer->getNumDataPackets() >= (uint64_t)SHARDBENCH_NUMMSGS;
+}
+
+static bool shardEcho(HyperCubeClientPool& rpool, double& rmsgsPerSec)
+{
+    int numShards = rpool.getNumShards();
+    std::vector<EchoWindowResult> results(numShards);
+    std::vector<std::thread> threads;
+    int64_t startNs = latencyNowNs();
+    for (int i = 0; i < numShards; i++) {
+        threads.emplace_back([&rpool, &results, i]() {
+            EchoWindow echoWindow(rpool.getShard(i), SUITE_WINDOW, SHARDBENCH_MSGSIZE);
+            results[i] = echoWindow.run(SHARDBENCH_NUMECHOES, SUITE_TIMEOUTMS);
+        });
+    }
+    for (auto& rthread : threads) rthread.join();
+    double seconds = (latencyNowNs() - startNs) / 1e9;
+    uint64_t numReceived = 0;
+    bool timedOut = false;
+    for (auto& rresult : results) {
+        numReceived += rresult.numReceived;
+        timedOut |= rresult.timedOut;
+    }
+    rmsgsPerSec = numReceived / seconds;
+    return !timedOut;
+}
+
+static bool runShardBench(HyperCubeStandInServer* pstandInServer, HYPERCUBE_THREADINGMODE threadingMode)
+{
+    std::string modeName = (threadingMode == HYPERCUBE_THREADINGMODE::EVENTLOOP) ? "eventloop" : "threaded";
+    if (!pstandInServer) {
+        cout << "  " << modeName << " : needs the local stand-in server\n";
+        return false;
+    }
+    HyperCubeSendQueueLimits limits;
+    limits.policy = HYPERCUBE_BACKPRESSURE::BLOCK;
+    limits.blockTimeoutMs = SUITE_TIMEOUTMS;
+    double baseFlood = 0;
+    double baseEcho = 0;
+    bool passed = true;
+    for (int numShards : SHARDBENCH_SHARDS) {
+        HyperCubeClientPool pool;
+        pool.setSendQueueLimits(limits);
+        pool.init("127.0.0.1", numShards, threadingMode);
+        for (int waited = 0; !pool.isConnected() && (waited < 10000); waited += 10) usleep(10000);
+        if (!pool.isConnected()) {
+            cout << "  " << modeName << " " << numShards << " shards : only " << pool.getNumConnected() << " connected\n";
+            pool.deinit();
+            return false;
+        }
+        double floodMsgsPerSec = 0;
+        double echoMsgsPerSec = 0;
+        bool floodDone = shardFlood(pool, pstandInServer, floodMsgsPerSec);
+        bool echoDone = shardEcho(pool, echoMsgsPerSec);
+        // each shard creates its own group, a failed ack is a shard the server turned down
+        uint64_t numFailedAcks = 0;
+        for (int i = 0; i < numShards; i++) numFailedAcks += pool.getShard(i).getSetupStats().numFailedAcks;
+        pool.deinit();
+        if (numShards == 1) {
+            baseFlood = floodMsgsPerSec;
+            baseEcho = echoMsgsPerSec;
+        }
+        cout << "  " << modeName << " " << numShards << " shards : flood " << (int)floodMsgsPerSec << " msgs/s (x"
+            << (baseFlood > 0 ? floodMsgsPerSec / baseFlood : 0) << ")" << (floodDone ? "" : " timed out")
+            << ", echo " << (int)echoMsgsPerSec << " msgs/s (x" << (baseEcho > 0 ? echoMsgsPerSec / baseEcho : 0) << ")"
+            << (echoDone ? "" : " timed out") << "\n";
+        if (numFailedAcks > 0) {
+            cout << "  " << modeName << " " << numShards << " shards : FAILED, " << numFailedAcks << " setup acks failed\n";
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reconnect. Stops the stand-in server, keeps it down for a while, starts it again and times
+// how long the client takes to get back, from losing the connection to connected.
+
+static const int RECONNECTBENCH_DOWNTIMESMS[] = { 0, 100, 500, 2000 };
+
+static bool runReconnectBench(HyperCubeStandInServer* pstandInServer, HYPERCUBE_THREADINGMODE threadingMode)
+{
+    std::string modeName = (threadingMode == HYPERCUBE_THREADINGMODE::EVENTLOOP) ? "eventloop" : "threaded";
+    if (!pstandInServer) {
+        cout << "  " << modeName << " : needs the local stand-in server\n";
+        return false;
+    }
+    BenchClient client;
+    client.init("127.0.0.1", true, threadingMode);
+    if (!client.waitForConnection(10000)) {
+        cout << "  " << modeName << " : stand-in server not available\n";
+        client.deinit();
+        return false;
+    }
+    bool stat = true;
+    for (int downTimeMs : RECONNECTBENCH_DOWNTIMESMS) {
+        uint64_t failedBefore = client.getReconnectStats().numFailedAttempts;
+        pstandInServer->deinit();
+        for (int waited = 0; client.isConnected() && (waited < 5000); waited++) usleep(1000);
+        usleep(downTimeMs * 1000);
+        pstandInServer->init();
+        if (!client.waitForConnection(RECONNECT_MAXDELAY_MS * 2)) {
+            cout << "  " << modeName << " down " << downTimeMs << "ms : did not reconnect\n";
+            stat = false;
+            break;
+        }
+        ReconnectStats stats = client.getReconnectStats();
+        cout << "  " << modeName << " down " << downTimeMs << "ms : reconnected in " << stats.lastReconnectNs / 1000000.0
+            << "ms after " << stats.numFailedAttempts - failedBefore << " failed attempts\n";
+    }
+    cout << "  " << modeName << " reconnect " << client.getLatency(HYPERCUBE_LATENCY::RECONNECT).to_string() << "\n";
+    client.deinit();
+    return stat;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reliable session. Sends a run of messages and restarts the stand-in server half way through,
+// with and without a reliable session, then counts what the server got. With the session the
+// server should end with every message exactly once, and the client should have resent only
+// what was in flight or unacked when the connection went.
+
+static const int SESSIONBENCH_NUMMSGS = 100000;
+static const int SESSIONBENCH_MSGSIZE = 1024;
+static const int REPLAYCHECK_MAXPACKETS = 4;
+
+static bool replayCheck(const char* what, bool ok)
+{
+    if (!ok) cout << "  replay buffer : FAILED, " << what << "\n";
+    return ok;
+}
+
+/// numbers and keeps seq first..last, as SendActivity does for new packets
+static void replayRetain(ReplayBuffer& rreplayBuffer, uint64_t first, uint64_t last)
+{
+    MSerDes mserdes;
+    for (uint64_t seq = first; seq <= last; seq++) {
+        MsgCmd cmdMsg("SEND " + std::to_string(seq));
+        Packet::UniquePtr ppacket = PacketPool::instance().acquire();
+        mserdes.msgToPacket(cmdMsg, ppacket);
+        rreplayBuffer.reserve(ppacket->getLength());
+        rreplayBuffer.retain(seq, ppacket);
+    }
+}
+
+/// pops numPackets resends, true if they are seq first on in order. Each is kept again, as
+/// once it has been sent
+static bool replayResend(ReplayBuffer& rreplayBuffer, uint64_t first, int numPackets)
+{
+    for (int i = 0; i < numPackets; i++) {
+        uint64_t seq = 0;
+        Packet::UniquePtr ppacket;
+        if (!rreplayBuffer.popResend(seq, ppacket) || (seq != first + i)) return false;
+        rreplayBuffer.retain(seq, ppacket);
+    }
+    return true;
+}
+
+/// ReplayBuffer at its edges, without a server: full, acked past the last packet sent, and
+/// resumed from 0 by a server that got nothing
+static bool checkReplayBuffer(void)
+{
+    ReplayBuffer replayBuffer;
+    ReplayBufferLimits limits;
+    limits.maxPackets = REPLAYCHECK_MAXPACKETS;
+    replayBuffer.setLimits(limits);
+    bool ok = true;
+
+    replayRetain(replayBuffer, 1, REPLAYCHECK_MAXPACKETS);
+    ok &= replayCheck("not full at maxPackets", replayBuffer.isFull());
+    replayBuffer.ack(1);
+    ok &= replayCheck("still full after an ack", !replayBuffer.isFull());
+    ok &= replayCheck("ack released the wrong count", replayBuffer.getStats().bufferedPackets == REPLAYCHECK_MAXPACKETS - 1);
+
+    // an ack past anything sent releases the lot, and must not leave the counts below zero,
+    // which would let more than maxPackets in
+    replayBuffer.ack(REPLAYCHECK_MAXPACKETS * 10);
+    ok &= replayCheck("ack past the last seq left packets", replayBuffer.getStats().bufferedPackets == 0);
+    ok &= replayCheck("ack past the last seq left resends", !replayBuffer.isResendPending());
+    ok &= replayCheck("ack past the last seq moved ackedSeq", replayBuffer.getAckedSeq() == (uint64_t)REPLAYCHECK_MAXPACKETS * 10);
+    for (int i = 0; i < REPLAYCHECK_MAXPACKETS; i++) replayBuffer.reserve(1);
+    ok &= replayCheck("counts off after an ack past the last seq", replayBuffer.isFull());
+    replayBuffer.clear(false);
+
+    uint64_t retransmittedBefore = replayBuffer.getStats().numRetransmitted;
+    replayRetain(replayBuffer, 1, REPLAYCHECK_MAXPACKETS);
+    replayBuffer.resume(0);
+    ok &= replayCheck("resume from 0 has nothing to resend", replayBuffer.isResendPending());
+    // a second reconnect part way through the resend starts again from the first
+    ok &= replayCheck("resume from 0 out of order", replayResend(replayBuffer, 1, 2));
+    replayBuffer.resume(0);
+    ok &= replayCheck("second resume from 0 out of order", replayResend(replayBuffer, 1, REPLAYCHECK_MAXPACKETS));
+    ok &= replayCheck("resends left over", !replayBuffer.isResendPending());
+    ok &= replayCheck("retransmits miscounted",
+        replayBuffer.getStats().numRetransmitted - retransmittedBefore == (uint64_t)REPLAYCHECK_MAXPACKETS + 2);
+    replayBuffer.ack(REPLAYCHECK_MAXPACKETS);
+    ok &= replayCheck("final ack left packets", replayBuffer.getStats().bufferedPackets == 0);
+    replayBuffer.clear(false);
+    if (ok) cout << "  replay buffer : ok\n";
+    return ok;
+}
+
+static bool runSessionBench(bool reliable, HyperCubeStandInServer* pstandInServer)
+{
+    const char* name = reliable ? "reliable" : "plain";
+    if (!pstandInServer) {
+        cout << "  " << name << " : needs the local stand-in server\n";
+        return false;
+    }
+    pstandInServer->setEchoData(false);
+    BenchClient client;
+    HyperCubeSendQueueLimits limits;
+    limits.policy = HYPERCUBE_BACKPRESSURE::BLOCK;
+    limits.blockTimeoutMs = 10000;
+    client.setSendQueueLimits(limits);
+    client.setReliableSession(reliable);
+    client.init("127.0.0.1");
+    if (!client.waitForConnection(10000)) {
+        cout << "  " << name << " : stand-in server not available\n";
+        client.deinit();
+        return false;
+    }
+    pstandInServer->resetCounts();
+    std::string data = "SEND " + std::string(SESSIONBENCH_MSGSIZE, 'D');
+    int numAccepted = 0;
+    ClockGetTime clock;
+    clock.start();
+    for (int i = 0; i < SESSIONBENCH_NUMMSGS; i++) {
+        if (i == SESSIONBENCH_NUMMSGS / 2) {
+            pstandInServer->deinit();
+            pstandInServer->init();
+        }
+        MsgCmd cmdMsg(data);
+        if (client.sendMsgOut(cmdMsg)) numAccepted++;
+    }
+    // until everything is in, or nothing more has arrived for a while
+    uint64_t numReceived = 0;
+    for (int idleMs = 0, waitedMs = 0; (idleMs < 200) && (waitedMs < 10000); idleMs += 10, waitedMs += 10) {
+        if (pstandInServer->getNumDataPackets() != numReceived) idleMs = 0;
+        numReceived = pstandInServer->getNumDataPackets();
+        if (numReceived >= (uint64_t)SESSIONBENCH_NUMMSGS) break;
+        usleep(10000);
+    }
+    clock.end();
+    HyperCubeSessionStats sessionStats = client.getSessionStats();
+    client.deinit();
+    uint64_t numOnce = reliable ? pstandInServer->getSessionSeq(sessionStats.sessionId) : 0;
+    cout << "  " << name << " : accepted " << numAccepted << " received " << numReceived;
+    if (reliable) {
+        cout << " once " << numOnce
+            << " resent " << sessionStats.replay.numRetransmitted << " (" << sessionStats.replay.retransmittedBytes / 1024 << "KB)"
+            << " resumes " << sessionStats.numResumes << " full " << sessionStats.numFullStalls
+            << " buffered " << sessionStats.replay.bufferedPackets;
+    }
+    cout << " in " << clock.change() << "s\n";
+    pstandInServer->setEchoData(true);
+    // without a session what was in flight is lost, with one every accepted message arrives once
+    if (reliable && (numOnce != (uint64_t)numAccepted)) {
+        cout << "  " << name << " : FAILED, server has " << numOnce << " of " << numAccepted << " accepted\n";
+        return false;
+    }
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Connection setup. Restarts the stand-in server a number of times and times each reconnect
+// from tcp connected until every setup command is acked and until open for data. With resume
+// the setup is CONNECTIONINFO alone, without it the whole handshake is pipelined.
+
+static const int SETUPBENCH_NUMRECONNECTS = 20;
+
+static bool runSetupBench(bool resume, HyperCubeStandInServer* pstandInServer)
+{
+    const char* name = resume ? "resume" : "full";
+    if (!pstandInServer) {
+        cout << "  " << name << " : needs the local stand-in server\n";
+        return false;
+    }
+    BenchClient client;
+    client.setConnectionResume(resume);
+    client.init("127.0.0.1");
+    bool stat = true;
+    for (int i = 0; stat && (i <= SETUPBENCH_NUMRECONNECTS); i++) {
+        if (i > 0) {
+            pstandInServer->deinit();
+            for (int waited = 0; client.isConnected() && (waited < 5000); waited++) usleep(1000);
+            pstandInServer->init();
+        }
+        uint64_t numOpened = client.getLatency(HYPERCUBE_LATENCY::OPENFORDATA).count;
+        stat = client.waitForConnection(10000);
+        for (int waited = 0; stat && (waited < 5000); waited++) {
+            if ((client.getSetupStats().pendingAcks == 0) && (client.getLatency(HYPERCUBE_LATENCY::OPENFORDATA).count > numOpened)) break;
+            usleep(1000);
+        }
+        // the first connect has nothing to resume, only the reconnects are timed
+        if (i == 0) client.resetLatencies();
+    }
+    if (!stat) cout << "  " << name << " : stand-in server not available\n";
+    HyperCubeSetupStats setupStats = client.getSetupStats();
+    cout << "  " << name << " : setups " << setupStats.numSetups << " resumed " << setupStats.numResumed
+        << " fallbacks " << setupStats.numFallbacks << " failed acks " << setupStats.numFailedAcks << "\n";
+    cout << "    setup       " << client.getLatency(HYPERCUBE_LATENCY::SETUP).to_string() << "\n";
+    cout << "    openForData " << client.getLatency(HYPERCUBE_LATENCY::OPENFORDATA).to_string() << "\n";
+    client.deinit();
+    return stat;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Binary signalling codec over a connection, see runSigCodecBench() for the codec alone
+
+static const int CODECBENCH_NUMREQUESTS = 100;
+
+/// a client and the stand-in that both take the binary codec. Requests sent once the
+/// connection is set up go out binary and their acks come back binary
+static bool runSigCodecEndToEnd(HyperCubeStandInServer* pstandInServer)
+{
+    if (!pstandInServer) {
+        cout << "  end to end : needs the local stand-in server\n";
+        return true;
+    }
+    pstandInServer->setSigCodec(true);
+    BenchClient client;
+    client.init("127.0.0.1");
+    bool stat = client.waitForConnection(10000);
+    for (int waited = 0; stat && (client.getSetupStats().pendingAcks != 0) && (waited < 5000); waited++) usleep(1000);
+    uint64_t numBinaryBefore = pstandInServer->getNumBinarySigCommands();
+    int numMatched = 0;
+    for (int i = 0; stat && (i < CODECBENCH_NUMREQUESTS); i++) {
+        std::string data = "sigCodec" + std::to_string(i);
+        RequestReply reply = ((i & 1) ? client.echoDataAsync(data) : client.remotePingAsync(data)).get();
+        StringInfo stringInfo;
+        if (reply.acked) stringInfo.from_json(reply.jsonData);
+        if (reply.acked && reply.status && (stringInfo.data == data)) numMatched++;
+    }
+    uint64_t numBinary = pstandInServer->getNumBinarySigCommands() - numBinaryBefore;
+    client.deinit();
+    pstandInServer->setSigCodec(false);
+    stat = stat && (numMatched == CODECBENCH_NUMREQUESTS) && (numBinary >= (uint64_t)CODECBENCH_NUMREQUESTS);
+    cout << "  end to end : " << numMatched << "/" << CODECBENCH_NUMREQUESTS << " acks matched, "
+        << numBinary << " binary commands at the server" << (stat ? "" : " FAILED") << "\n";
+    return stat;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Signalling requests. Remote pings with up to window of them outstanding at once, each
+// resolved by its own ack through the correlation id. A window of 1 is one request per round trip.
+
+static const int REQUESTBENCH_NUMREQUESTS = 5000;
+static const int REQUESTBENCH_WINDOWS[] = { 1, 16, 256 };
+
+static bool runRequestBench(const std::string& serverIpAddress, int window)
+{
+    BenchClient client;
+    client.init(serverIpAddress);
+    if (!client.waitForConnection(5000)) {
+        cout << "  window " << window << " : server not available\n";
+        client.deinit();
+        return false;
+    }
+    for (int waited = 0; (client.getSetupStats().pendingAcks != 0) && (waited < 5000); waited++) usleep(1000);
+    client.resetLatencies();
+    RequestStats startStats = client.getRequestStats();
+
+    std::vector<std::future<RequestReply>> replies;
+    replies.reserve(window);
+    uint64_t numAcked = 0;
+    ClockGetTime cgt;
+    cgt.start();
+    for (int sent = 0; sent < REQUESTBENCH_NUMREQUESTS;) {
+        for (; (sent < REQUESTBENCH_NUMREQUESTS) && ((int)replies.size() < window); sent++) {
+            replies.push_back(client.remotePingAsync("requestBench"));
+        }
+        // the oldest is acked first, its slot goes to the next request
+        if (replies.front().get().acked) numAcked++;
+        replies.erase(replies.begin());
+        if (sent == REQUESTBENCH_NUMREQUESTS) {
+            for (auto& rreply : replies) if (rreply.get().acked) numAcked++;
+            replies.clear();
+        }
+    }
+    cgt.end();
+
+    RequestStats requestStats = client.getRequestStats();
+    cout << "  window " << window << " : " << (uint64_t)(REQUESTBENCH_NUMREQUESTS / cgt.change()) << " requests/s, acked "
+        << numAcked << "/" << REQUESTBENCH_NUMREQUESTS << " timed out " << (requestStats.numTimedOut - startStats.numTimedOut)
+        << " unmatched " << (requestStats.numUnmatched - startStats.numUnmatched) << " max outstanding " << requestStats.maxOutstanding << "\n";
+    cout << "    ack " << client.getLatency(HYPERCUBE_LATENCY::SIGNALLINGRTT).to_string() << "\n";
+    client.deinit();
+    return numAcked == REQUESTBENCH_NUMREQUESTS;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Metrics. Cost of one counter update with every thread counting the same metric, the
+// registry's per thread slots against one shared atomic, and of writing the snapshot.
+
+static const int METRICSBENCH_NUMCOUNTS = 10000000;     // per thread
+static const int METRICSBENCH_THREADS[] = { 1, 2, 4, 8 };
+
+template <class COUNT>
+static double benchMetricCount(int numThreads, COUNT count)
+{
+    std::vector<std::thread> threads;
+    ClockGetTime cgt;
+    cgt.start();
+    for (int t = 0; t < numThreads; t++) {
+        threads.emplace_back([&count]() {
+            for (int i = 0; i < METRICSBENCH_NUMCOUNTS; i++) count();
+        });
+    }
+    for (auto& rthread : threads) rthread.join();
+    cgt.end();
+    return (cgt.change() / METRICSBENCH_NUMCOUNTS) * 1000000000.0;
+}
+
+static bool runMetricsBench(void)
+{
+    cout << "Metrics benchmark, ns per count, per thread\n";
+    bool stat = true;
+    for (int numThreads : METRICSBENCH_THREADS) {
+        MetricsRegistry registry;
+        int counter = registry.addCounter("bench_messages_total", "Counted by the bench.");
+        double registryNs = benchMetricCount(numThreads, [&registry, counter]() { registry.add(counter); });
+        std::atomic<uint64_t> shared{ 0 };
+        double sharedNs = benchMetricCount(numThreads, [&shared]() { shared.fetch_add(1, std::memory_order_relaxed); });
+        bool counted = (registry.get(counter) == (int64_t)numThreads * METRICSBENCH_NUMCOUNTS);
+        stat = stat && counted;
+        cout << "  " << numThreads << " threads : registry " << registryNs << ", shared atomic " << sharedNs
+            << (counted ? "" : " MISCOUNTED") << "\n";
+    }
+
+    HyperCubeMetrics metrics;
+    std::string path = "/tmp/hyperCubeClientBench.prom";
+    ClockGetTime cgt;
+    cgt.start();
+    for (int i = 0; i < 1000; i++) metrics.registry.exportFile(path);
+    cgt.end();
+    cout << "  export to " << path << " : " << cgt.change() * 1000.0 << " us\n";
+    return stat;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Logging. Cost of one log call with a bit of command text, building the line and logging it
+// on the calling thread as the signalling path used to, against queueing an AsyncLog record.
+// Then remote pings one at a time, with the signalling logs formatted inline or queued.
+
+static const int LOGBENCH_NUMCALLS = 200000;        // per thread
+static const int LOGBENCH_THREADS[] = { 1, 4 };
+static const int LOGBENCH_NUMPINGS = 5000;
+
+template <class LOGCALL>
+static double benchLogCall(int numThreads, LOGCALL logCall)
+{
+    std::vector<std::thread> threads;
+    ClockGetTime cgt;
+    cgt.start();
+    for (int t = 0; t < numThreads; t++) {
+        threads.emplace_back([&logCall]() {
+            for (int i = 0; i < LOGBENCH_NUMCALLS; i++) logCall(i);
+        });
+    }
+    for (auto& rthread : threads) rthread.join();
+    cgt.end();
+    return (cgt.change() / LOGBENCH_NUMCALLS) * 1000000000.0;
+}
+
+static bool runLogBench(const std::string& serverIpAddress)
+{
+    cout << "Logging benchmark, ns per call, per thread\n";
+    const std::string commandText = "{\"command\":\"SUBSCRIBER\",\"jsonData\":{\"groupName\":\"TeamPegasus\"}}";
+    for (int numThreads : LOGBENCH_THREADS) {
+        double syncNs = benchLogCall(numThreads, [&commandText](int i) {
+            LOG_INFO("hyperCubeClientBench::runLogBench()", "received subscriber" + commandText, i);
+        });
+        AsyncLog::instance().flush();
+        AsyncLogStats startStats = AsyncLog::instance().getStats();
+        double asyncNs = benchLogCall(numThreads, [&commandText](int i) {
+            ALOG_INFO("hyperCubeClientBench::runLogBench()", "received subscriber", i, commandText);
+        });
+        AsyncLog::instance().flush();
+        AsyncLogStats logStats = AsyncLog::instance().getStats();
+        cout << "  " << numThreads << " threads : inline " << syncNs << ", queued " << asyncNs << ", dropped "
+            << (logStats.numDropped - startStats.numDropped) << "/" << (uint64_t)numThreads * LOGBENCH_NUMCALLS << "\n";
+    }
+
+    bool stat = true;
+    for (bool async : { false, true }) {
+        AsyncLog::instance().setAsync(async);
+        BenchClient client;
+        client.init(serverIpAddress);
+        if (!client.waitForConnection(5000)) {
+            cout << "  remote pings : server not available\n";
+            client.deinit();
+            stat = false;
+            break;
+        }
+        for (int waited = 0; (client.getSetupStats().pendingAcks != 0) && (waited < 5000); waited++) usleep(1000);
+        client.resetLatencies();
+        int numAcked = 0;
+        ClockGetTime cgt;
+        cgt.start();
+        for (int i = 0; i < LOGBENCH_NUMPINGS; i++) {
+            if (client.remotePingAsync("logBench").get().acked) numAcked++;
+        }
+        cgt.end();
+        cout << "  remote pings, logs " << (async ? "queued" : "inline") << " : " << (uint64_t)(LOGBENCH_NUMPINGS / cgt.change())
+            << " requests/s, acked " << numAcked << "/" << LOGBENCH_NUMPINGS << "\n";
+        cout << "    ack " << client.getLatency(HYPERCUBE_LATENCY::SIGNALLINGRTT).to_string() << "\n";
+        client.deinit();
+    }
+    AsyncLog::instance().setAsync(true);
+    return stat;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Coroutine sessions. Each logical session waits for open for data, then sends a packet and
+// awaits an echo, a number of times over. All of them share the client's threads. Only built
+// with C++20 coroutines, make CXXSTD=c++20
+
+#ifdef HYPERCUBE_COROUTINES
+
+static const int AWAITBENCH_SESSIONS[] = { 1, 100, 1000 };
+static const int AWAITBENCH_NUMROUNDS = 100;         // per session
+
+static HyperCubeTask awaitBenchSession(HyperCubeAwaitClient& rclient, std::atomic<int>& rnumDone, std::atomic<int>& rnumEchoes)
+{
+    if (co_await rclient.openForData()) {
+        for (int round = 0; round < AWAITBENCH_NUMROUNDS; round++) {
+            MsgCmd cmdMsg("SEND awaitBench");
+            if (!co_await rclient.send(cmdMsg)) break;
+            Packet::UniquePtr ppacket = co_await rclient.nextPacket();
+            if (!ppacket) break;
+            PacketPool::instance().recycle(ppacket);
+            rnumEchoes++;
+        }
+    }
+    rnumDone++;
+}
+
+static bool runAwaitBench(const std::string& serverIpAddress, int numSessions)
+{
+    HyperCubeAwaitClient client;
+    client.init(serverIpAddress);
+    std::atomic<int> numDone = 0;
+    std::atomic<int> numEchoes = 0;
+    ClockGetTime cgt;
+    cgt.start();
+    for (int i = 0; i < numSessions; i++) awaitBenchSession(client, numDone, numEchoes).detach();
+    for (int waited = 0; (numDone < numSessions) && (waited < 30000); waited++) usleep(1000);
+    cgt.end();
+    bool stat = (numDone == numSessions);
+    // lets any session still waiting finish empty handed
+    client.deinit();
+    for (int waited = 0; (numDone < numSessions) && (waited < 1000); waited++) usleep(1000);
+    cout << "  sessions " << numSessions << " : " << numEchoes << " echoes in " << cgt.change() << "s, "
+        << (uint64_t)(numEchoes / cgt.change()) << " echoes/s" << (stat ? "" : ", timed out") << "\n";
+    return stat;
+}
+
+#endif
+
+// ------------------------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    printf("HyperCubeClient Bench\n");
+    printf("---------------------\n");
+
+    std::string scenario = (argc > 1) ? argv[1] : "all";
+    std::string serverIpAddress = (argc > 2) ? argv[2] : "127.0.0.1";
+    std::string jsonFileName = (argc > 3) ? argv[3] : "";
+
+    // stand in for the server on this host, unless one is already listening on the port
+    HyperCubeStandInServer standInServer(BenchClient::serverPort());
+    HyperCubeStandInServer* pstandInServer = 0;
+    if ((serverIpAddress == "127.0.0.1") && standInServer.init()) pstandInServer = &standInServer;
+    cout << "Server: " << (pstandInServer ? "local stand-in" : serverIpAddress) << "\n";
+    int numFailed = 0;      // scenarios that check correctness as well as timing
+
+    if ((scenario == "all") || (scenario == "queue")) runQueueBench();
+    if ((scenario == "all") || (scenario == "pool")) runPoolBench();
+    if ((scenario == "all") || (scenario == "sigcodec")) {
+        if (!runSigCodecBench()) numFailed++;
+        if (!runSigCodecEndToEnd(pstandInServer)) numFailed++;
+    }
+    if ((scenario == "all") || (scenario == "compression")) runLzCodecBench();
+    if ((scenario == "all") || (scenario == "classify")) runClassifyBench();
+    if ((scenario == "all") || (scenario == "dispatch")) runDispatchBench();
+    if ((scenario == "all") || (scenario == "rtt")) {
+        cout << "Echo round trip benchmark\n";
+        for (HYPERCUBE_THREADINGMODE threadingMode : { HYPERCUBE_THREADINGMODE::THREADED, HYPERCUBE_THREADINGMODE::EVENTLOOP }) {
+            for (DELIVERY delivery : { DELIVERY::POLL, DELIVERY::WAIT, DELIVERY::EVENTFD, DELIVERY::HANDLER }) {
+                runRttBench(serverIpAddress, threadingMode, delivery);
+            }
+        }
+    }
+    if ((scenario == "all") || (scenario == "backpressure")) {
+        cout << "Send queue backpressure benchmark\n";
+        for (HYPERCUBE_BACKPRESSURE policy : { HYPERCUBE_BACKPRESSURE::BLOCK, HYPERCUBE_BACKPRESSURE::FAILFAST,
+            HYPERCUBE_BACKPRESSURE::DROPOLDEST, HYPERCUBE_BACKPRESSURE::DROPNEWEST }) {
+            runBackpressureBench(serverIpAddress, policy, pstandInServer);
+        }
+    }
+    if ((scenario == "all") || (scenario == "lanes")) {
+        cout << "Send lane benchmark, pings during a " << LANEBENCH_MSGSIZE << "B flood\n";
+        for (HYPERCUBE_LANESCHEDULE schedule : { HYPERCUBE_LANESCHEDULE::STRICT, HYPERCUBE_LANESCHEDULE::WEIGHTED }) {
+            runLaneBench(serverIpAddress, schedule, pstandInServer);
+        }
+    }
+    if ((scenario == "all") || (scenario == "suite")) {
+        cout << "Benchmark suite\n";
+        json report = {
+            { "benchmark", "hyperCubeClientBench" },
+            { "server", pstandInServer ? "standin" : serverIpAddress },
+            { "results", json::array() },
+        };
+        for (HYPERCUBE_THREADINGMODE threadingMode : { HYPERCUBE_THREADINGMODE::THREADED, HYPERCUBE_THREADINGMODE::EVENTLOOP }) {
+            runSuite(serverIpAddress, pstandInServer, threadingMode, report["results"]);
+        }
+        if (jsonFileName.empty()) {
+            cout << report.dump(2) << "\n";
+        }
+        else {
+            std::ofstream jsonFile(jsonFileName);
+            jsonFile << report.dump(2) << "\n";
+            cout << "Results written to " << jsonFileName << "\n";
+        }
+    }
+    if ((scenario == "all") || (scenario == "shards")) {
+        cout << "Sharded connection benchmark, " << SHARDBENCH_MSGSIZE << "B messages\n";
+        for (HYPERCUBE_THREADINGMODE threadingMode : { HYPERCUBE_THREADINGMODE::THREADED, HYPERCUBE_THREADINGMODE::EVENTLOOP }) {
+            if (!runShardBench(pstandInServer, threadingMode) && pstandInServer) numFailed++;
+        }
+    }
+    if ((scenario == "all") || (scenario == "reconnect")) {
+        cout << "Reconnect benchmark\n";
+        for (HYPERCUBE_THREADINGMODE threadingMode : { HYPERCUBE_THREADINGMODE::THREADED, HYPERCUBE_THREADINGMODE::EVENTLOOP }) {
+            runReconnectBench(pstandInServer, threadingMode);
+        }
+    }
+    if ((scenario == "all") || (scenario == "setup")) {
+        cout << "Connection setup benchmark, " << SETUPBENCH_NUMRECONNECTS << " reconnects\n";
+        for (bool resume : { false, true }) runSetupBench(resume, pstandInServer);
+    }
+    if ((scenario == "all") || (scenario == "session")) {
+        cout << "Reliable session benchmark, server restarted half way through " << SESSIONBENCH_NUMMSGS << " messages\n";
+        if (!checkReplayBuffer()) numFailed++;
+        for (bool reliable : { false, true }) {
+            if (!runSessionBench(reliable, pstandInServer) && pstandInServer) numFailed++;
+        }
+    }
+    if ((scenario == "all") || (scenario == "requests")) {
+        cout << "Signalling request benchmark, " << REQUESTBENCH_NUMREQUESTS << " remote pings\n";
+        for (int window : REQUESTBENCH_WINDOWS) runRequestBench(serverIpAddress, window);
+    }
+    if ((scenario == "all") || (scenario == "metrics")) runMetricsBench();
+    if ((scenario == "all") || (scenario == "logging")) runLogBench(serverIpAddress);
+#ifdef HYPERCUBE_COROUTINES
+    if ((scenario == "all") || (scenario == "await")) {
+        cout << "Coroutine session benchmark, " << AWAITBENCH_NUMROUNDS << " echoes per session\n";
+        for (int numSessions : AWAITBENCH_SESSIONS) runAwaitBench(serverIpAddress, numSessions);
+    }
+#endif
+    standInServer.deinit();
+    if (numFailed > 0) cout << numFailed << " scenarios FAILED\n";
+    return (numFailed > 0) ? 1 : 0;
+}
@@ -0,0 +1,387 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <random>
+
+#include "Logger.h"
+#include "hyperCubeStandInServer.h"
+
+// ------------------------------------------------------------------------------------------------
+
+HyperCubeStandInServer::HyperCubeStandInServer(int _port) :
+    CstdThread(this),
+    port{ _port }
+{
+}
+
+HyperCubeStandInServer::~HyperCubeStandInServer()
+{
+    deinit();
+}
+
+bool HyperCubeStandInServer::init(void)
+{
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd < 0) return false;
+    int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0) || (listen(listenFd, 16) < 0)) {
+        LOG_WARNING("HyperCubeStandInServer::init()", "port not available", port);
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    CstdThread::init(true);
+    return true;
+}
+
+bool HyperCubeStandInServer::deinit(void)
+{
+    if (listenFd < 0) return true;
+    CstdThread::setShouldExit();
+    CstdThread::deinit(true);
+    closeConnections(false);
+    close(listenFd);
+    listenFd = -1;
+    return true;
+}
+
+/// poll with a short timeout, so setShouldExit() is seen without a wakeup fd
+bool HyperCubeStandInServer::threadFunction(void)
+{
+    LOG_INFO("HyperCubeStandInServer::threadFunction()", "ThreadStarted", port);
+    while (!checkIfShouldExit()) {
+        struct pollfd pollFd = { listenFd, POLLIN, 0 };
+        if ((poll(&pollFd, 1, 100) > 0) && (pollFd.revents & POLLIN)) acceptClient();
+        closeConnections(true);
+    }
+    exiting();
+    return true;
+}
+
+bool HyperCubeStandInServer::acceptClient(void)
+{
+    int fd = accept(listenFd, 0, 0);
+    if (fd < 0) return false;
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    std::unique_ptr<Connection> pconnection(new Connection(*this, fd));
+    pconnection->init();
+    connections.push_back(std::move(pconnection));
+    numConnections++;
+    return true;
+}
+
+uint64_t HyperCubeStandInServer::getSessionSeq(uint64_t sessionId)
+{
+    std::lock_guard<std::mutex> guard(sessionsLock);
+    auto it = sessions.find(sessionId);
+    return (it == sessions.end()) ? 0 : (uint64_t)*it->second;
+}
+
+/// false if another connection has the name, and is not the same creator come back
+bool HyperCubeStandInServer::addGroup(const Connection* powner, const std::string& name, const std::string& creator)
+{
+    std::lock_guard<std::mutex> guard(sessionsLock);
+    auto it = groups.find(name);
+    if ((it != groups.end()) && (it->second.powner != powner) && (it->second.creator != creator)) return false;
+    Group& rgroup = groups[name];
+    rgroup.powner = powner;
+    rgroup.creator = creator;
+    return true;
+}
+
+void HyperCubeStandInServer::releaseGroups(const Connection* powner)
+{
+    std::lock_guard<std::mutex> guard(sessionsLock);
+    for (auto it = groups.begin(); it != groups.end();) {
+        if (it->second.powner == powner) it = groups.erase(it);
+        else ++it;
+    }
+}
+
+/// closedOnly reaps the connections whose client has gone, otherwise all of them are closed
+void HyperCubeStandInServer::closeConnections(bool closedOnly)
+{
+    for (auto it = connections.begin(); it != connections.end();) {
+        if (closedOnly && !(*it)->isClosed()) {
+            ++it;
+            continue;
+        }
+        (*it)->deinit();
+        it = connections.erase(it);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+
+HyperCubeStandInServer::Connection::Connection(HyperCubeStandInServer& _rserver, int _fd) :
+    CstdThread(this),
+    rserver{ _rserver },
+    fd{ _fd },
+    recvPacketBuilder(*this, COMMON_PACKETSIZE_MAX),
+    recvBuffer(STANDIN_RECVBUFFER_SIZE)
+{
+}
+
+HyperCubeStandInServer::Connection::~Connection()
+{
+    deinit();
+}
+
+bool HyperCubeStandInServer::Connection::init(void)
+{
+    recvPacketBuilder.init();
+    pinputPacket = Packet::create();
+    CstdThread::init(true);
+    return true;
+}
+
+bool HyperCubeStandInServer::Connection::deinit(void)
+{
+    if (fd < 0) return true;
+    CstdThread::setShouldExit();
+    // unblocks a recv() waiting for the rest of a packet
+    shutdown(fd, SHUT_RDWR);
+    CstdThread::deinit(true);
+    close(fd);
+    fd = -1;
+    recvPacketBuilder.deinit();
+    return true;
+}
+
+bool HyperCubeStandInServer::Connection::threadFunction(void)
+{
+    while (!checkIfShouldExit() && !closed) {
+        struct pollfd pollFd = { fd, POLLIN, 0 };
+        if (poll(&pollFd, 1, 100) <= 0) continue;
+        if ((pollFd.revents & (POLLIN | POLLHUP | POLLERR)) && !readPackets()) closed = true;
+    }
+    // straight away, the client may already be reconnecting to create them again
+    rserver.releaseGroups(this);
+    exiting();
+    return true;
+}
+
+/// one recv(), then every complete packet in it. False once the client has gone
+bool HyperCubeStandInServer::Connection::readPackets(void)
+{
+    recvAllowed = true;
+    while (true) {
+        readWouldBlock = false;
+        RecvPacketBuilder::READSTATUS readStatus = recvPacketBuilder.readPacket(*pinputPacket);
+        if (readWouldBlock && (readStatus != RecvPacketBuilder::READSTATUS::NEEDEDDATAREAD)) return true;
+        if (readStatus == RecvPacketBuilder::READSTATUS::MOREDATANEEDED) return true;
+        if (readStatus != RecvPacketBuilder::READSTATUS::NEEDEDDATAREAD) return false;
+
+        Msg msg;
+        if (!mserdes.packetToMsg(pinputPacket.get(), msg)) continue;
+        if (msg.subSys == SUBSYS_SIG) {
+            onSigMsg(pinputPacket.get());
+            continue;
+        }
+        rserver.numDataPackets++;
+        rserver.numDataBytes += pinputPacket->getLength();
+        if (psessionSeq) {
+            uint64_t seq = ++*psessionSeq;
+            if ((sessionAckEvery > 0) && ((seq % sessionAckEvery) == 0) && !sendSessionAck()) return false;
+        }
+        if (rserver.echoData && !sendPacket(*pinputPacket)) return false;
+    }
+}
+
+int HyperCubeStandInServer::Connection::readData(void* pdata, int dataLen)
+{
+    if (recvBufferHead == recvBufferTail) {
+        if (!recvAllowed) {
+            readWouldBlock = true;
+            return 0;
+        }
+        recvAllowed = false;
+        recvBufferHead = 0;
+        recvBufferTail = 0;
+        int res = (int)recv(fd, recvBuffer.data(), recvBuffer.size(), 0);
+        if (res <= 0) return res;
+        recvBufferTail = res;
+    }
+    int numToCopy = std::min(dataLen, recvBufferTail - recvBufferHead);
+    memcpy(pdata, &recvBuffer[recvBufferHead], numToCopy);
+    recvBufferHead += numToCopy;
+    return numToCopy;
+}
+
+/// ack what HyperCubeClientCore::SignallingObject sends. Other commands are counted and ignored
+bool HyperCubeStandInServer::Connection::onSigMsg(const Packet* ppacket)
+{
+    rserver.numSigCommands++;
+    MsgJson msgJson;
+    if (!mserdes.packetToMsg(ppacket, msgJson)) return false;
+    try {
+        json jsonData = json::object();
+        HyperCubeCommand hyperCubeCommand(HYPERCUBECOMMANDS::NONE, NULL, true);
+        // acks echo the command's correlation id
+        json ackFields = json::object();
+        if (SigCodec::isBinary(msgJson.jsonData)) {
+            uint32_t correlationId = 0;
+            if (!SigCodec::decode(msgJson.jsonData, hyperCubeCommand, correlationId)) return false;
+            rserver.numBinarySigCommands++;
+            if (correlationId != 0) ackFields["correlationId"] = correlationId;
+        }
+        else {
+            jsonData = json::parse(msgJson.jsonData);
+            if (jsonData.contains("session")) return sendSessionAck();
+            hyperCubeCommand.from_json(jsonData);
+            if (jsonData.contains("correlationId")) ackFields["correlationId"] = jsonData["correlationId"];
+        }
+        switch (hyperCubeCommand.command) {
+            case HYPERCUBECOMMANDS::CONNECTIONINFO:
+            {
+                json capabilities;
+                bool resumed = false;
+                if (rserver.sigCodec && jsonData.contains("capabilities") && jsonData["capabilities"].contains("sigCodecs")) {
+                    const json& sigCodecs = jsonData["capabilities"]["sigCodecs"];
+                    if (std::find(sigCodecs.begin(), sigCodecs.end(), SIGCODEC_NAME) != sigCodecs.end()) {
+                        capabilities["sigCodec"] = SIGCODEC_NAME;
+                        capabilities["correlationIds"] = true;
+                    }
+                }
+                if (jsonData.contains("capabilities") && jsonData["capabilities"].contains("session")) {
+                    capabilities["session"] = openSession(jsonData["capabilities"]["session"]);
+                }
+                if (jsonData.contains("capabilities") && jsonData["capabilities"].contains("resume")) {
+                    capabilities["resume"] = resumeConnection(jsonData["capabilities"]["resume"], resumed);
+                }
+                if (!capabilities.is_null()) ackFields["capabilities"] = capabilities;
+                if (!sendCmd(HYPERCUBECOMMANDS::CONNECTIONINFOACK, hyperCubeCommand.getJsonData(), false, ackFields)) return false;
+                // the ack that offers the codec is JSON, everything after it binary
+                binarySigCodec = capabilities.contains("sigCodec");
+                return !resumed || sendCmd(HYPERCUBECOMMANDS::SUBSCRIBER, json::object(), false);
+            }
+            case HYPERCUBECOMMANDS::CREATEGROUP:
+                return onCreateGroup(hyperCubeCommand, ackFields);
+            case HYPERCUBECOMMANDS::REMOTEPING:
+            case HYPERCUBECOMMANDS::LOCALPING:
+            case HYPERCUBECOMMANDS::ECHODATA:
+                if (hyperCubeCommand.ack) return true;
+                return sendCmd(hyperCubeCommand.command, hyperCubeCommand.getJsonData(), true, ackFields);
+            default:
+                return true;
+        }
+    }
+    catch (...) {
+        LOG_WARNING("HyperCubeStandInServer::Connection::onSigMsg()", "Failed to decode json", 0);
+    }
+    return false;
+}
+
+bool HyperCubeStandInServer::Connection::onCreateGroup(HyperCubeCommand& rhyperCubeCommand, const json& ackFields)
+{
+    GroupInfo groupInfo;
+    groupInfo.from_json(rhyperCubeCommand.getJsonData());
+    std::string creator = groupInfo.creatorConnectionInfo.to_json().dump();
+    if (!rserver.addGroup(this, groupInfo.groupName, creator)) {
+        LOG_WARNING("HyperCubeStandInServer::Connection::onCreateGroup()", "duplicate group name " + groupInfo.groupName, 0);
+        return sendCmd(HYPERCUBECOMMANDS::CREATEGROUPACK, rhyperCubeCommand.getJsonData(), false, ackFields, false);
+    }
+    if (!sendCmd(HYPERCUBECOMMANDS::CREATEGROUPACK, rhyperCubeCommand.getJsonData(), false, ackFields)) return false;
+    return sendCmd(HYPERCUBECOMMANDS::SUBSCRIBER, json::object(), false);
+}
+
+/// A session the server does not know starts from what the client says was acked, so a
+/// restarted server picks up where the client's replay buffer starts
+json HyperCubeStandInServer::Connection::openSession(const json& offer)
+{
+    uint64_t sessionId = offer.value("id", (uint64_t)0);
+    {
+        std::lock_guard<std::mutex> guard(rserver.sessionsLock);
+        auto& rpsessionSeq = rserver.sessions[sessionId];
+        if (!rpsessionSeq) rpsessionSeq = std::make_shared<std::atomic<uint64_t>>(offer.value("acked", (uint64_t)0));
+        psessionSeq = rpsessionSeq;
+    }
+    sessionAckEvery = offer.value("ackEvery", 0);
+    return { { "id", sessionId }, { "received", (uint64_t)*psessionSeq } };
+}
+
+/// A token this server handed out restores the connection, its group is still there.
+/// Otherwise a new token is issued for next time
+json HyperCubeStandInServer::Connection::resumeConnection(const json& offer, bool& rresumed)
+{
+    std::string token = offer.value("token", "");
+    std::lock_guard<std::mutex> guard(rserver.sessionsLock);
+    rresumed = !token.empty() && (rserver.resumeTokens.count(token) > 0);
+    if (!rresumed) {
+        std::random_device random;
+        char tokenChars[17];
+        snprintf(tokenChars, sizeof(tokenChars), "%08x%08x", (unsigned)random(), (unsigned)random());
+        token = tokenChars;
+        rserver.resumeTokens.insert(token);
+    }
+    return { { "token", token }, { "resumed", rresumed } };
+}
+
+bool HyperCubeStandInServer::Connection::sendSessionAck(void)
+{
+    if (!psessionSeq) return true;
+    json j = { { "session", { { "ack", (uint64_t)*psessionSeq } } } };
+    SigMsg signallingMsg(j.dump());
+    Packet::UniquePtr ppacket = Packet::create();
+    mserdes.msgToPacket(signallingMsg, ppacket);
+    return sendPacket(*ppacket);
+}
+
+/// fields other than correlationId only go out in JSON commands, as the client only looks for
+/// them in CONNECTIONINFOACK, which is always JSON
+bool HyperCubeStandInServer::Connection::sendCmd(HYPERCUBECOMMANDS command, const json& jsonData, bool ack, const json& fields, bool status)
+{
+    if (binarySigCodec) {
+        // pings and echoes carry a StringInfo, as the client sends them
+        bool stringPayload = (command == HYPERCUBECOMMANDS::REMOTEPING) || (command == HYPERCUBECOMMANDS::LOCALPING)
+            || (command == HYPERCUBECOMMANDS::ECHODATA);
+        uint32_t correlationId = fields.is_object() ? fields.value("correlationId", (uint32_t)0) : 0;
+        std::string commandData;
+        SigCodec::encode(command, jsonData, stringPayload ? SigCodec::PAYLOAD::STRING : SigCodec::PAYLOAD::MSGPACK,
+            ack, status, commandData, correlationId);
+        SigMsg signallingMsg(commandData);
+        Packet::UniquePtr ppacket = Packet::create();
+        mserdes.msgToPacket(signallingMsg, ppacket);
+        return sendPacket(*ppacket);
+    }
+    HyperCubeCommand hyperCubeCommand(command, jsonData, status);
+    hyperCubeCommand.ack = ack;
+    json commandJson = hyperCubeCommand.to_json();
+    if (fields.is_object()) {
+        for (auto& ritem : fields.items()) commandJson[ritem.key()] = ritem.value();
+    }
+    SigMsg signallingMsg(commandJson.dump());
+    Packet::UniquePtr ppacket = Packet::create();
+    mserdes.msgToPacket(signallingMsg, ppacket);
+    return sendPacket(*ppacket);
+}
+
+bool HyperCubeStandInServer::Connection::sendPacket(const Packet& packet)
+{
+    const char* pdata = packet.getpData();
+    int numLeft = packet.getLength();
+    while (numLeft > 0) {
+        int res = (int)send(fd, pdata, numLeft, MSG_NOSIGNAL);
+        if (res < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        pdata += res;
+        numLeft -= res;
+    }
+    return true;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <set>
+#include <string>
+
+#include "sthread.h"
+#include "Packet.h"
+#include "Messages.h"
+#include "mserdes.h"
+#include "sigCodec.h"
+
+#define STANDIN_RECVBUFFER_SIZE (256*1024)
+
+/// Loopback stand-in for the HyperCube server, so the benchmarks have something to talk to.
+/// One thread accepts, and each client connection gets a thread of its own, so several
+/// clients, or the shards of a HyperCubeClientPool, can be served at once. It acks the
+/// signalling commands the client sends during connection setup, acks pings and echoes, and
+/// either echoes every data packet back unchanged or just counts it (setEchoData(false)).
+/// Acks carry the correlation id of the command they answer.
+/// Signalling is JSON unless setSigCodec(true), then a client that offers SIGCODEC_NAME is
+/// answered with the binary codec from its CONNECTIONINFOACK on. Reliable sessions count data
+/// packets per session id, and that count is what the server acks and resumes from. Resume
+/// tokens restore a connection's group without a new createGroup. Group names are unique, a
+/// createGroup of a name another live connection created is acked with a failed status, unless
+/// it comes from the same creator reconnecting. A client is told it is open for data
+/// (SUBSCRIBER) once its group exists.
+class HyperCubeStandInServer : CstdThread {
+    class Connection : CstdThread, RecvPacketBuilder::IReadDataObject {
+        HyperCubeStandInServer& rserver;
+        int fd = -1;
+        RecvPacketBuilder recvPacketBuilder;
+        Packet::UniquePtr pinputPacket = 0;
+        MSerDes mserdes;
+
+        // same one recv() per pass framing as HyperCubeClientCore::RecvActivity
+        std::vector<char> recvBuffer;
+        int recvBufferHead = 0;
+        int recvBufferTail = 0;
+        bool recvAllowed = false;
+        bool readWouldBlock = false;
+        std::atomic<bool> closed = false;
+        bool binarySigCodec = false;        // this client's commands and acks use SigCodec
+        std::shared_ptr<std::atomic<uint64_t>> psessionSeq;     // data packets received in this client's session
+        int sessionAckEvery = 0;
+
+        virtual bool threadFunction(void);
+        virtual int readData(void* pdata, int dataLen);
+        bool readPackets(void);
+        bool onSigMsg(const Packet* ppacket);
+        /// fields are added at the top level, next to the command, such as capabilities and correlationId
+        bool sendCmd(HYPERCUBECOMMANDS command, const json& jsonData, bool ack, const json& fields = json(), bool status = true);
+        bool onCreateGroup(HyperCubeCommand& rhyperCubeCommand, const json& ackFields);
+        json openSession(const json& offer);
+        json resumeConnection(const json& offer, bool& rresumed);
+        bool sendSessionAck(void);
+        bool sendPacket(const Packet& packet);
+    public:
+        Connection(HyperCubeStandInServer& _rserver, int _fd);
+        ~Connection();
+        bool init(void);
+        bool deinit(void);
+        /// the client went away, the accept thread reaps it
+        bool isClosed(void) { return closed; }
+    };
+
+    int port = 0;
+    int listenFd = -1;
+    std::vector<std::unique_ptr<Connection>> connections;     // accept thread only, until deinit()
+
+    std::atomic<bool> echoData = true;
+    std::atomic<bool> sigCodec = false;
+    std::atomic<uint64_t> numBinarySigCommands = 0;
+    std::atomic<uint64_t> numDataPackets = 0;
+    std::atomic<uint64_t> numDataBytes = 0;
+    std::atomic<uint64_t> numSigCommands = 0;
+    std::atomic<uint64_t> numConnections = 0;
+    // session id -> data packets received. Kept across deinit()/init(), like a server that only lost the connection
+    std::mutex sessionsLock;
+    std::map<uint64_t, std::shared_ptr<std::atomic<uint64_t>>> sessions;
+    std::set<std::string> resumeTokens;     // also under sessionsLock
+    struct Group {
+        const Connection* powner = 0;       // released when it closes
+        std::string creator;                // the creatorConnectionInfo it was created with
+    };
+    std::map<std::string, Group> groups;    // by name, also under sessionsLock
+
+    virtual bool threadFunction(void);
+    bool acceptClient(void);
+    void closeConnections(bool closedOnly);
+    bool addGroup(const Connection* powner, const std::string& name, const std::string& creator);
+    void releaseGroups(const Connection* powner);
+
+public:
+    HyperCubeStandInServer(int _port);
+    ~HyperCubeStandInServer();
+    /// listen on 127.0.0.1:port. False if the port is taken, by a real server for instance.
+    /// init() again after deinit() restarts it, as a server coming back would
+    bool init(void);
+    bool deinit(void);
+    void setEchoData(bool _echoData) { echoData = _echoData; }
+    /// accept the binary signalling codec from the next connection on
+    void setSigCodec(bool _sigCodec) { sigCodec = _sigCodec; }
+    uint64_t getNumDataPackets(void) { return numDataPackets; }
+    uint64_t getNumDataBytes(void) { return numDataBytes; }
+    uint64_t getNumSigCommands(void) { return numSigCommands; }
+    uint64_t getNumBinarySigCommands(void) { return numBinarySigCommands; }
+    uint64_t getNumConnections(void) { return numConnections; }
+    /// data packets received in a reliable session, each counted once
+    uint64_t getSessionSeq(uint64_t sessionId);
+    void resetCounts(void) { numDataPackets = 0; numDataBytes = 0; numSigCommands = 0; numBinarySigCommands = 0; }
+};
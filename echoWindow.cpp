@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "Logger.h"
+#include "MsgExt.h"
+#include "echoWindow.h"
+
+// ------------------------------------------------------------------------------------------------
+
+static void putHex(char* pdata, uint64_t value)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    for (int i = 15; i >= 0; i--) {
+        pdata[i] = hexDigits[value & 0xf];
+        value >>= 4;
+    }
+}
+
+static bool getHex(const char* pdata, uint64_t& rvalue)
+{
+    rvalue = 0;
+    for (int i = 0; i < 16; i++) {
+        char ch = pdata[i];
+        int digit = ((ch >= '0') && (ch <= '9')) ? ch - '0' : ((ch >= 'a') && (ch <= 'f')) ? ch - 'a' + 10 : -1;
+        if (digit < 0) return false;
+        rvalue = (rvalue << 4) | (uint64_t)digit;
+    }
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+EchoWindow::EchoWindow(HyperCubeClientCore& _rclient, int _windowSize, int _msgSize) :
+    rclient{ _rclient },
+    windowSize{ std::max(_windowSize, 1) },
+    msgSize{ std::max(_msgSize, ECHOWINDOW_HEADERSIZE) },
+    inFlightSeqs(windowSize, -1)
+{
+    payload = ECHOWINDOW_MARKER;
+    payload.resize(msgSize, 'D');
+}
+
+bool EchoWindow::sendRequest(int64_t seq)
+{
+    putHex(&payload[6], (uint64_t)seq);
+    putHex(&payload[22], (uint64_t)latencyNowNs());
+    MsgCmd cmdMsg(payload);
+    if (!rclient.sendMsgOut(cmdMsg)) return false;
+    inFlightSeqs[seq % windowSize] = seq;
+    numInFlight++;
+    result.numSent++;
+    return true;
+}
+
+/// The packet header and message encoding are not looked at, the marker is searched for
+/// near the start of the packet, so this works on whatever the server echoes back
+bool EchoWindow::onReply(const Packet& packet)
+{
+    const int64_t receivedNs = latencyNowNs();
+    const char* pdata = packet.getpData();
+    int searchLen = std::min(packet.getLength(), ECHOWINDOW_SEARCHBYTES) - ECHOWINDOW_HEADERSIZE;
+    const int markerLen = (int)strlen(ECHOWINDOW_MARKER);
+    for (int offset = 0; offset <= searchLen; offset++) {
+        if (memcmp(pdata + offset, ECHOWINDOW_MARKER, markerLen) != 0) continue;
+        uint64_t seq = 0;
+        uint64_t sentNs = 0;
+        if (!getHex(pdata + offset + 6, seq) || !getHex(pdata + offset + 22, sentNs)) break;
+        int64_t& rinFlightSeq = inFlightSeqs[seq % windowSize];
+        if (rinFlightSeq != (int64_t)seq) break;
+        rinFlightSeq = -1;
+        numInFlight--;
+        result.numReceived++;
+        latency.record(receivedNs - (int64_t)sentNs);
+        return true;
+    }
+    result.numUnmatched++;
+    return false;
+}
+
+EchoWindowResult EchoWindow::run(int numMsgs, int timeoutMs)
+{
+    const int BATCHSIZE = 64;
+    Packet::UniquePtr ppackets[BATCHSIZE];
+    Packet packet;
+    int64_t nextSeq = 0;
+    result = EchoWindowResult();
+    latency.reset();
+    std::fill(inFlightSeqs.begin(), inFlightSeqs.end(), -1);
+    numInFlight = 0;
+
+    int64_t startNs = latencyNowNs();
+    while (result.numReceived < (uint64_t)numMsgs) {
+        // a seq can only be reused once the one windowSize before it has come back
+        while ((nextSeq < numMsgs) && (numInFlight < windowSize) && (inFlightSeqs[nextSeq % windowSize] < 0)) {
+            if (!sendRequest(nextSeq)) break;
+            nextSeq++;
+            if ((pingEvery > 0) && ((nextSeq % pingEvery) == 0)) rclient.remotePing();
+        }
+        int numPackets = rclient.getPackets(ppackets, BATCHSIZE);
+        for (int i = 0; i < numPackets; i++) {
+            onReply(*ppackets[i]);
+            PacketPool::instance().recycle(ppackets[i]);
+        }
+        if (numPackets > 0) continue;
+        if (!rclient.waitForPacket(packet, timeoutMs)) {
+            LOG_WARNING("EchoWindow::run()", "timed out, echoes in flight", numInFlight);
+            result.timedOut = true;
+            break;
+        }
+        onReply(packet);
+    }
+
+    result.seconds = (latencyNowNs() - startNs) / 1e9;
+    if (result.seconds > 0) {
+        result.msgsPerSec = result.numReceived / result.seconds;
+        result.mbPerSec = ((double)result.numReceived * msgSize) / result.seconds / 1000000.0;
+    }
+    result.latency = latency.snapshot();
+    return result;
+}
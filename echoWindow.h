@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "hyperCubeClient.h"
+#include "latencyHistogram.h"
+
+#define ECHOWINDOW_MARKER "ECHOEW"      // data messages start with this, then 16 hex seq and 16 hex send time
+#define ECHOWINDOW_HEADERSIZE (6 + 16 + 16)
+#define ECHOWINDOW_SEARCHBYTES 256      // how far into a reply packet to look for the marker
+
+struct EchoWindowResult {
+    uint64_t numSent = 0;
+    uint64_t numReceived = 0;
+    uint64_t numUnmatched = 0;      // replies with no request in flight, or other data packets
+    bool timedOut = false;
+    double seconds = 0;
+    double msgsPerSec = 0;
+    double mbPerSec = 0;            // payload bytes echoed per second, one way
+    LatencySnapshot latency;        // send to matching reply
+};
+
+/// Pipelined echo over the data path. Keeps up to windowSize "ECHO" requests in flight,
+/// each carrying a sequence number and its send time, and matches the echoes as they
+/// arrive, in any order. run() drives it on the calling thread, so the client must not
+/// have a packet handler set and nothing else may be reading its packets meanwhile.
+class EchoWindow {
+    HyperCubeClientCore& rclient;
+    const int windowSize;
+    const int msgSize;
+    int pingEvery = 0;
+    std::vector<int64_t> inFlightSeqs;      // indexed by seq % windowSize, -1 when free
+    int numInFlight = 0;
+    LatencyHistogram latency;
+    EchoWindowResult result;
+    std::string payload;
+
+    bool sendRequest(int64_t seq);
+    bool onReply(const Packet& packet);
+public:
+    EchoWindow(HyperCubeClientCore& _rclient, int _windowSize, int _msgSize);
+    /// also send a signalling ping every pingEvery requests, to mix control traffic into the load
+    void setPingEvery(int _pingEvery) { pingEvery = _pingEvery; }
+    /// send numMsgs requests and wait for their echoes. Gives up if no echo arrives for timeoutMs
+    EchoWindowResult run(int numMsgs, int timeoutMs);
+};
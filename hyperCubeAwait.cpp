@@ -0,0 +1,169 @@
+#include "Logger.h"
+#include "hyperCubeAwait.h"
+
+#ifdef HYPERCUBE_COROUTINES
+
+// ------------------------------------------------------------------------------------------------
+
+void HyperCubeTask::promise_type::unhandled_exception(void)
+{
+    exception = std::current_exception();
+    // nobody is left to rethrow it to
+    if (detached) LOG_WARNING("HyperCubeTask::unhandled_exception()", "detached task threw", 0);
+}
+
+void HyperCubeTask::detach(void)
+{
+    if (!handle) return;
+    std::coroutine_handle<promise_type> started = handle;
+    handle = nullptr;
+    started.promise().detached = true;
+    started.resume();
+}
+
+// ------------------------------------------------------------------------------------------------
+
+HyperCubeAwaitClient::HyperCubeAwaitClient()
+{
+    setPacketHandler([this](Packet::UniquePtr& rppacket) { onPacket(rppacket); });
+}
+
+HyperCubeAwaitClient::~HyperCubeAwaitClient()
+{
+    bool running = false;
+    {
+        std::lock_guard<std::mutex> guard(awaitLock);
+        running = !closing;
+    }
+    if (running) deinit();
+}
+
+bool HyperCubeAwaitClient::init(std::string _serverIpAddress, bool reInit, HYPERCUBE_THREADINGMODE _threadingMode)
+{
+    {
+        std::lock_guard<std::mutex> guard(awaitLock);
+        closing = false;
+    }
+    return HyperCubeClientCore::init(_serverIpAddress, reInit, _threadingMode);
+}
+
+/// stops the client threads first, so nothing completes while the waiters are let go
+bool HyperCubeAwaitClient::deinit(void)
+{
+    bool stat = HyperCubeClientCore::deinit();
+    std::deque<PacketWaiter*> emptyHanded;
+    std::deque<OpenWaiter*> notOpened;
+    {
+        std::lock_guard<std::mutex> guard(awaitLock);
+        closing = true;
+        open = false;
+        emptyHanded.swap(packetWaiters);
+        notOpened.swap(openWaiters);
+        for (auto& rppacket : packets) PacketPool::instance().recycle(rppacket);
+        packets.clear();
+    }
+    for (PacketWaiter* pwaiter : emptyHanded) resume(pwaiter->handle);
+    for (OpenWaiter* pwaiter : notOpened) resume(pwaiter->handle);
+    return stat;
+}
+
+void HyperCubeAwaitClient::resume(std::coroutine_handle<> handle)
+{
+    if (executor) executor([handle]() { handle.resume(); });
+    else handle.resume();
+}
+
+/// receive thread
+void HyperCubeAwaitClient::onPacket(Packet::UniquePtr& rppacket)
+{
+    PacketWaiter* pwaiter = 0;
+    {
+        std::lock_guard<std::mutex> guard(awaitLock);
+        if (packetWaiters.empty()) {
+            packets.push_back(std::move(rppacket));
+            return;
+        }
+        pwaiter = packetWaiters.front();
+        packetWaiters.pop_front();
+        pwaiter->ppacket = std::move(rppacket);
+    }
+    resume(pwaiter->handle);
+}
+
+void HyperCubeAwaitClient::onOpenState(bool isOpen)
+{
+    std::deque<OpenWaiter*> opened;
+    {
+        std::lock_guard<std::mutex> guard(awaitLock);
+        open = isOpen;
+        if (isOpen) opened.swap(openWaiters);
+    }
+    for (OpenWaiter* pwaiter : opened) {
+        pwaiter->isOpen = true;
+        resume(pwaiter->handle);
+    }
+}
+
+bool HyperCubeAwaitClient::onOpenForData(void)
+{
+    onOpenState(true);
+    return true;
+}
+
+bool HyperCubeAwaitClient::onClosedForData(void)
+{
+    onOpenState(false);
+    return true;
+}
+
+bool HyperCubeAwaitClient::PacketWaiter::await_suspend(std::coroutine_handle<> _handle)
+{
+    std::lock_guard<std::mutex> guard(rclient.awaitLock);
+    if (!rclient.packets.empty()) {
+        ppacket = std::move(rclient.packets.front());
+        rclient.packets.pop_front();
+        return false;
+    }
+    if (rclient.closing) return false;
+    handle = _handle;
+    rclient.packetWaiters.push_back(this);
+    return true;
+}
+
+bool HyperCubeAwaitClient::OpenWaiter::await_suspend(std::coroutine_handle<> _handle)
+{
+    std::lock_guard<std::mutex> guard(rclient.awaitLock);
+    isOpen = rclient.open;
+    if (isOpen || rclient.closing) return false;
+    handle = _handle;
+    rclient.openWaiters.push_back(this);
+    return true;
+}
+
+bool HyperCubeAwaitClient::SendWaiter::await_suspend(std::coroutine_handle<> _handle)
+{
+    handoff.handle = _handle;
+    rclient.sendMsgOut(rmsg, lane, [this](bool _sent) {
+        sent = _sent;
+        if (handoff.complete()) rclient.resume(handoff.handle);
+    });
+    // sent, or refused, already
+    return !handoff.complete();
+}
+
+bool HyperCubeAwaitClient::ReplyWaiter::await_suspend(std::coroutine_handle<> _handle)
+{
+    handoff.handle = _handle;
+    starter([this](const RequestReply& rreply) {
+        reply = rreply;
+        if (handoff.complete()) rclient.resume(handoff.handle);
+    });
+    return !handoff.complete();
+}
+
+HyperCubeAwaitClient::ReplyWaiter HyperCubeAwaitClient::remotePingReply(std::string data, int timeoutMs)
+{
+    return reply([this, data, timeoutMs](ReplyHandler handler) { return remotePing(data, handler, timeoutMs); });
+}
+
+#endif
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "hyperCubeClient.h"
+
+// The awaitable API needs C++20 coroutines. With an earlier standard this header declares
+// nothing, build with -std=c++20 (make CXXSTD=c++20) to get it
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define HYPERCUBE_COROUTINES 1
+#endif
+#endif
+
+#ifdef HYPERCUBE_COROUTINES
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+
+/// Runs a coroutine's resumption somewhere else, a thread pool or the application's own loop.
+/// Without one coroutines resume on the client thread that completed what they waited for
+typedef std::function<void(std::function<void()> resume)> HyperCubeExecutor;
+
+/// A coroutine returning nothing, one logical session. It does not start until it is awaited,
+/// which resumes the awaiter when it finishes, or detached, after which it frees itself.
+/// Nothing is tied to a thread, so any number can be waiting at once
+class HyperCubeTask {
+public:
+    struct promise_type {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr exception;
+        bool detached = false;
+
+        HyperCubeTask get_return_object(void) { return HyperCubeTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend(void) noexcept { return {}; }
+        struct FinalAwaiter {
+            bool await_ready(void) noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                promise_type& rpromise = handle.promise();
+                if (rpromise.detached) {
+                    handle.destroy();
+                    return std::noop_coroutine();
+                }
+                return rpromise.continuation ? rpromise.continuation : std::noop_coroutine();
+            }
+            void await_resume(void) noexcept {}
+        };
+        FinalAwaiter final_suspend(void) noexcept { return {}; }
+        void return_void(void) {}
+        void unhandled_exception(void);
+    };
+
+    HyperCubeTask(HyperCubeTask&& rother) noexcept : handle{ rother.handle } { rother.handle = nullptr; }
+    HyperCubeTask(const HyperCubeTask&) = delete;
+    HyperCubeTask& operator=(const HyperCubeTask&) = delete;
+    ~HyperCubeTask() { if (handle) handle.destroy(); }
+
+    /// run it on this thread up to its first wait, and let it finish on its own
+    void detach(void);
+
+    bool await_ready(void) noexcept { return !handle || handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        handle.promise().continuation = awaiter;
+        return handle;
+    }
+    void await_resume(void) { if (handle.promise().exception) std::rethrow_exception(handle.promise().exception); }
+
+private:
+    explicit HyperCubeTask(std::coroutine_handle<promise_type> _handle) : handle{ _handle } {}
+    std::coroutine_handle<promise_type> handle;
+};
+
+/// HyperCubeClient for coroutines. Packets, the open for data state, sends and signalling acks
+/// can all be awaited:
+///
+///     HyperCubeTask session(HyperCubeAwaitClient& rclient) {
+///         if (!co_await rclient.openForData()) co_return;
+///         co_await rclient.send(msg);
+///         Packet::UniquePtr ppacket = co_await rclient.nextPacket();
+///     }
+///
+/// Received packets go to the oldest nextPacket() waiting, or are kept until one asks, so they
+/// are not also available from getPacket(). Wait only after init(), deinit() wakes everything
+/// still waiting empty handed
+class HyperCubeAwaitClient : public HyperCubeClient {
+    /// one waiter, completed once from any thread. Whichever of the waiter and the completion
+    /// comes second carries on, so a completion before the coroutine has suspended is not lost
+    struct Handoff {
+        std::coroutine_handle<> handle;
+        std::atomic<bool> arrived = false;
+        bool complete(void) { return arrived.exchange(true); }
+    };
+
+
+public:
+    struct PacketWaiter {
+        HyperCubeAwaitClient& rclient;
+        Packet::UniquePtr ppacket = 0;
+        std::coroutine_handle<> handle;
+        bool await_ready(void) noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> _handle);
+        /// empty once the client is deinit()ed
+        Packet::UniquePtr await_resume(void) { return std::move(ppacket); }
+    };
+
+    struct OpenWaiter {
+        HyperCubeAwaitClient& rclient;
+        bool isOpen = false;
+        std::coroutine_handle<> handle;
+        bool await_ready(void) noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> _handle);
+        /// false once the client is deinit()ed
+        bool await_resume(void) noexcept { return isOpen; }
+    };
+
+    struct SendWaiter {
+        HyperCubeAwaitClient& rclient;
+        Msg& rmsg;
+        HYPERCUBE_LANE lane;
+        bool sent = false;
+        Handoff handoff;
+        bool await_ready(void) noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> _handle);
+        /// see SentHandler
+        bool await_resume(void) noexcept { return sent; }
+    };
+
+    /// starts a signalling request with the ReplyHandler it is given, see HyperCubeClientCore::remotePing().
+    /// Like those, it must call the handler even when it returns false
+    typedef std::function<bool(ReplyHandler handler)> RequestStarter;
+    struct ReplyWaiter {
+        HyperCubeAwaitClient& rclient;
+        RequestStarter starter;
+        RequestReply reply;
+        Handoff handoff;
+        bool await_ready(void) noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> _handle);
+        RequestReply await_resume(void) { return std::move(reply); }
+    };
+
+private:
+    std::mutex awaitLock;
+    std::deque<Packet::UniquePtr> packets;              // arrived with no one waiting
+    std::deque<PacketWaiter*> packetWaiters;
+    std::deque<OpenWaiter*> openWaiters;
+    bool open = false;
+    bool closing = true;            // until init(), and again from deinit()
+    HyperCubeExecutor executor;
+
+    void resume(std::coroutine_handle<> handle);
+    void onPacket(Packet::UniquePtr& rppacket);
+    void onOpenState(bool isOpen);
+    virtual bool onOpenForData(void);
+    virtual bool onClosedForData(void);
+
+public:
+
+    HyperCubeAwaitClient();
+    ~HyperCubeAwaitClient();
+    bool init(std::string _serverIpAddress, bool reInit = true, HYPERCUBE_THREADINGMODE _threadingMode = HYPERCUBE_THREADINGMODE::THREADED);
+    bool deinit(void);
+    /// where coroutines resume. Set before anything waits
+    void setExecutor(HyperCubeExecutor _executor) { executor = _executor; }
+
+    /// the next data packet to arrive, in order
+    PacketWaiter nextPacket(void) { return PacketWaiter{ *this }; }
+    /// straight through if open for data already, else resumes when the server opens it
+    OpenWaiter openForData(void) { return OpenWaiter{ *this }; }
+    /// resumes once the packet has gone out to the socket
+    SendWaiter send(Msg& msg, HYPERCUBE_LANE lane = HYPERCUBE_LANE::DATA) { return SendWaiter{ *this, msg, lane }; }
+    /// resumes with the ack, or the timeout: co_await client.reply([&](ReplyHandler h) { return client.remotePing("ping", h); })
+    ReplyWaiter reply(RequestStarter starter) { return ReplyWaiter{ *this, starter }; }
+    /// the same for a remote ping
+    ReplyWaiter remotePingReply(std::string data = "remotePingFromMatrix", int timeoutMs = REQUEST_TIMEOUT_MS);
+};
+
+#endif
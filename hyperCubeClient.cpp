@@ -1,58 +1,141 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "Logger.h"
 #include <Winsock2.h> // before Windows.h, else Winsock 1 conflict
 #include <errno.h>
+#include <thread>
+#include <chrono>
+#include <algorithm>
 
 #include "hyperCubeClient.h"
 #include "Common.h"
 #include "Packet.h"
 #include "mserdes.h"
+#include "packetPool.h"
+#include "sigCodec.h"
 #include "kbhit.h"
 #include "clockGetTime.h"
 #include "MsgExt.h"
+#include "asyncLog.h"
+#include "packetClassifier.h"
 
 using namespace std;
 
 #ifdef _WIN64
+#include <ws2tcpip.h>
 #define poll WSAPoll
 #else
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
 #endif
 
-// ------------------------------------------------------------------------------------------------
-
-void HyperCubeClientCore::PacketQWithLock::init(void) 
+static bool lastSocketErrorWouldBlock(void)
 {
-    deinit();
+#ifdef _WIN64
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+#endif
 }
 
-void HyperCubeClientCore::PacketQWithLock::deinit(void) {
-    std::lock_guard<std::mutex> lock(qLock);
-    while (std::deque<Packet::UniquePtr>::size() > 0) {
-        std::unique_ptr<Packet> rpacket = std::move(std::deque<Packet::UniquePtr>::front());
-        Packet* packet = rpacket.release();
-        if (packet) delete packet;
-        pop_front();
-    }
+// ----------------------------------------------------------------------
+
+/// in HYPERCUBE_METRIC order, the index each definition gets is the enum value
+HyperCubeMetrics::HyperCubeMetrics()
+{
+    registry.addCounter("hypercube_messages_out_total", "Messages sendMsgOut() queued. Refused ones are in hypercube_rejects_total, DROPNEWEST ones in hypercube_drops_total.");
+    registry.addCounter("hypercube_messages_in_total", "Data packets received.");
+    registry.addCounter("hypercube_bytes_out_total", "Bytes handed to the socket.");
+    registry.addCounter("hypercube_bytes_in_total", "Bytes read from the socket.");
+    registry.addCounter("hypercube_drops_total", "Packets discarded by the DROPOLDEST and DROPNEWEST policies.");
+    registry.addCounter("hypercube_rejects_total", "Packets refused because the send queue was full.");
+    registry.addCounter("hypercube_reconnects_total", "Connects after the first.");
+    registry.addGauge("hypercube_queued_packets", "Packets waiting in the send queues.");
+    registry.addGauge("hypercube_queued_bytes", "Bytes waiting in the send queues.");
+    registry.addGauge("hypercube_outstanding_requests", "Signalling requests waiting for their acks.");
+    registry.addGauge("hypercube_connected", "1 while connected to the server.");
 }
 
-void HyperCubeClientCore::PacketQWithLock::push(std::unique_ptr<Packet>& rpacket) {
-    std::lock_guard<std::mutex> lock(qLock);
-    push_back(std::move(rpacket));
+// ----------------------------------------------------------------------
+
+int IHyperCubeClientCore::tcpSendv(const IoVec* piov, const int iovCount, bool dontWait)
+{
+#ifdef _WIN64
+    DWORD numSent = 0;
+    int res = WSASend(rtcpClient.getSocket(), (LPWSABUF)piov, (DWORD)iovCount, &numSent, 0, NULL, NULL);
+    return (res == 0) ? (int)numSent : -1;
+#else
+    struct msghdr msgHdr;
+    memset(&msgHdr, 0, sizeof(msgHdr));
+    msgHdr.msg_iov = (struct iovec*)piov;
+    msgHdr.msg_iovlen = iovCount;
+    return (int)::sendmsg(rtcpClient.getSocket(), &msgHdr, MSG_NOSIGNAL | (dontWait ? MSG_DONTWAIT : 0));
+#endif
 }
 
-bool HyperCubeClientCore::PacketQWithLock::pop(std::unique_ptr<Packet>& rpacket) {
-    std::lock_guard<std::mutex> lock(qLock);
-    if (empty()) return false;
-    rpacket = std::move(std::deque<Packet::UniquePtr>::front());
-    pop_front();
-    return true;
+bool IHyperCubeClientCore::tcpSetNonBlocking(bool nonBlocking)
+{
+#ifdef _WIN64
+    u_long mode = nonBlocking ? 1 : 0;
+    return ioctlsocket(rtcpClient.getSocket(), FIONBIO, &mode) == 0;
+#else
+    int fd = (int)rtcpClient.getSocket();
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return false;
+    flags = nonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(fd, F_SETFL, flags) == 0;
+#endif
 }
 
-bool HyperCubeClientCore::PacketQWithLock::isEmpty(void) 
+/// Ctcp::Client::connect() blocks for as long as the OS keeps retrying the SYN, which can be
+/// minutes for a host that has gone away. It creates its socket inside that call, so there is
+/// no socket to connect non-blocking and poll() on. This bounds the wait with a connection of
+/// its own instead, one extra handshake and a connection the server sees close straight away
+bool IHyperCubeClientCore::tcpProbe(std::string addrString, int port, int timeoutMs)
 {
-    std::lock_guard<std::mutex> lock(qLock);
-    return empty();
+    struct addrinfo hints;
+    struct addrinfo* paddrInfo = 0;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((getaddrinfo(addrString.c_str(), std::to_string(port).c_str(), &hints, &paddrInfo) != 0) || !paddrInfo) return false;
+    bool stat = false;
+#ifdef _WIN64
+    SOCKET sock = socket(paddrInfo->ai_family, paddrInfo->ai_socktype, paddrInfo->ai_protocol);
+    if (sock != INVALID_SOCKET) {
+        u_long mode = 1;
+        ioctlsocket(sock, FIONBIO, &mode);
+        int res = ::connect(sock, paddrInfo->ai_addr, (int)paddrInfo->ai_addrlen);
+        if ((res == 0) || (WSAGetLastError() == WSAEWOULDBLOCK)) {
+#else
+    int sock = socket(paddrInfo->ai_family, paddrInfo->ai_socktype, paddrInfo->ai_protocol);
+    if (sock >= 0) {
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+        int res = ::connect(sock, paddrInfo->ai_addr, paddrInfo->ai_addrlen);
+        if ((res == 0) || (errno == EINPROGRESS)) {
+#endif
+            struct pollfd pollFd = { sock, POLLOUT, 0 };
+            if ((res == 0) || (poll(&pollFd, 1, timeoutMs) > 0)) {
+                int error = 0;
+                socklen_t errorLen = sizeof(error);
+                getsockopt(sock, SOL_SOCKET, SO_ERROR, (char*)&error, &errorLen);
+                stat = (error == 0);
+            }
+        }
+#ifdef _WIN64
+        closesocket(sock);
+#else
+        close(sock);
+#endif
+    }
+    freeaddrinfo(paddrInfo);
+    return stat;
 }
 
 // ----------------------------------------------------------------------
@@ -61,29 +144,43 @@ bool HyperCubeClientCore::PacketQWithLock::isEmpty(void)
 HyperCubeClientCore::RecvActivity::RecvActivity(IHyperCubeClientCore* pIHyperCubeClientCore, SignallingObject& _signallingObject) :
     CstdThread(this),
     pIHyperCubeClientCore{ pIHyperCubeClientCore },
-    recvPacketBuilder(*this, COMMON_PACKETSIZE_MAX)
+    recvPacketBuilder(*this, COMMON_PACKETSIZE_MAX),
+    recvBuffer(HYPERCUBE_RECVBUFFER_SIZE)
 {};
 
-bool HyperCubeClientCore::RecvActivity::init(void) 
+bool HyperCubeClientCore::RecvActivity::init(bool startThread, EventLoopActivity* _peventLoopActivity) 
 {
     eventReadyToRead.reset();
     std::lock_guard<std::mutex> lock(recvPacketBuilderLock);
     recvPacketBuilder.init();
-    pinputPacket = std::make_unique<Packet>();
-    CstdThread::init(true);
+    peventLoopActivity = _peventLoopActivity;
+    inputHeld = false;
+    pinputPacket = PacketPool::instance().acquire(COMMON_PACKETSIZE_MAX);
+    if (startThread) CstdThread::init(true);
     return true;
 }
 bool HyperCubeClientCore::RecvActivity::deinit(void) 
 {
     eventReadyToRead.notify();
+    eventRoomInQ.notify();
     // locking here causes a deadlock during shutdown as readPackets() cannot get lock to shutdown
     // No need to lock as its all being deinited anyway
     //   std::lock_guard<std::mutex> lock(recvPacketBuilderLock);
     recvPacketBuilder.deinit();
-    Packet* packet = pinputPacket.release();
-    if (packet) delete packet;
-    inPacketQ.deinit();
+    PacketPool::instance().recycle(pinputPacket);
+    {
+        std::lock_guard<std::mutex> lock(consumerLock);
+        inPacketQ.deinit();
+    }
     CstdThread::deinit(true);
+    {
+        std::lock_guard<std::mutex> lock(packetWaitLock);
+        packetWaitCondition.notify_all();
+    }
+#ifndef _WIN64
+    if (packetReadyFd >= 0) close(packetReadyFd);
+    packetReadyFd = -1;
+#endif
     return true;
 }
 
@@ -93,50 +190,167 @@ bool HyperCubeClientCore::RecvActivity::threadFunction(void)
         eventReadyToRead.wait();
         if (checkIfShouldExit()) break;
         RecvPacketBuilder::READSTATUS readStatus = readPackets();
-        switch (readStatus) {
-            case RecvPacketBuilder::READSTATUS::NEEDEDDATAREAD:
-                pIHyperCubeClientCore->onReceivedData();
-                break;
-            case RecvPacketBuilder::READSTATUS::READERROR:
-                LOG_WARNING("HyperCubeClientCore::RecvActivity::threadFunction()", "peer error", (int)readStatus);
-            case RecvPacketBuilder::READSTATUS::PEERSHUTDOWN:
-                pIHyperCubeClientCore->onDisconnect();
-                eventReadyToRead.reset();
-                break;
-            case RecvPacketBuilder::READSTATUS::MOREDATANEEDED:
-                break;
-            default:
-                LOG_WARNING("HyperCubeClientCore::RecvActivity::threadFunction()", "invalid state", (int)readStatus);
-                break;
-        }
+        processReadStatus(readStatus);
     } while (!checkIfShouldExit());
     exiting();
     return true;
 }
 
+/// returns false if the connection was lost
+bool HyperCubeClientCore::RecvActivity::processReadStatus(RecvPacketBuilder::READSTATUS readStatus)
+{
+    switch (readStatus) {
+        case RecvPacketBuilder::READSTATUS::NEEDEDDATAREAD:
+            // readPackets() has already called onReceivedData() for each packet
+            break;
+        case RecvPacketBuilder::READSTATUS::READERROR:
+            LOG_WARNING("HyperCubeClientCore::RecvActivity::processReadStatus()", "peer error", (int)readStatus);
+        case RecvPacketBuilder::READSTATUS::PEERSHUTDOWN:
+            pIHyperCubeClientCore->onDisconnect();
+            eventReadyToRead.reset();
+            return false;
+        case RecvPacketBuilder::READSTATUS::MOREDATANEEDED:
+            break;
+        default:
+            LOG_WARNING("HyperCubeClientCore::RecvActivity::processReadStatus()", "invalid state", (int)readStatus);
+            break;
+    }
+    return true;
+}
+
+/// event loop mode. Read every complete packet available on the non-blocking socket
+bool HyperCubeClientCore::RecvActivity::onReadable(void)
+{
+    RecvPacketBuilder::READSTATUS readStatus = RecvPacketBuilder::READSTATUS::MOREDATANEEDED;
+    do {
+        readStatus = readPackets();
+    } while ((readStatus == RecvPacketBuilder::READSTATUS::NEEDEDDATAREAD) && !inputHeld);
+    return processReadStatus(readStatus);
+}
+
+/// event loop mode. Queue the packet readPackets() held back. false while inPacketQ is still full
+bool HyperCubeClientCore::RecvActivity::resumeHeld(void)
+{
+    std::lock_guard<std::mutex> lock(recvPacketBuilderLock);
+    return !inputHeld || pushHeld();
+}
+
+/// called with recvPacketBuilderLock held
+bool HyperCubeClientCore::RecvActivity::pushHeld(void)
+{
+    if (!inPacketQ.push(pinputPacket, recvBufferNs)) return false;
+    inputHeld = false;
+    onPacketQueued();
+    pinputPacket = PacketPool::instance().acquire(COMMON_PACKETSIZE_MAX);
+    pIHyperCubeClientCore->onReceivedData();
+    return true;
+}
+
+/// One pass: at most one recv(), then frame every complete packet that is in recvBuffer.
+/// Returns NEEDEDDATAREAD if any packet was framed.
 RecvPacketBuilder::READSTATUS HyperCubeClientCore::RecvActivity::readPackets(void)
 {
     std::lock_guard<std::mutex> lock(recvPacketBuilderLock);
 
-    RecvPacketBuilder::READSTATUS readStatus = recvPacketBuilder.readPacket(*pinputPacket);
-    if (readStatus== RecvPacketBuilder::READSTATUS::NEEDEDDATAREAD) {
+    RecvPacketBuilder::READSTATUS readStatus = RecvPacketBuilder::READSTATUS::MOREDATANEEDED;
+    if (inputHeld && !pushHeld()) return readStatus;
+    int numPackets = 0;
+    recvAllowed = true;
+    do {
+        readWouldBlock = false;
+        readStatus = recvPacketBuilder.readPacket(*pinputPacket);
+        // the buffer or a non-blocking socket ran dry part way through a packet, not a peer shutdown
+        if (readWouldBlock && (readStatus != RecvPacketBuilder::READSTATUS::NEEDEDDATAREAD)) {
+            readStatus = RecvPacketBuilder::READSTATUS::MOREDATANEEDED;
+        }
+        if (readStatus != RecvPacketBuilder::READSTATUS::NEEDEDDATAREAD) break;
+
+        numPackets++;
+        if (!pIHyperCubeClientCore->decompressIn(pinputPacket)) continue;
         if (!pIHyperCubeClientCore->isSignallingMsg(pinputPacket)) {
-            inPacketQ.push(pinputPacket);
-            pinputPacket = std::make_unique<Packet>();
+            if (pIHyperCubeClientCore->dispatchIn(pinputPacket, recvBufferNs)) {
+                if (!pinputPacket) pinputPacket = PacketPool::instance().acquire(COMMON_PACKETSIZE_MAX);
+                pIHyperCubeClientCore->onReceivedData();
+                continue;
+            }
+            if (packetHandler) {
+                pIHyperCubeClientCore->latencies.recordSince(HYPERCUBE_LATENCY::RECVDELIVERY, recvBufferNs);
+                packetHandler(pinputPacket);
+                if (!pinputPacket) pinputPacket = PacketPool::instance().acquire(COMMON_PACKETSIZE_MAX);
+                pIHyperCubeClientCore->onReceivedData();
+                continue;
+            }
+            // inPacketQ is bounded. When the consumer falls behind, stop reading
+            // so that tcp flow control pushes back on the server
+            if (peventLoopActivity) {
+                // the loop thread must not wait here. Hold the packet and stop reading, the loop
+                // drops EPOLLIN until the consumer makes room and calls resumeHeld()
+                if (!inPacketQ.push(pinputPacket, recvBufferNs)) {
+                    inputHeld = true;
+                    // a consumer that popped before it saw inputHeld has made room, look once more
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (!pushHeld()) break;
+                    continue;
+                }
+            }
+            else if (!waitForRoom()) {
+                return RecvPacketBuilder::READSTATUS::MOREDATANEEDED;
+            }
+            onPacketQueued();
+            pinputPacket = PacketPool::instance().acquire(COMMON_PACKETSIZE_MAX);
             pIHyperCubeClientCore->onReceivedData();
         }
+    } while (true);
+
+    numPacketsReceived += numPackets;
+    if ((numPackets > 0) && (readStatus == RecvPacketBuilder::READSTATUS::MOREDATANEEDED)) {
+        readStatus = RecvPacketBuilder::READSTATUS::NEEDEDDATAREAD;
     }
     return readStatus;
 }
 
+/// Serves recvPacketBuilder from recvBuffer. The buffer is only refilled once it is empty, so
+/// a packet split across two recv()s has its first part already copied into the builder and
+/// the buffer always restarts at offset 0, nothing ever wraps.
 int HyperCubeClientCore::RecvActivity::readData(void* pdata, int dataLen)
 {
-    int res = pIHyperCubeClientCore->tcpRecv((char*)pdata, dataLen);
-    return res;
+    if (recvBufferHead == recvBufferTail) {
+        if (!recvAllowed) {
+            readWouldBlock = true;
+            return 0;
+        }
+        recvAllowed = false;
+        recvBufferHead = 0;
+        recvBufferTail = 0;
+        int res = pIHyperCubeClientCore->tcpRecv(recvBuffer.data(), (int)recvBuffer.size());
+        numRecvCalls++;
+        if (res <= 0) {
+            if ((res < 0) && lastSocketErrorWouldBlock()) {
+                readWouldBlock = true;
+                res = 0;
+            }
+            return res;
+        }
+        recvBufferTail = res;
+        recvBufferNs = pIHyperCubeClientCore->latencies.now();
+        numBytesReceived += res;
+        pIHyperCubeClientCore->metrics.count(HYPERCUBE_METRIC::BYTESIN, (uint64_t)res);
+    }
+    int numToCopy = std::min(dataLen, recvBufferTail - recvBufferHead);
+    memcpy(pdata, &recvBuffer[recvBufferHead], numToCopy);
+    recvBufferHead += numToCopy;
+    return numToCopy;
 }
 
 bool HyperCubeClientCore::RecvActivity::onConnect(void)
 {
+    {
+        // drop anything left from the previous connection
+        std::lock_guard<std::mutex> lock(recvPacketBuilderLock);
+        recvPacketBuilder.init();
+        recvBufferHead = 0;
+        recvBufferTail = 0;
+    }
     eventReadyToRead.notify();
     return true;
 }
@@ -148,26 +362,160 @@ bool HyperCubeClientCore::RecvActivity::onDisconnect(void)
 }
 
 
+HyperCubeRecvStats HyperCubeClientCore::RecvActivity::getRecvStats(void)
+{
+    HyperCubeRecvStats recvStats;
+    recvStats.numPacketsReceived = numPacketsReceived;
+    recvStats.numBytesReceived = numBytesReceived;
+    recvStats.numRecvCalls = numRecvCalls;
+    return recvStats;
+}
+
+/// wake whoever is blocked in waitReceiveIn() or polling packetReadyFd. Both are skipped
+/// unless someone is actually waiting, so the common path is two atomic loads
+void HyperCubeClientCore::RecvActivity::onPacketQueued(void)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (numPacketWaiters.load() > 0) {
+        std::lock_guard<std::mutex> lock(packetWaitLock);
+        packetWaitCondition.notify_one();
+    }
+#ifndef _WIN64
+    if ((packetReadyFd >= 0) && !packetReadySignalled.exchange(true)) {
+        uint64_t count = 1;
+        if (write(packetReadyFd, &count, sizeof(count)) < 0) {
+            LOG_WARNING("HyperCubeClientCore::RecvActivity::onPacketQueued()", "eventfd write failed", errno);
+        }
+    }
+#endif
+}
+
 bool HyperCubeClientCore::RecvActivity::receiveIn(Packet::UniquePtr& rppacket) {
-    bool stat = inPacketQ.pop(rppacket);
+    std::lock_guard<std::mutex> lock(consumerLock);
+    int64_t queuedNs = 0;
+    bool stat = inPacketQ.pop(rppacket, &queuedNs);
+    if (!stat && packetReadySignalled) {
+        // queue drained, rearm packetReadyFd. Check again for a packet pushed while it was still armed
+        packetReadySignalled = false;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        stat = inPacketQ.pop(rppacket, &queuedNs);
+    }
+    if (stat) {
+        pIHyperCubeClientCore->latencies.recordSince(HYPERCUBE_LATENCY::RECVDELIVERY, queuedNs);
+        onPacketsPopped();
+    }
     return stat;
 }
 
+int HyperCubeClientCore::RecvActivity::receiveIn(Packet::UniquePtr* ppackets, int maxPackets) {
+    std::lock_guard<std::mutex> lock(consumerLock);
+    int numPackets = popIn(ppackets, maxPackets);
+    if ((numPackets == 0) && packetReadySignalled) {
+        packetReadySignalled = false;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        numPackets = popIn(ppackets, maxPackets);
+    }
+    if (numPackets > 0) onPacketsPopped();
+    return numPackets;
+}
+
+/// event loop mode. Wake the loop if readPackets() is holding a packet for the room just made
+void HyperCubeClientCore::RecvActivity::onPacketsPopped(void)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!inputHeld.load()) return;
+    if (peventLoopActivity) peventLoopActivity->wake();
+    else eventRoomInQ.notify();
+}
+
+/// threaded mode. Push pinputPacket, sleeping while inPacketQ is full until onPacketsPopped()
+/// says there is room. false if the thread is told to exit first
+bool HyperCubeClientCore::RecvActivity::waitForRoom(void)
+{
+    while (!inPacketQ.push(pinputPacket, recvBufferNs)) {
+        eventRoomInQ.reset();
+        inputHeld = true;
+        // a consumer that popped before it saw inputHeld has made room, look once more
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (inPacketQ.push(pinputPacket, recvBufferNs)) break;
+        eventRoomInQ.waitUntil(HYPERCUBE_RECVQFULL_WAITMS);
+        if (checkIfShouldExit()) {
+            inputHeld = false;
+            return false;
+        }
+    }
+    inputHeld = false;
+    return true;
+}
+
+/// popMany() in chunks small enough to keep the queue times on the stack
+int HyperCubeClientCore::RecvActivity::popIn(Packet::UniquePtr* ppackets, int maxPackets) {
+    const int CHUNKSIZE = 64;
+    int64_t queuedNs[CHUNKSIZE];
+    int numPackets = 0;
+    while (numPackets < maxPackets) {
+        int numInChunk = inPacketQ.popMany(ppackets + numPackets, std::min(CHUNKSIZE, maxPackets - numPackets), queuedNs);
+        for (int i = 0; i < numInChunk; i++) {
+            pIHyperCubeClientCore->latencies.recordSince(HYPERCUBE_LATENCY::RECVDELIVERY, queuedNs[i]);
+        }
+        numPackets += numInChunk;
+        if (numInChunk < CHUNKSIZE) break;
+    }
+    return numPackets;
+}
+
+bool HyperCubeClientCore::RecvActivity::waitReceiveIn(Packet::UniquePtr& rppacket, int timeoutMs)
+{
+    if (receiveIn(rppacket)) return true;
+    {
+        std::unique_lock<std::mutex> lock(packetWaitLock);
+        numPacketWaiters++;
+        packetWaitCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]() {
+            return !inPacketQ.isEmpty() || checkIfShouldExit();
+        });
+        numPacketWaiters--;
+    }
+    return receiveIn(rppacket);
+}
+
+int HyperCubeClientCore::RecvActivity::getPacketReadyFd(void)
+{
+#ifdef _WIN64
+    return -1;
+#else
+    if (packetReadyFd < 0) {
+        packetReadyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        // packets may already be waiting
+        if (!inPacketQ.isEmpty()) onPacketQueued();
+    }
+    return packetReadyFd;
+#endif
+}
+
+void HyperCubeClientCore::RecvActivity::setPacketHandler(PacketHandler _packetHandler)
+{
+    std::lock_guard<std::mutex> lock(recvPacketBuilderLock);
+    packetHandler = _packetHandler;
+}
+
 // ------------------------------------------------------------------
 
 HyperCubeClientCore::SendActivity::SendActivity(IHyperCubeClientCore* _pIHyperCubeClientCore) :
     CstdThread(this),
     pIHyperCubeClientCore{ _pIHyperCubeClientCore },
     writePacketBuilder(COMMON_PACKETSIZE_MAX)
-{};
+{
+    sendBatch.reserve(HYPERCUBE_SENDBATCH_MAXPACKETS);
+};
 
 HyperCubeClientCore::SendActivity::~SendActivity() {};
 
-bool HyperCubeClientCore::SendActivity::init(void) {
+bool HyperCubeClientCore::SendActivity::init(bool startThread, EventLoopActivity* _peventLoopActivity) {
     std::lock_guard<std::mutex> lock(writePacketBuilderLock);
     writePacketBuilder.init();
     eventPacketsAvailableToSend.reset();
-    CstdThread::init(true);
+    peventLoopActivity = _peventLoopActivity;
+    if (startThread) CstdThread::init(true);
     return true;
 }
 
@@ -175,15 +523,30 @@ bool HyperCubeClientCore::SendActivity::deinit(void) {
     CstdThread::setShouldExit();
     eventPacketsAvailableToSend.notify();
     CstdThread::deinit(true);
-    std::lock_guard<std::mutex> lock(writePacketBuilderLock);
-    writePacketBuilder.deinit();
-    outPacketQ.deinit();
+    {
+        std::lock_guard<std::mutex> lock(writePacketBuilderLock);
+        writePacketBuilder.deinit();
+        if (writePacketRetained) {
+            onPacketDone(writePacketRetained.get(), false);
+            PacketPool::instance().recycle(writePacketRetained);
+        }
+        writePacketSeq = 0;
+        clearSendBatch();
+        clearOutPacketQ();
+        // the session ends with the client, SignallingObject starts a new one
+        replayBuffer.clear(false);
+        lastSeq = 0;
+        sessionState = SESSIONSTATE::OFF;
+    }
+    // whatever is left went with the replay buffer
+    failSentHandlers();
     return true;
 }
 
 
 bool HyperCubeClientCore::SendActivity::threadFunction(void) 
 {
+    sendThreadId = std::this_thread::get_id();
     do {
         eventPacketsAvailableToSend.wait();
         eventPacketsAvailableToSend.reset();
@@ -191,6 +554,8 @@ bool HyperCubeClientCore::SendActivity::threadFunction(void)
         if (!writePackets()) {
             LOG_WARNING("HyperCubeClientCore::SendActivity::threadFunction()", "writePackets failed", 0);
         }
+        requestSessionAckIfWanted();
+        runSentHandlers();
     } while (!checkIfShouldExit());
     exiting();
     return true;
@@ -205,12 +570,14 @@ bool HyperCubeClientCore::SendActivity::writePacket(void)
     if (writePacketBuilder.empty()) {
 
         Packet::UniquePtr ppacket = 0;
-        bool stat = outPacketQ.pop(ppacket);
+        bool stat = popOut(ppacket, &writePacketQueuedNs, &writePacketLane, true, &writePacketSeq);
 
         if (!stat) return true; // all sent, nothing to send
 
         packet = ppacket.get();
         writePacketBuilder.addNew(*packet);
+        if (writePacketSeq || awaitingSent(packet)) writePacketRetained = std::move(ppacket);
+        else PacketPool::instance().recycle(ppacket);
     }
 
     // send whats in packet builder
@@ -218,60 +585,654 @@ bool HyperCubeClientCore::SendActivity::writePacket(void)
 
     if (numSent < 0) numSent = 0;
     totalBytesSent += numSent;
+    numBytesSent += numSent;
+    numSendCalls++;
+    pIHyperCubeClientCore->metrics.count(HYPERCUBE_METRIC::BYTESOUT, (uint64_t)numSent);
     bool sendDone = writePacketBuilder.setNumSent(numSent);
+    if (sendDone) {
+        onPacketSent(writePacketLane, writePacketQueuedNs);
+        if (writePacketRetained) onPacketDone(writePacketRetained.get(), true);
+        if (writePacketSeq) replayBuffer.retain(writePacketSeq, writePacketRetained);
+        else if (writePacketRetained) PacketPool::instance().recycle(writePacketRetained);
+        writePacketSeq = 0;
+    }
 
     return sendDone;
 }
 
+/// Top up sendBatch from outPacketQs and send everything in it with one vectored call.
+/// Packets from MSerDes::msgToPacket() are already in wire format, so they are sent
+/// straight from their own buffers. A short send leaves the unsent tail in sendBatch,
+/// possibly part way into a packet, and it goes out first on the next call.
+/// URGENT packets are spliced in ahead of whatever has not started going out yet.
+bool HyperCubeClientCore::SendActivity::writeBatch(void)
+{
+    std::lock_guard<std::mutex> lock(writePacketBuilderLock);
+
+    spliceUrgent();
+    int batchBytes = -sendBatchOffset;
+    for (auto& rlanePacket : sendBatch) batchBytes += rlanePacket.ppacket->getLength();
+
+    while ((sendBatch.size() < HYPERCUBE_SENDBATCH_MAXPACKETS) && (batchBytes < HYPERCUBE_SENDBATCH_MAXBYTES)) {
+        LanePacket lanePacket;
+        if (!popOut(lanePacket.ppacket, &lanePacket.queuedNs, &lanePacket.lane, false, &lanePacket.seq)) break;
+        batchBytes += lanePacket.ppacket->getLength();
+        sendBatch.push_back(std::move(lanePacket));
+    }
+    if (sendBatch.empty()) return true; // all sent, nothing to send
+
+    IoVec iov[HYPERCUBE_SENDBATCH_MAXPACKETS];
+    int iovCount = 0;
+    for (auto& rlanePacket : sendBatch) {
+        // spliced URGENT packets can take the batch past the iov limit, the rest go next time
+        if (iovCount == HYPERCUBE_SENDBATCH_MAXPACKETS) break;
+        const char* pdata = rlanePacket.ppacket->getpData();
+        int dataLen = rlanePacket.ppacket->getLength();
+        if (iovCount == 0) {
+            pdata += sendBatchOffset;
+            dataLen -= sendBatchOffset;
+        }
+        setIoVec(iov[iovCount++], pdata, dataLen);
+    }
+
+    int numSent = sendDataOutv(iov, iovCount);
+
+    if (numSent < 0) numSent = 0;
+    totalBytesSent += numSent;
+    numBytesSent += numSent;
+    numSendCalls++;
+    pIHyperCubeClientCore->metrics.count(HYPERCUBE_METRIC::BYTESOUT, (uint64_t)numSent);
+
+    // retire every packet that is now completely sent
+    sendBatchOffset += numSent;
+    size_t numDone = 0;
+    while ((numDone < sendBatch.size()) && (sendBatchOffset >= sendBatch[numDone].ppacket->getLength())) {
+        sendBatchOffset -= sendBatch[numDone].ppacket->getLength();
+        onPacketSent(sendBatch[numDone].lane, sendBatch[numDone].queuedNs);
+        onPacketDone(sendBatch[numDone].ppacket.get(), true);
+        if (sendBatch[numDone].seq) replayBuffer.retain(sendBatch[numDone].seq, sendBatch[numDone].ppacket);
+        else PacketPool::instance().recycle(sendBatch[numDone].ppacket);
+        numDone++;
+    }
+    sendBatch.erase(sendBatch.begin(), sendBatch.begin() + numDone);
+
+    return sendBatch.empty();
+}
+
+/// threaded mode. A full socket buffer parks the thread in poll() until the peer has taken
+/// some data, and the next pass carries on from where the last send stopped. Any other
+/// send error gives up until the next packet is queued, the receive side sees the disconnect
 bool HyperCubeClientCore::SendActivity::writePackets(void)
 {
     bool sendDone = false;
     do {
-        sendDone = writePacket();
-    } while (!outPacketQ.isEmpty());
+        lastSendStalled = false;
+        sendDone = batchedSends ? writeBatch() : writePacket();
+        if (lastSendStalled && (!lastSendWouldBlock || !waitWritable())) return false;
+    } while ((!sendDone || !outPacketQsEmpty()) && !checkIfShouldExit());
     return sendDone;
 }
 
-bool HyperCubeClientCore::SendActivity::sendOut(Packet::UniquePtr& rppacket) 
+bool HyperCubeClientCore::SendActivity::waitWritable(void)
 {
-    outPacketQ.push(rppacket);
-    eventPacketsAvailableToSend.notify();
+    numWouldBlock++;
+    int64_t startNs = latencyNowNs();
+    bool writable = false;
+    while (!writable && !checkIfShouldExit() && pIHyperCubeClientCore->tcpSocketValid()) {
+        struct pollfd pollFd;
+        memset(&pollFd, 0, sizeof(pollFd));
+        pollFd.fd = pIHyperCubeClientCore->tcpGetSocket();
+        pollFd.events = POLLOUT;
+        int res = poll(&pollFd, 1, HYPERCUBE_SENDSTALL_POLLMS);
+        if (res == 0) continue;
+        if ((res < 0) && (errno == EINTR)) continue;
+        if ((res < 0) || (pollFd.revents & (POLLERR | POLLHUP | POLLNVAL))) break;
+        writable = (pollFd.revents & POLLOUT) != 0;
+    }
+    stallNs += latencyNowNs() - startNs;
+    return writable;
+}
+
+/// Called with writePacketBuilderLock held. Moves every queued URGENT packet into sendBatch,
+/// after the packet that is part way out and after the URGENT packets already there
+bool HyperCubeClientCore::SendActivity::spliceUrgent(void)
+{
+    const int urgent = (int)HYPERCUBE_LANE::URGENT;
+    if (outPacketQs[urgent].isEmpty()) return false;
+    size_t insertAt = (sendBatchOffset > 0) ? 1 : 0;
+    while ((insertAt < sendBatch.size()) && (sendBatch[insertAt].lane == urgent)) insertAt++;
+    LanePacket lanePacket;
+    lanePacket.lane = urgent;
+    while (popOutLane(urgent, lanePacket.ppacket, &lanePacket.queuedNs)) {
+        sendBatch.insert(sendBatch.begin() + insertAt++, std::move(lanePacket));
+        lanePacket.ppacket = 0;
+    }
+    return true;
+}
+
+/// Called with writePacketBuilderLock held. URGENT first, then SIGNALLING and DATA by
+/// laneSchedule. Weighted lanes spend a credit per packet and get weights[lane] more
+/// once every lane with packets waiting has run out. -1 when all are empty
+int HyperCubeClientCore::SendActivity::nextLane(bool includeUrgent)
+{
+    const int firstLane = (int)HYPERCUBE_LANE::SIGNALLING;
+    const int numLanes = (int)HYPERCUBE_LANE::NUMLANES;
+    if (includeUrgent && !outPacketQs[(int)HYPERCUBE_LANE::URGENT].isEmpty()) return (int)HYPERCUBE_LANE::URGENT;
+    if (laneSchedule.schedule == HYPERCUBE_LANESCHEDULE::STRICT) {
+        for (int lane = firstLane; lane < numLanes; lane++) {
+            if (laneReady(lane)) return lane;
+        }
+        return -1;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        for (int lane = firstLane; lane < numLanes; lane++) {
+            if ((laneCredits[lane] > 0) && laneReady(lane)) {
+                laneCredits[lane]--;
+                return lane;
+            }
+        }
+        for (int lane = firstLane; lane < numLanes; lane++) laneCredits[lane] = std::max(laneSchedule.weights[lane], 1);
+    }
+    return -1;
+}
+
+/// The DATA lane of a reliable session also has the packets to resend, and is held while the
+/// session is being resumed or while the replay buffer has no room for another packet
+bool HyperCubeClientCore::SendActivity::laneReady(int lane)
+{
+    if ((lane != (int)HYPERCUBE_LANE::DATA) || (sessionState == SESSIONSTATE::OFF)) return !outPacketQs[lane].isEmpty();
+    if (sessionState != SESSIONSTATE::OPEN) return false;
+    // resent packets are already counted in the replay buffer, they go out even when it is full
+    if (replayBuffer.isResendPending()) return true;
+    if (outPacketQs[lane].isEmpty()) return false;
+    if (replayBuffer.isFull()) {
+        if (!sessionAckRequested.exchange(true)) {
+            numFullStalls++;
+            sessionAckWanted = true;
+        }
+        return false;
+    }
+    return true;
+}
+
+/// nothing that can be sent now. Held reliable session DATA counts as empty
+bool HyperCubeClientCore::SendActivity::outPacketQsEmpty(void)
+{
+    for (int lane = 0; lane < (int)HYPERCUBE_LANE::NUMLANES; lane++) {
+        if (laneReady(lane)) return false;
+    }
+    return true;
+}
+
+void HyperCubeClientCore::SendActivity::onPacketSent(int lane, int64_t queuedNs)
+{
+    numPacketsSent++;
+    lanePacketsSent[lane]++;
+    pIHyperCubeClientCore->latencies.recordSince(HYPERCUBE_LATENCY::SENDDWELL, queuedNs);
+    laneDwell[lane].recordSince(queuedNs);
+}
+
+/// Queue a packet for the send thread on its lane. The DATA lane is subject to sendQueueLimits
+/// and its policy when there is no room, the others only to the size of their queues.
+/// On false the caller still owns rppacket
+bool HyperCubeClientCore::SendActivity::sendOut(Packet::UniquePtr& rppacket, HYPERCUBE_LANE lane, SentHandler onSent, bool* pdropped) 
+{
+    const Packet* ppacketId = rppacket.get();
+    if (onSent) {
+        // before it is queued, the sender could be done with it first
+        std::lock_guard<std::mutex> lock(sentHandlersLock);
+        sentHandlers[ppacketId] = std::move(onSent);
+        numSentHandlers++;
+    }
+    const int length = rppacket->getLength();
+    const int64_t queuedNs = pIHyperCubeClientCore->latencies.now();
+    const bool applyLimits = (lane == HYPERCUBE_LANE::DATA);
+    bool stat = queueOut(rppacket, length, queuedNs, (int)lane, applyLimits);
+
+    if (!stat && applyLimits) {
+        HYPERCUBE_BACKPRESSURE policy = sendQueueLimits.policy;
+        // blocking the thread that drains the queue, from a SentHandler say, would stop it ever draining
+        if ((policy == HYPERCUBE_BACKPRESSURE::BLOCK) && onSenderThread()) {
+            policy = HYPERCUBE_BACKPRESSURE::FAILFAST;
+        }
+        switch (policy) {
+            case HYPERCUBE_BACKPRESSURE::BLOCK:
+            {
+                const bool waitForever = (sendQueueLimits.blockTimeoutMs <= 0);
+                auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(sendQueueLimits.blockTimeoutMs);
+                numBlocked++;
+                while (!stat && waitForQueueSpace(deadline, waitForever)) {
+                    stat = queueOut(rppacket, length, queuedNs, (int)lane, true);
+                }
+                if (!stat) {
+                    numRejected++;
+                    pIHyperCubeClientCore->metrics.count(HYPERCUBE_METRIC::REJECTS);
+                }
+            }
+            break;
+            case HYPERCUBE_BACKPRESSURE::DROPOLDEST:
+                while (!stat && dropOldest()) {
+                    stat = queueOut(rppacket, length, queuedNs, (int)lane, true);
+                }
+                if (!stat) {
+                    numRejected++;
+                    pIHyperCubeClientCore->metrics.count(HYPERCUBE_METRIC::REJECTS);
+                }
+                break;
+            case HYPERCUBE_BACKPRESSURE::DROPNEWEST:
+                onPacketDone(ppacketId, false);
+                PacketPool::instance().recycle(rppacket);
+                numDropped++;
+                pIHyperCubeClientCore->metrics.count(HYPERCUBE_METRIC::DROPS);
+                if (pdropped) *pdropped = true;
+                runSentHandlers();
+                return true;
+            case HYPERCUBE_BACKPRESSURE::FAILFAST:
+            default:
+                numRejected++;
+                pIHyperCubeClientCore->metrics.count(HYPERCUBE_METRIC::REJECTS);
+                break;
+        }
+    }
+
+    // the caller recycles it
+    if (!stat) onPacketDone(ppacketId, false);
+    if (numSendHolds == 0) wakeSender();
+    runSentHandlers();
+    return stat;
+}
+
+bool HyperCubeClientCore::SendActivity::onSenderThread(void)
+{
+    if (peventLoopActivity) return peventLoopActivity->onLoopThread();
+    return sendThreadId.load() == std::this_thread::get_id();
+}
+
+bool HyperCubeClientCore::SendActivity::awaitingSent(const Packet* ppacket)
+{
+    if (numSentHandlers == 0) return false;
+    std::lock_guard<std::mutex> lock(sentHandlersLock);
+    return sentHandlers.count(ppacket) > 0;
+}
+
+/// the packet is written or thrown away. Its handler, if it has one, runs in runSentHandlers()
+void HyperCubeClientCore::SendActivity::onPacketDone(const Packet* ppacket, bool sent)
+{
+    if (numSentHandlers == 0) return;
+    std::lock_guard<std::mutex> lock(sentHandlersLock);
+    auto it = sentHandlers.find(ppacket);
+    if (it == sentHandlers.end()) return;
+    sentHandlersDue.emplace_back(std::move(it->second), sent);
+    sentHandlers.erase(it);
+}
+
+/// outside writePacketBuilderLock
+void HyperCubeClientCore::SendActivity::runSentHandlers(void)
+{
+    if (numSentHandlers == 0) return;
+    std::vector<std::pair<SentHandler, bool>> due;
+    {
+        std::lock_guard<std::mutex> lock(sentHandlersLock);
+        due.swap(sentHandlersDue);
+    }
+    for (auto& rdue : due) {
+        rdue.first(rdue.second);
+        numSentHandlers--;
+    }
+}
+
+void HyperCubeClientCore::SendActivity::failSentHandlers(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(sentHandlersLock);
+        for (auto& rentry : sentHandlers) sentHandlersDue.emplace_back(std::move(rentry.second), false);
+        sentHandlers.clear();
+    }
+    runSentHandlers();
+}
+
+void HyperCubeClientCore::SendActivity::wakeSender(void)
+{
+    if (peventLoopActivity) peventLoopActivity->wake();
+    else eventPacketsAvailableToSend.notify();
+}
+
+void HyperCubeClientCore::SendActivity::holdSends(bool hold)
+{
+    if (hold) numSendHolds++;
+    else if (--numSendHolds == 0) wakeSender();
+}
+
+/// Reserve room in the queue counters, then push. The counters are raised before the push
+/// so the send thread can never see them go negative
+bool HyperCubeClientCore::SendActivity::queueOut(Packet::UniquePtr& rppacket, int length, int64_t queuedNs, int lane, bool applyLimits)
+{
+    int64_t numPackets = queuedPackets.fetch_add(1) + 1;
+    int64_t numBytes = queuedBytes.fetch_add(length) + length;
+    // a single packet larger than maxBytes still goes through on an empty queue
+    bool overLimit = applyLimits && (numPackets > 1) &&
+        ((numPackets > sendQueueLimits.maxPackets) || (numBytes > sendQueueLimits.maxBytes));
+    laneQueuedPackets[lane]++;
+    laneQueuedBytes[lane] += length;
+    if (overLimit || !outPacketQs[lane].push(rppacket, queuedNs)) {
+        queuedPackets -= 1;
+        queuedBytes -= length;
+        laneQueuedPackets[lane]--;
+        laneQueuedBytes[lane] -= length;
+        return false;
+    }
+    if ((numBytes >= sendQueueLimits.highWatermarkBytes) && !aboveHighWatermark.exchange(true)) {
+        numHighWatermarks++;
+        pIHyperCubeClientCore->onSendQueueHigh();
+    }
     return true;
 }
 
+bool HyperCubeClientCore::SendActivity::popOut(Packet::UniquePtr& rppacket, int64_t* pqueuedNs, int* plane, bool includeUrgent, uint64_t* pseq)
+{
+    if (pseq) *pseq = 0;
+    int lane = nextLane(includeUrgent);
+    if (lane < 0) return false;
+    if (plane) *plane = lane;
+    if ((lane == (int)HYPERCUBE_LANE::DATA) && (sessionState == SESSIONSTATE::OPEN)) return popOutSession(rppacket, pqueuedNs, pseq);
+    return popOutLane(lane, rppacket, pqueuedNs);
+}
+
+/// Called with writePacketBuilderLock held. Packets to resend keep their numbers and go
+/// first, new ones take the next number and a place in the replay buffer
+bool HyperCubeClientCore::SendActivity::popOutSession(Packet::UniquePtr& rppacket, int64_t* pqueuedNs, uint64_t* pseq)
+{
+    uint64_t seq = 0;
+    if (replayBuffer.popResend(seq, rppacket)) {
+        if (pqueuedNs) *pqueuedNs = 0;
+    }
+    else {
+        if (!popOutLane((int)HYPERCUBE_LANE::DATA, rppacket, pqueuedNs)) return false;
+        replayBuffer.reserve(rppacket->getLength());
+        seq = ++lastSeq;
+    }
+    if (pseq) *pseq = seq;
+    return true;
+}
+
+bool HyperCubeClientCore::SendActivity::popOutLane(int lane, Packet::UniquePtr& rppacket, int64_t* pqueuedNs)
+{
+    if (!outPacketQs[lane].pop(rppacket, pqueuedNs)) return false;
+    int length = rppacket->getLength();
+    laneQueuedPackets[lane]--;
+    laneQueuedBytes[lane] -= length;
+    onDequeued(1, length);
+    return true;
+}
+
+void HyperCubeClientCore::SendActivity::onDequeued(int64_t numPackets, int64_t numBytes)
+{
+    queuedPackets -= numPackets;
+    int64_t numBytesLeft = (queuedBytes -= numBytes);
+    if ((numBytesLeft <= sendQueueLimits.lowWatermarkBytes) && aboveHighWatermark.exchange(false)) {
+        pIHyperCubeClientCore->onSendQueueLow();
+    }
+    if (numBlockedProducers > 0) {
+        std::lock_guard<std::mutex> lock(queueSpaceLock);
+        queueSpaceCondition.notify_all();
+    }
+}
+
+/// DROPOLDEST. Discard the packet at the front of the DATA lane. Taking writePacketBuilderLock
+/// keeps this thread the only consumer while it pops
+bool HyperCubeClientCore::SendActivity::dropOldest(void)
+{
+    std::lock_guard<std::mutex> lock(writePacketBuilderLock);
+    Packet::UniquePtr ppacket = 0;
+    if (!popOutLane((int)HYPERCUBE_LANE::DATA, ppacket)) return false;
+    onPacketDone(ppacket.get(), false);
+    PacketPool::instance().recycle(ppacket);
+    numDropped++;
+    pIHyperCubeClientCore->metrics.count(HYPERCUBE_METRIC::DROPS);
+    return true;
+}
+
+bool HyperCubeClientCore::SendActivity::waitForQueueSpace(std::chrono::steady_clock::time_point deadline, bool waitForever)
+{
+    if (checkIfShouldExit()) return false;
+    if (!waitForever && (std::chrono::steady_clock::now() >= deadline)) return false;
+    // make sure the send side is awake to drain the queue
+    wakeSender();
+    // short waits, so a missed notify or a drained queue on disconnect costs at most one interval
+    auto waitUntil = std::chrono::steady_clock::now() + std::chrono::milliseconds(10);
+    if (!waitForever && (deadline < waitUntil)) waitUntil = deadline;
+    std::unique_lock<std::mutex> lock(queueSpaceLock);
+    numBlockedProducers++;
+    queueSpaceCondition.wait_until(lock, waitUntil);
+    numBlockedProducers--;
+    return true;
+}
+
+/// empty outPacketQs and zero the counters. keepData leaves the DATA lane for a reliable
+/// session to send once it resumes. Called with writePacketBuilderLock held
+void HyperCubeClientCore::SendActivity::clearOutPacketQ(bool keepData)
+{
+    Packet::UniquePtr ppacket = 0;
+    for (int lane = 0; lane < (int)HYPERCUBE_LANE::NUMLANES; lane++) {
+        if (keepData && (lane == (int)HYPERCUBE_LANE::DATA)) continue;
+        while (popOutLane(lane, ppacket)) {
+            onPacketDone(ppacket.get(), false);
+            PacketPool::instance().recycle(ppacket);
+        }
+        outPacketQs[lane].deinit();
+    }
+}
+
+/// Called with writePacketBuilderLock held, as the connection goes. Numbered packets that
+/// were part way out belong in the replay buffer, the server dropped their partial bytes
+void HyperCubeClientCore::SendActivity::retainUnsent(void)
+{
+    if (writePacketSeq && writePacketRetained) replayBuffer.retain(writePacketSeq, writePacketRetained);
+    else if (writePacketRetained) {
+        onPacketDone(writePacketRetained.get(), false);
+        PacketPool::instance().recycle(writePacketRetained);
+    }
+    writePacketSeq = 0;
+    for (auto& rlanePacket : sendBatch) {
+        if (rlanePacket.seq) replayBuffer.retain(rlanePacket.seq, rlanePacket.ppacket);
+    }
+}
+
 int HyperCubeClientCore::SendActivity::sendDataOut(const void* pdata, const int dataLen)
 {
-    return pIHyperCubeClientCore->tcpSend((char*)pdata, dataLen);
+    int64_t startNs = pIHyperCubeClientCore->latencies.now();
+    int res = pIHyperCubeClientCore->tcpSend((char*)pdata, dataLen);
+    pIHyperCubeClientCore->latencies.recordSince(HYPERCUBE_LATENCY::SOCKETWRITE, startNs);
+    lastSendStalled = (res <= 0);
+    lastSendWouldBlock = (res < 0) && (lastSocketErrorWouldBlock() || (errno == EINTR));
+    return res;
+}
+
+int HyperCubeClientCore::SendActivity::sendDataOutv(const IoVec* piov, const int iovCount)
+{
+    int64_t startNs = pIHyperCubeClientCore->latencies.now();
+    // the threaded socket stays blocking for the receive thread, so only this call is made non-blocking
+    int res = pIHyperCubeClientCore->tcpSendv(piov, iovCount, !peventLoopActivity);
+    pIHyperCubeClientCore->latencies.recordSince(HYPERCUBE_LATENCY::SOCKETWRITE, startNs);
+    lastSendStalled = (res <= 0);
+    lastSendWouldBlock = (res < 0) && (lastSocketErrorWouldBlock() || (errno == EINTR));
+    return res;
+}
+
+/// event loop mode. Send until outPacketQs are empty or the socket stops taking data.
+/// Returns false if data is left, so the caller waits for the socket to become writable
+bool HyperCubeClientCore::SendActivity::onWritable(void)
+{
+    if (stallStartNs) {
+        stallNs += latencyNowNs() - stallStartNs;
+        stallStartNs = 0;
+    }
+    bool sendDone = true;
+    do {
+        lastSendStalled = false;
+        sendDone = batchedSends ? writeBatch() : writePacket();
+        if (lastSendStalled) {
+            if (lastSendWouldBlock) {
+                numWouldBlock++;
+                stallStartNs = latencyNowNs();
+            }
+            break;
+        }
+    } while (!sendDone || !outPacketQsEmpty());
+    requestSessionAckIfWanted();
+    runSentHandlers();
+    return !lastSendStalled;
+}
+
+void HyperCubeClientCore::SendActivity::clearSendBatch(void)
+{
+    // numbered packets have been moved to the replay buffer by now
+    for (auto& rlanePacket : sendBatch) {
+        if (!rlanePacket.ppacket) continue;
+        onPacketDone(rlanePacket.ppacket.get(), false);
+        PacketPool::instance().recycle(rlanePacket.ppacket);
+    }
+    sendBatch.clear();
+    sendBatchOffset = 0;
 }
 
 bool HyperCubeClientCore::SendActivity::onConnect(void)
 {
-    std::lock_guard<std::mutex> lock(writePacketBuilderLock);
-    writePacketBuilder.init();
-    outPacketQ.init();
+    {
+        std::lock_guard<std::mutex> lock(writePacketBuilderLock);
+        writePacketBuilder.init();
+        clearSendBatch();
+        clearOutPacketQ(reliable);
+        if (reliable) sessionState = SESSIONSTATE::RESUMING;
+    }
+    runSentHandlers();
     return true;
 }
 
 bool HyperCubeClientCore::SendActivity::onDisconnect(void)
 {
-    std::lock_guard<std::mutex> lock(writePacketBuilderLock);
-    writePacketBuilder.deinit();
-    outPacketQ.deinit();
+    {
+        std::lock_guard<std::mutex> lock(writePacketBuilderLock);
+        writePacketBuilder.deinit();
+        retainUnsent();
+        clearSendBatch();
+        clearOutPacketQ(reliable);
+        if (reliable) sessionState = SESSIONSTATE::RESUMING;
+    }
+    runSentHandlers();
     return true;
 }
 
+void HyperCubeClientCore::SendActivity::setReliableSession(bool enabled, const ReplayBufferLimits& limits)
+{
+    reliable = enabled;
+    replayBuffer.setLimits(limits);
+}
+
+/// The server answered the session offer. Resumed, everything after receivedSeq is sent
+/// again. Otherwise the session is gone with whatever it had not acked, and DATA goes
+/// out unnumbered on this connection
+void HyperCubeClientCore::SendActivity::onSessionOpened(bool resumed, uint64_t receivedSeq)
+{
+    {
+        std::lock_guard<std::mutex> lock(writePacketBuilderLock);
+        if (resumed) {
+            replayBuffer.resume(receivedSeq);
+            numResumes++;
+            sessionState = SESSIONSTATE::OPEN;
+        }
+        else {
+            replayBuffer.clear(true);
+            lastSeq = 0;
+            numRefused++;
+            sessionState = SESSIONSTATE::OFF;
+        }
+        sessionAckRequested = false;
+    }
+    wakeSender();
+}
+
+void HyperCubeClientCore::SendActivity::onSessionAck(uint64_t ackedSeq)
+{
+    replayBuffer.ack(ackedSeq);
+    // DATA may have been waiting for room
+    if (sessionAckRequested.exchange(false)) wakeSender();
+}
+
+/// outside writePacketBuilderLock, the request goes through sendOut() like any command
+void HyperCubeClientCore::SendActivity::requestSessionAckIfWanted(void)
+{
+    if (sessionAckWanted.exchange(false)) pIHyperCubeClientCore->requestSessionAck();
+}
+
+HyperCubeSessionStats HyperCubeClientCore::SendActivity::getSessionStats(void)
+{
+    HyperCubeSessionStats sessionStats;
+    sessionStats.open = (sessionState == SESSIONSTATE::OPEN);
+    sessionStats.lastSeq = lastSeq;
+    sessionStats.ackedSeq = replayBuffer.getAckedSeq();
+    sessionStats.numResumes = numResumes;
+    sessionStats.numRefused = numRefused;
+    sessionStats.numFullStalls = numFullStalls;
+    sessionStats.replay = replayBuffer.getStats();
+    return sessionStats;
+}
+
+HyperCubeSendStats HyperCubeClientCore::SendActivity::getSendStats(void)
+{
+    HyperCubeSendStats sendStats;
+    sendStats.numPacketsSent = numPacketsSent;
+    sendStats.numBytesSent = numBytesSent;
+    sendStats.numSendCalls = numSendCalls;
+    int64_t numQueuedPackets = queuedPackets;
+    int64_t numQueuedBytes = queuedBytes;
+    sendStats.queuedPackets = (numQueuedPackets > 0) ? (uint64_t)numQueuedPackets : 0;
+    sendStats.queuedBytes = (numQueuedBytes > 0) ? (uint64_t)numQueuedBytes : 0;
+    sendStats.numDropped = numDropped;
+    sendStats.numRejected = numRejected;
+    sendStats.numBlocked = numBlocked;
+    sendStats.numHighWatermarks = numHighWatermarks;
+    sendStats.numWouldBlock = numWouldBlock;
+    sendStats.stallNs = stallNs;
+    return sendStats;
+}
+
+HyperCubeLaneStats HyperCubeClientCore::SendActivity::getLaneStats(HYPERCUBE_LANE lane)
+{
+    HyperCubeLaneStats laneStats;
+    int64_t numQueuedPackets = laneQueuedPackets[(int)lane];
+    int64_t numQueuedBytes = laneQueuedBytes[(int)lane];
+    laneStats.queuedPackets = (numQueuedPackets > 0) ? (uint64_t)numQueuedPackets : 0;
+    laneStats.queuedBytes = (numQueuedBytes > 0) ? (uint64_t)numQueuedBytes : 0;
+    laneStats.numPacketsSent = lanePacketsSent[(int)lane];
+    laneStats.dwell = laneDwell[(int)lane].snapshot();
+    return laneStats;
+}
+
 
 // ------------------------------------------------------------------------------------------------
 
 HyperCubeClientCore::SignallingObject::SignallingObject(IHyperCubeClientCore* _pIHyperCubeClientCore) :
     pIHyperCubeClientCore{ _pIHyperCubeClientCore },
     CstdThread(this)
-{};
+{
+    newSession();
+    sigCommandHandlers[(int)HYPERCUBECOMMANDS::CONNECTIONINFOACK] = &SignallingObject::onConnectionInfoAck;
+    sigCommandHandlers[(int)HYPERCUBECOMMANDS::CREATEGROUPACK] = &SignallingObject::onCreateGroupAck;
+    sigCommandHandlers[(int)HYPERCUBECOMMANDS::SUBSCRIBEACK] = &SignallingObject::onSubscribeAck;
+    sigCommandHandlers[(int)HYPERCUBECOMMANDS::UNSUBSCRIBEACK] = &SignallingObject::onUnsubscribeAck;
+    sigCommandHandlers[(int)HYPERCUBECOMMANDS::SUBSCRIBER] = &SignallingObject::onSubscriber;
+    sigCommandHandlers[(int)HYPERCUBECOMMANDS::UNSUBSCRIBER] = &SignallingObject::onUnsubscriber;
+    sigCommandHandlers[(int)HYPERCUBECOMMANDS::CLOSEDFORDATA] = &SignallingObject::onClosedForDataCommand;
+    sigCommandHandlers[(int)HYPERCUBECOMMANDS::ECHODATA] = &SignallingObject::onEchoData;
+    sigCommandHandlers[(int)HYPERCUBECOMMANDS::REMOTEPING] = &SignallingObject::onRemotePing;
+    sigCommandHandlers[(int)HYPERCUBECOMMANDS::LOCALPING] = &SignallingObject::onLocalPing;
+};
 
-void HyperCubeClientCore::SignallingObject::init(std::string _serverIpAddress) 
+void HyperCubeClientCore::SignallingObject::init(std::string _serverIpAddress, bool startThread) 
 {
     serverIpAddress = _serverIpAddress;
-    if (!isStarted()) {
+    if (startThread && !isStarted()) {
         CstdThread::init(true);
         eventDisconnectedFromServer.reset();
     }
@@ -286,6 +1247,19 @@ void HyperCubeClientCore::SignallingObject::deinit(void)
         }
     }
     CstdThread::deinit(true);
+    // SendActivity::deinit() drops the replay buffer, so the next init() is a new session
+    newSession();
+    std::lock_guard<std::mutex> lock(resumeTokenLock);
+    resumeToken.clear();
+}
+
+void HyperCubeClientCore::SignallingObject::newSession(void)
+{
+    std::random_device random;
+    uint64_t id = 0;
+    while (id == 0) id = ((uint64_t)random() << 32) | (uint64_t)random();
+    sessionId = id;
+    sessionAckedSeq = 0;
 }
 
 bool HyperCubeClientCore::SignallingObject::threadFunction(void)
@@ -293,7 +1267,11 @@ bool HyperCubeClientCore::SignallingObject::threadFunction(void)
     LOG_INFO("HyperCubeClientCore::threadFunction()", "ThreadStarted", 0);
     while (!checkIfShouldExit()) {
         connectIfNotConnected();
-        eventDisconnectedFromServer.waitUntil(HYPERCUBE_CONNECTIONINTERVAL_MS);
+        int waitMs = socketValid() ? HYPERCUBE_CONNECTIONINTERVAL_MS : reconnectScheduler.msUntilNextAttempt();
+        // this thread also times out signalling requests, sendRequest() wakes it for an earlier one
+        int expireMs = expireRequests();
+        if ((expireMs >= 0) && (expireMs < waitMs)) waitMs = expireMs;
+        if (waitMs > 0) eventDisconnectedFromServer.waitUntil(waitMs);
     }
     exiting();
     return true;
@@ -302,179 +1280,404 @@ bool HyperCubeClientCore::SignallingObject::threadFunction(void)
 bool HyperCubeClientCore::SignallingObject::connectIfNotConnected(void)
 {
     bool stat = true;
+    // reset first, so a disconnect during the attempt, or a request, still wakes the thread
+    eventDisconnectedFromServer.reset();
     if (!socketValid()) {
-        if (justDisconnected) {
-            // wait another second to give time, if just after a disconnect. 
-            // This is a seperate signalling thread, so ok to sleep here
-            Sleep(2000);    
-            justDisconnected = false;
-        }
-        stat = connect();
-        LOG_STATESTRING("HyperCubeClientCore-ServerIP", serverIpAddress);
-        if (stat) {
-            LOG_INFO("HyperCubeClientCore::connectIfNotConnected()", "connected to " + serverIpAddress, 0);
-            pIHyperCubeClientCore->onConnect();
-            setupConnection();
-            connected = true;
-            alreadyWarnedOfFailedConnectionAttempt = false;
-            LOG_STATEINT("HyperCubeClientCore-NumSuccessfullConnectionAttempts", ++numSuccessfullConnectionAttempts);
-        } else {
-            LOG_STATESTRING("HyperCubeClientCore-state", "disconnected");
-            LOG_STATEINT("HyperCubeClientCore-NumFailedConnectionAttempts", ++numFailedConnectionAttempts);
-            if (!alreadyWarnedOfFailedConnectionAttempt) {
-                LOG_WARNING("HyperCubeClientCore::connectIfNotConnected()", "connection failed to " + serverIpAddress, 0);
-                alreadyWarnedOfFailedConnectionAttempt = true;
-            }
-        }
-        eventDisconnectedFromServer.reset();
+        stat = (reconnectScheduler.msUntilNextAttempt() == 0) && tryConnect();
+    }
+    return stat;
+}
 
+/// one connection attempt, set up the session if it succeeds
+bool HyperCubeClientCore::SignallingObject::tryConnect(void)
+{
+    bool stat = connect();
+    LOG_STATESTRING("HyperCubeClientCore-ServerIP", serverIpAddress);
+    if (stat) {
+        LOG_INFO("HyperCubeClientCore::connectIfNotConnected()", "connected to " + serverIpAddress, 0);
+        int64_t reconnectNs = reconnectScheduler.onConnected();
+        if (reconnectNs > 0) pIHyperCubeClientCore->latencies.recorders[(int)HYPERCUBE_LATENCY::RECONNECT].record(reconnectNs);
+        connectedNs = latencyNowNs();
+        openForDataPendingNs = (int64_t)connectedNs;
+        pIHyperCubeClientCore->onConnect();
+        setupConnection();
+        connected = true;
+        alreadyWarnedOfFailedConnectionAttempt = false;
+        LOG_STATEINT("HyperCubeClientCore-NumSuccessfullConnectionAttempts", ++numSuccessfullConnectionAttempts);
+    } else {
+        LOG_STATESTRING("HyperCubeClientCore-state", "disconnected");
+        LOG_STATEINT("HyperCubeClientCore-NumFailedConnectionAttempts", ++numFailedConnectionAttempts);
+        reconnectScheduler.onAttemptFailed();
+        if (!alreadyWarnedOfFailedConnectionAttempt) {
+            LOG_WARNING("HyperCubeClientCore::connectIfNotConnected()", "connection failed to " + serverIpAddress, 0);
+            alreadyWarnedOfFailedConnectionAttempt = true;
+        }
     }
     return stat;
 }
 
+/// Only the header is read, data packets go on to the application without being decoded.
+/// A packet whose header can not be read is passed on as data
 bool HyperCubeClientCore::SignallingObject::isSignallingMsg(std::unique_ptr<Packet>& rppacket)
 {
-    bool sigMsg = false;
-    Msg msg;
-    const Packet* ppacket = rppacket.get();
-    assert(mserdes.packetToMsg(ppacket, msg));
-    bool msgProcessed = false;
-    switch (msg.subSys) {
-    case SUBSYS_SIG:
-        sigMsg = true;
-        switch (msg.command) {
-        case CMD_JSON:
-            processSigMsgJson(ppacket);
-            break;
-        default:
-            assert(false); // should not get here
-        }
+    int subSys = 0;
+    int command = 0;
+    if (!PacketClassifier::instance().classify(*rppacket, subSys, command)) return false;
+    if (subSys != SUBSYS_SIG) return false;
+    switch (command) {
+    case CMD_JSON:
+        processSigMsgJson(rppacket.get());
         break;
     default:
+        ALOG_WARNING("HyperCubeClientCore::SignallingObject::isSignallingMsg()", "unknown signalling command dropped", command);
         break;
     }
-    return sigMsg;
+    return true;
 }
 
-bool HyperCubeClientCore::SignallingObject::onConnectionInfoAck(HyperCubeCommand& hyperCubeCommand)
+bool HyperCubeClientCore::SignallingObject::onConnectionInfoAck(SigCommandIn& rin)
 {
+    HyperCubeCommand& hyperCubeCommand = rin.rcommand;
+    const json& jsonData = rin.rjsonData;
     ConnectionInfoAck connectionInfoAck;
     connectionInfoAck.from_json(hyperCubeCommand.getJsonData());
-    std::string jsonDataString = connectionInfoAck.to_json().dump();
     if (hyperCubeCommand.status) {
-        LOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "onConnectionInfoAck, status:success", 0);
+        ALOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "onConnectionInfoAck, status:success", 0);
+        // servers that know about capabilities say which of the ones we offered they accept
+        if (jsonData.contains("capabilities")) {
+            const json& capabilities = jsonData["capabilities"];
+            if (capabilities.value("sigCodec", "") == SIGCODEC_NAME) {
+                binarySigCodec = true;
+                ALOG_INFO("HyperCubeClientCore::SignallingObject::onConnectionInfoAck()", "using binary signalling codec", 0);
+            }
+            // JSON commands always carry their correlation id, binary ones only if the server takes it
+            correlationIds = capabilities.value("correlationIds", false);
+            if (compressionOffered && (capabilities.value("compression", "") == LZCODEC_NAME)) {
+                compression = true;
+                ALOG_INFO("HyperCubeClientCore::SignallingObject::onConnectionInfoAck()", "compressing payloads", 0);
+            }
+        }
     }
     else {
-        LOG_WARNING("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "onConnectionInfoAckstatus:Failed - Duplicate name? " + jsonDataString, 0);
+        ALOG_WARNING("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "onConnectionInfoAckstatus:Failed - Duplicate name? ", 0, connectionInfoAck.to_json().dump());
     }
+    if (sessionOffered) {
+        bool resumed = false;
+        uint64_t receivedSeq = 0;
+        if (hyperCubeCommand.status && jsonData.contains("capabilities") && jsonData["capabilities"].contains("session")) {
+            const json& session = jsonData["capabilities"]["session"];
+            resumed = (session.value("id", (uint64_t)0) == sessionId);
+            receivedSeq = session.value("received", (uint64_t)0);
+        }
+        if (resumed) {
+            if (receivedSeq > sessionAckedSeq) sessionAckedSeq = receivedSeq;
+            LOG_INFO("HyperCubeClientCore::SignallingObject::onConnectionInfoAck()", "session resumed", (int)receivedSeq);
+        }
+        else {
+            LOG_WARNING("HyperCubeClientCore::SignallingObject::onConnectionInfoAck()", "session not resumed, unacked data dropped", 0);
+            newSession();
+        }
+        pIHyperCubeClientCore->onSessionOpened(resumed, receivedSeq);
+    }
+    bool connectionResumed = false;
+    if (hyperCubeCommand.status && jsonData.contains("capabilities") && jsonData["capabilities"].contains("resume")) {
+        const json& resume = jsonData["capabilities"]["resume"];
+        connectionResumed = resume.value("resumed", false);
+        std::lock_guard<std::mutex> lock(resumeTokenLock);
+        resumeToken = resumeOffered ? resume.value("token", "") : "";
+    }
+    if (resumeTokenOffered) {
+        if (connectionResumed) {
+            numResumed++;
+            LOG_INFO("HyperCubeClientCore::SignallingObject::onConnectionInfoAck()", "connection resumed", 0);
+        }
+        else {
+            // the server no longer knows the token, the second round trip setupConnection() saved
+            numFallbacks++;
+            setupAcksPending |= SETUPACK_CREATEGROUP;
+            createGroup(groupName);
+        }
+    }
+    onSetupAck(SETUPACK_CONNECTIONINFO, hyperCubeCommand.status);
+    return true;
+}
+
+/// Times the setup once the last of its commands is acked. Acks that arrive after a
+/// reconnect started a new setup, or that were never asked for, are ignored
+void HyperCubeClientCore::SignallingObject::onSetupAck(int setupAck, bool status)
+{
+    int pending = setupAcksPending.fetch_and(~setupAck);
+    if (!(pending & setupAck)) return;
+    if (!status) numFailedSetupAcks++;
+    if ((pending & ~setupAck) != 0) return;
+    int64_t setupNs = latencyNowNs() - connectedNs;
+    lastSetupNs = setupNs;
+    pIHyperCubeClientCore->latencies.recorders[(int)HYPERCUBE_LATENCY::SETUP].record(setupNs);
+    LOG_INFO("HyperCubeClientCore::SignallingObject::onSetupAck()", "setup acked, us", (int)(setupNs / 1000));
+}
+
+HyperCubeSetupStats HyperCubeClientCore::SignallingObject::getSetupStats(void)
+{
+    HyperCubeSetupStats setupStats;
+    setupStats.numSetups = numSetups;
+    setupStats.numResumed = numResumed;
+    setupStats.numFallbacks = numFallbacks;
+    setupStats.numFailedAcks = numFailedSetupAcks;
+    int pending = setupAcksPending;
+    for (; pending; pending &= pending - 1) setupStats.pendingAcks++;
+    setupStats.lastSetupNs = lastSetupNs;
+    setupStats.lastOpenForDataNs = lastOpenForDataNs;
+    return setupStats;
+}
+
+/// {"session": {"ack": seq}}, the server has every DATA packet up to seq
+bool HyperCubeClientCore::SignallingObject::onSessionMsg(const json& session)
+{
+    if (!sessionOffered || !session.contains("ack")) return false;
+    uint64_t ackedSeq = session["ack"].get<uint64_t>();
+    if (ackedSeq > sessionAckedSeq) sessionAckedSeq = ackedSeq;
+    pIHyperCubeClientCore->onSessionAck(ackedSeq);
     return true;
 }
 
-bool HyperCubeClientCore::SignallingObject::onCreateGroupAck(HyperCubeCommand& hyperCubeCommand)
+/// the replay buffer is full, ask for an ack now rather than at the next ackEvery
+bool HyperCubeClientCore::SignallingObject::requestSessionAck(void)
 {
+    json j = { { "session", { { "ackRequest", true } } } };
+    SigMsg signallingMsg(j.dump());
+    return sendMsgOut(signallingMsg, HYPERCUBE_LANE::URGENT);
+}
+
+bool HyperCubeClientCore::SignallingObject::onCreateGroupAck(SigCommandIn& rin)
+{
+    HyperCubeCommand& hyperCubeCommand = rin.rcommand;
     GroupInfo groupInfo;
     groupInfo.from_json(hyperCubeCommand.getJsonData());
-    std::string jsonDataString = groupInfo.to_json().dump();
     if (hyperCubeCommand.status) {
-        LOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "createGroupAck, status:success", 0);
+        ALOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "createGroupAck, status:success", 0);
     }
     else {
-        LOG_WARNING("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "createGroupAck status:Failed - Duplicate name? " + jsonDataString, 0);
+        ALOG_WARNING("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "createGroupAck status:Failed - Duplicate name? ", 0, groupInfo.to_json().dump());
     }
+    onSetupAck(SETUPACK_CREATEGROUP, hyperCubeCommand.status);
     return true;
 }
 
-bool HyperCubeClientCore::SignallingObject::onRemotePing(HyperCubeCommand& hyperCubeCommand)
+bool HyperCubeClientCore::SignallingObject::onRemotePing(SigCommandIn& rin)
 {
-    std::string pingData = hyperCubeCommand.getJsonData().dump();
-    if (hyperCubeCommand.ack) {
-        LOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "onRemotePing ack", 0);
+    if (rin.rcommand.ack) {
+        ALOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "onRemotePing ack", 0);
     } else {
-        LOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "onRemotePing command", 0);
-        remotePing(true, pingData);
+        ALOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "onRemotePing command", 0);
+        StringInfo stringInfo;
+        stringInfo.data = rin.rcommand.getJsonData().dump();
+        sendCmdOut(HYPERCUBECOMMANDS::REMOTEPING, stringInfo, true, rin.correlationId);
     }
     return true;
 }
 
-bool HyperCubeClientCore::SignallingObject::onEchoData(HyperCubeCommand& hyperCubeCommand)
+bool HyperCubeClientCore::SignallingObject::onEchoData(SigCommandIn& rin)
 {
-    std::string data = hyperCubeCommand.getJsonData().dump();
-    bool status = echoData(data);
-    std::string jsonDataString = hyperCubeCommand.getJsonData().dump();
+    // the echo of one of ours, onReply() has it
+    if (rin.rcommand.ack) return true;
+    // the server's echo is answered with an ack carrying its correlation id, not a request of our own
+    StringInfo stringInfo;
+    stringInfo.data = rin.rcommand.getJsonData().dump();
+    bool status = sendCmdOut(HYPERCUBECOMMANDS::ECHODATA, stringInfo, true, rin.correlationId);
+    const std::string& data = stringInfo.data;
     if (status) {
-        LOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "onEchoData, success", 0);
+        ALOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "onEchoData, success", 0);
     }
     else {
-        LOG_WARNING("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "onEchoDat Failed" + jsonDataString, 0);
+        ALOG_WARNING("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "onEchoDat Failed", 0, data);
     }
     return true;
 }
 
+bool HyperCubeClientCore::SignallingObject::onSubscribeAck(SigCommandIn& rin)
+{
+    ALOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "received subscribeAck", 0, rin.plogText, rin.logTextLength);
+    return true;
+}
+
+bool HyperCubeClientCore::SignallingObject::onUnsubscribeAck(SigCommandIn& rin)
+{
+    ALOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "received unsubscribeAck", 0, rin.plogText, rin.logTextLength);
+    return true;
+}
+
+bool HyperCubeClientCore::SignallingObject::onSubscriber(SigCommandIn& rin)
+{
+    ALOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "received subscriber", 0, rin.plogText, rin.logTextLength);
+    onOpenForData();
+    return true;
+}
+
+bool HyperCubeClientCore::SignallingObject::onUnsubscriber(SigCommandIn& rin)
+{
+    ALOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "received unsubscriber", 0, rin.plogText, rin.logTextLength);
+    onClosedForData();
+    return true;
+}
+
+bool HyperCubeClientCore::SignallingObject::onClosedForDataCommand(SigCommandIn& rin)
+{
+    ALOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "received onClosedForData", 0, rin.plogText, rin.logTextLength);
+    onClosedForData();
+    return true;
+}
+
+bool HyperCubeClientCore::SignallingObject::onLocalPing(SigCommandIn& rin)
+{
+    ALOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "received LocalPing", 0, rin.plogText, rin.logTextLength);
+    if (rin.rcommand.ack) onSetupAck(SETUPACK_LOCALPING, true);
+    return true;
+}
+
 bool HyperCubeClientCore::SignallingObject::processSigMsgJson(const Packet* ppacket)
 {
     MsgJson msgJson;
     json jsonData;
-    assert(mserdes.packetToMsgJson(ppacket, msgJson, jsonData));
     bool msgProcessed = false;
+    if (!mserdes.packetToMsg(ppacket, msgJson)) {
+        ALOG_WARNING("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "Failed to decode packet", 0);
+        return false;
+    }
 
     try {
-        std::string logLineData = msgJson.jsonData;
+        bool binary = SigCodec::isBinary(msgJson.jsonData);
+        // the log keeps the start of a JSON command, only that much is copied
+        const char* plogText = binary ? "" : msgJson.jsonData.data();
+        size_t logTextLength = binary ? 0 : msgJson.jsonData.size();
         //        LOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "received " + line, 0);
         HyperCubeCommand hyperCubeCommand(HYPERCUBECOMMANDS::NONE, NULL, true);
-        hyperCubeCommand.from_json(jsonData);
-
-        switch (hyperCubeCommand.command) {
-            case HYPERCUBECOMMANDS::CONNECTIONINFOACK:
-                msgProcessed = onConnectionInfoAck(hyperCubeCommand);
-                break;
-            case HYPERCUBECOMMANDS::CREATEGROUPACK:
-                msgProcessed = onCreateGroupAck(hyperCubeCommand);
-                break;
-            case HYPERCUBECOMMANDS::SUBSCRIBEACK:
-                LOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "received subscribeAck" + logLineData, 0);
-                msgProcessed = true;
-                break;
-            case HYPERCUBECOMMANDS::UNSUBSCRIBEACK:
-                LOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "received unsubscribeAck" + logLineData, 0);
-                msgProcessed = true;
-                break;
-            case HYPERCUBECOMMANDS::SUBSCRIBER:
-                LOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "received subscriber" + logLineData, 0);
-                onOpenForData();
-                msgProcessed = true;
-                break;
-            case HYPERCUBECOMMANDS::UNSUBSCRIBER:
-                LOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "received unsubscriber" + logLineData, 0);
-                onClosedForData();
-                msgProcessed = true;
-                break;
-            case HYPERCUBECOMMANDS::CLOSEDFORDATA:
-                LOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "received onClosedForData" + logLineData, 0);
-                onClosedForData();
-                msgProcessed = true;
-                break;
-            case HYPERCUBECOMMANDS::ECHODATA:
-                msgProcessed = onEchoData(hyperCubeCommand);
-                break;
-            case HYPERCUBECOMMANDS::REMOTEPING:
-                msgProcessed = onRemotePing(hyperCubeCommand);
-                break;
-            case HYPERCUBECOMMANDS::LOCALPING:
-                LOG_INFO("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "received LocalPing" + logLineData, 0);
-                msgProcessed = true;
-                break;
-            default:
-                break;
+        uint32_t correlationId = 0;
+        if (binary) {
+            if (!SigCodec::decode(msgJson.jsonData, hyperCubeCommand, correlationId)) {
+                ALOG_WARNING("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "Failed to decode binary command", 0);
+                return false;
+            }
+        }
+        else {
+            jsonData = json::parse(msgJson.jsonData);
+            // reliable session acks are not commands, and always JSON
+            if (jsonData.contains("session")) return onSessionMsg(jsonData["session"]);
+            hyperCubeCommand.from_json(jsonData);
+            correlationId = jsonData.value("correlationId", (uint32_t)0);
         }
+
+        // the setup handlers below rely on the connection's capabilities, so complete after them
+        bool reply = hyperCubeCommand.ack || isAckCommand(hyperCubeCommand.command);
+
+        SigCommandIn in{ hyperCubeCommand, jsonData, correlationId, plogText, logTextLength };
+        unsigned command = (unsigned)hyperCubeCommand.command;
+        if ((command < MSGDISPATCHER_MAXCOMMANDS) && sigCommandHandlers[command]) {
+            msgProcessed = (this->*sigCommandHandlers[command])(in);
+        }
+        if (reply) onReply(hyperCubeCommand, correlationId);
+        if (pIHyperCubeClientCore->dispatcher.dispatchCommand(hyperCubeCommand)) msgProcessed = true;
     }
     catch (...) {
-        LOG_WARNING("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "Failed to decode json", 0);
+        ALOG_WARNING("HyperCubeClientCore::SignallingObject::processSigMsgJson()", "Failed to decode json", 0);
     }
     return msgProcessed;
 }
 
+/// Commands go out as JSON until the server has accepted the binary codec for this connection.
+/// CONNECTIONINFO is always JSON and carries the capabilities we offer, which older servers ignore
+bool HyperCubeClientCore::SignallingObject::sendCmdOut(HYPERCUBECOMMANDS command, CommonInfoBase& commonInfoBase, bool ack, uint32_t correlationId)
+{
+    // remote pings and acks are what RTTs are measured with, they must not wait behind data.
+    // The rest keep their order on SIGNALLING: setupConnection() relies on CONNECTIONINFO,
+    // CREATEGROUP and the LOCALPING after them reaching the server in that order, so none of
+    // them may go URGENT
+    const bool urgent = ack || (command == HYPERCUBECOMMANDS::REMOTEPING);
+    const HYPERCUBE_LANE lane = urgent ? HYPERCUBE_LANE::URGENT : HYPERCUBE_LANE::SIGNALLING;
+    if (binarySigCodec && (command != HYPERCUBECOMMANDS::CONNECTIONINFO)) {
+        std::string commandData;
+        SigCodec::encode(command, commonInfoBase, ack, true, commandData, correlationIds ? correlationId : 0);
+        SigMsg signallingMsg(commandData);
+        return sendMsgOut(signallingMsg, lane);
+    }
+    HyperCubeCommand hypeCubeCommand(command, commonInfoBase.to_json(), true);
+    hypeCubeCommand.ack = ack;
+    json commandJson = hypeCubeCommand.to_json();
+    if (correlationId != 0) commandJson["correlationId"] = correlationId;
+    if (command == HYPERCUBECOMMANDS::CONNECTIONINFO) {
+        commandJson["capabilities"] = { { "sigCodecs", { SIGCODEC_NAME } }, { "correlationIds", true } };
+        if (compressionOffered) commandJson["capabilities"]["compression"] = { LZCODEC_NAME };
+        if (resumeOffered) {
+            std::lock_guard<std::mutex> lock(resumeTokenLock);
+            commandJson["capabilities"]["resume"] = { { "token", resumeTokenOffered ? resumeToken : "" } };
+        }
+        if (sessionOffered) {
+            commandJson["capabilities"]["session"] = {
+                { "id", (uint64_t)sessionId },
+                { "acked", (uint64_t)sessionAckedSeq },
+                { "ackEvery", HYPERCUBE_SESSION_ACKEVERY },
+            };
+        }
+    }
+    SigMsg signallingMsg(commandJson.dump());
+    return sendMsgOut(signallingMsg, lane);
+}
+
+/// A command the server acks, sent with a correlation id and tracked until the ack, the timeout
+/// or the end of the connection. Commands with no known ack go out untracked
+bool HyperCubeClientCore::SignallingObject::sendRequest(HYPERCUBECOMMANDS command, CommonInfoBase& commonInfoBase, ReplyHandler handler, int timeoutMs)
+{
+    HYPERCUBECOMMANDS ackCommand = ackCommandFor(command);
+    if (ackCommand == HYPERCUBECOMMANDS::NONE) {
+        bool stat = sendCmdOut(command, commonInfoBase);
+        if (handler) handler(RequestReply());
+        return stat;
+    }
+    bool wakeExpiry = false;
+    uint32_t correlationId = requestTracker.add((int)ackCommand, timeoutMs, handler, wakeExpiry);
+    // in EVENTLOOP mode queueing the command wakes the loop, which times requests out
+    if (wakeExpiry && isStarted()) eventDisconnectedFromServer.notify();
+    if (!sendCmdOut(command, commonInfoBase, false, correlationId)) {
+        requestTracker.cancel(correlationId);
+        return false;
+    }
+    return true;
+}
+
+/// the ack a command is matched with when the server does not echo its correlation id
+HYPERCUBECOMMANDS HyperCubeClientCore::SignallingObject::ackCommandFor(HYPERCUBECOMMANDS command)
+{
+    switch (command) {
+        case HYPERCUBECOMMANDS::CONNECTIONINFO: return HYPERCUBECOMMANDS::CONNECTIONINFOACK;
+        case HYPERCUBECOMMANDS::CREATEGROUP: return HYPERCUBECOMMANDS::CREATEGROUPACK;
+        // pings and echoes come back as the same command with the ack flag
+        case HYPERCUBECOMMANDS::REMOTEPING:
+        case HYPERCUBECOMMANDS::LOCALPING:
+        case HYPERCUBECOMMANDS::ECHODATA:
+            return command;
+        default:
+            return HYPERCUBECOMMANDS::NONE;
+    }
+}
+
+bool HyperCubeClientCore::SignallingObject::isAckCommand(HYPERCUBECOMMANDS command)
+{
+    return (command == HYPERCUBECOMMANDS::CONNECTIONINFOACK) || (command == HYPERCUBECOMMANDS::CREATEGROUPACK)
+        || (command == HYPERCUBECOMMANDS::SUBSCRIBEACK) || (command == HYPERCUBECOMMANDS::UNSUBSCRIBEACK);
+}
+
+/// completes the request this ack answers, its round trip is SIGNALLINGRTT
+void HyperCubeClientCore::SignallingObject::onReply(HyperCubeCommand& hyperCubeCommand, uint32_t correlationId)
+{
+    int64_t rttNs = 0;
+    if (!requestTracker.onAck(correlationId, (int)hyperCubeCommand.command, hyperCubeCommand.status, hyperCubeCommand.getJsonData(), rttNs)) return;
+    if (pIHyperCubeClientCore->latencies.enabled) pIHyperCubeClientCore->latencies.recorders[(int)HYPERCUBE_LATENCY::SIGNALLINGRTT].record(rttNs);
+}
+
+/// the probe is a separate connection, see ReconnectPolicy::connectTimeoutMs for what that costs
 bool HyperCubeClientCore::SignallingObject::connect(void)
 {
+    int connectTimeoutMs = reconnectScheduler.getPolicy().connectTimeoutMs;
+    if ((connectTimeoutMs > 0) && !pIHyperCubeClientCore->tcpProbe(serverIpAddress, SERVER_PORT, connectTimeoutMs)) return false;
     bool stat = pIHyperCubeClientCore->tcpConnect(serverIpAddress, SERVER_PORT);
     return stat;
 }
@@ -487,10 +1690,17 @@ bool HyperCubeClientCore::SignallingObject::onConnect(void)
 
 bool HyperCubeClientCore::SignallingObject::onDisconnect(void)
 {
+    binarySigCodec = false;
+    compression = false;
+    setupAcksPending = 0;
+    openForDataPendingNs = 0;
+    correlationIds = false;
+    // their acks went with the connection
+    requestTracker.cancelAll();
     if (connected) {
         LOG_STATESTRING("HyperCubeClientCore-state", "disconnected");
         connected = false;
-        justDisconnected = true;
+        reconnectScheduler.onDisconnected();
         eventDisconnectedFromServer.notify();
     }
     return true;
@@ -498,6 +1708,12 @@ bool HyperCubeClientCore::SignallingObject::onDisconnect(void)
 
 bool HyperCubeClientCore::SignallingObject::onOpenForData(void)
 {
+    int64_t startNs = openForDataPendingNs.exchange(0);
+    if (startNs != 0) {
+        int64_t openNs = latencyNowNs() - startNs;
+        lastOpenForDataNs = openNs;
+        pIHyperCubeClientCore->latencies.recorders[(int)HYPERCUBE_LATENCY::OPENFORDATA].record(openNs);
+    }
     LOG_STATESTRING("HyperCubeClientCore-state", "openForData");
     pIHyperCubeClientCore->onOpenForData();
     return true;
@@ -510,45 +1726,60 @@ bool HyperCubeClientCore::SignallingObject::onClosedForData(void)
     return true;
 }
 
+/// The whole handshake is queued before the sender is woken, so it goes out in one send and
+/// the acks come back in one round trip. With a resume token from the last connection,
+/// CONNECTIONINFO restores the group as well and createGroup() is only sent if the server
+/// turns the token down. Each command's ack is tracked, see onSetupAck(). The commands must
+/// arrive in the order they are sent here, they all go on the SIGNALLING lane, see sendCmdOut()
 bool HyperCubeClientCore::SignallingObject::setupConnection(void)
 {
-    //sendEcho();
+    {
+        std::lock_guard<std::mutex> lock(resumeTokenLock);
+        resumeTokenOffered = resumeOffered && !resumeToken.empty();
+    }
+    int setupAcks = SETUPACK_CONNECTIONINFO | SETUPACK_LOCALPING;
+    if (!resumeTokenOffered) setupAcks |= SETUPACK_CREATEGROUP;
+    setupAcksPending = setupAcks;
+    numSetups++;
+    pIHyperCubeClientCore->holdSends(true);
     sendConnectionInfo("Matrix");
-    createGroup("TeamPegasus");
+    if (!resumeTokenOffered) createGroup(groupName);
     localPing();
-    LOG_INFO("HyperCubeClientCore::SignallingObject::setupConnection()", "done setup", 0);
+    pIHyperCubeClientCore->holdSends(false);
+    LOG_INFO("HyperCubeClientCore::SignallingObject::setupConnection()", "done setup", setupAcks);
     return true;
 }
 
-bool HyperCubeClientCore::SignallingObject::echoData(std::string echoData)
+bool HyperCubeClientCore::SignallingObject::echoData(std::string echoData, ReplyHandler handler, int timeoutMs)
 {
-    LOG_INFO("HyperCubeClientCore::echoData()", "", 0);
+    ALOG_INFO("HyperCubeClientCore::echoData()", "", 0);
     if (echoData.length() == 0) echoData = "echoDataData";
     StringInfo stringInfo;
     stringInfo.data = echoData;
-    return sendCmdOut(HYPERCUBECOMMANDS::ECHODATA, stringInfo);
+    return sendRequest(HYPERCUBECOMMANDS::ECHODATA, stringInfo, handler, timeoutMs);
 }
 
 bool HyperCubeClientCore::SignallingObject::localPing(bool ack, std::string data)
 {
-    LOG_INFO("HyperCubeClientCore::localPing()", "", 0);
+    ALOG_INFO("HyperCubeClientCore::localPing()", "", 0);
     StringInfo stringInfo;
     stringInfo.data = data;
-    return sendCmdOut(HYPERCUBECOMMANDS::LOCALPING, stringInfo, ack);
+    if (ack) return sendCmdOut(HYPERCUBECOMMANDS::LOCALPING, stringInfo, true);
+    return sendRequest(HYPERCUBECOMMANDS::LOCALPING, stringInfo, nullptr, REQUEST_TIMEOUT_MS);
 }
 
-bool HyperCubeClientCore::SignallingObject::remotePing(bool ack, std::string data)
+bool HyperCubeClientCore::SignallingObject::remotePing(std::string data, ReplyHandler handler, int timeoutMs)
 {
-    LOG_INFO("HyperCubeClientCore::remotePing()", "", 0);
+    ALOG_INFO("HyperCubeClientCore::remotePing()", "", 0);
     StringInfo stringInfo;
     stringInfo.data = data;
-    return sendCmdOut(HYPERCUBECOMMANDS::REMOTEPING, stringInfo, ack);
+    return sendRequest(HYPERCUBECOMMANDS::REMOTEPING, stringInfo, handler, timeoutMs);
 }
 
 
 bool HyperCubeClientCore::SignallingObject::publish(void)
 {
-    LOG_INFO("HyperCubeClientCore::publish()", "", 0);
+    ALOG_INFO("HyperCubeClientCore::publish()", "", 0);
     PublishInfo publishInfo;
     publishInfo.publishData = "publish data!";
     return sendCmdOut(HYPERCUBECOMMANDS::PUBLISHINFO, publishInfo);
@@ -556,33 +1787,246 @@ bool HyperCubeClientCore::SignallingObject::publish(void)
 
 bool HyperCubeClientCore::SignallingObject::sendConnectionInfo(std::string _connectionName)
 {
-    LOG_INFO("HyperCubeClientCore::sendConnectionInfo()", "", 0);
-    return sendCmdOut(HYPERCUBECOMMANDS::CONNECTIONINFO, connectionInfo);
+    ALOG_INFO("HyperCubeClientCore::sendConnectionInfo()", "", 0);
+    return sendRequest(HYPERCUBECOMMANDS::CONNECTIONINFO, connectionInfo, nullptr, REQUEST_TIMEOUT_MS);
 }
 
-bool HyperCubeClientCore::SignallingObject::createGroup(std::string _groupName)
+bool HyperCubeClientCore::SignallingObject::createGroup(std::string _groupName, ReplyHandler handler, int timeoutMs)
 {
-    LOG_INFO("HyperCubeClientCore::createGroup()", "", 0);
+    ALOG_INFO("HyperCubeClientCore::createGroup()", "", 0);
     GroupInfo groupInfo;
     groupInfo.groupName = _groupName;
     groupInfo.creatorConnectionInfo = connectionInfo;
-    return sendCmdOut(HYPERCUBECOMMANDS::CREATEGROUP, groupInfo);
+    return sendRequest(HYPERCUBECOMMANDS::CREATEGROUP, groupInfo, handler, timeoutMs);
 }
 
-bool HyperCubeClientCore::SignallingObject::subscribe(std::string _groupName)
+bool HyperCubeClientCore::SignallingObject::subscribe(std::string _groupName, ReplyHandler handler, int timeoutMs)
 {
     string command; 
     uint64_t _groupId = 1;
 
+    bool wakeExpiry = false;
+    uint32_t correlationId = requestTracker.add((int)HYPERCUBECOMMANDS::SUBSCRIBEACK, timeoutMs, handler, wakeExpiry);
+    if (wakeExpiry && isStarted()) eventDisconnectedFromServer.notify();
     json j = {
         { "command", "subscribe" },
-        { "groupName", _groupName }
+        { "groupName", _groupName },
+        { "correlationId", correlationId }
     };
 
     command = j.dump();
     SigMsg signallingMsg(command);
-    LOG_INFO("HyperCubeClientCore::subscribe()", "", 0);
-    return sendMsgOut(signallingMsg);
+    ALOG_INFO("HyperCubeClientCore::subscribe()", "", 0);
+    if (!sendMsgOut(signallingMsg)) {
+        requestTracker.cancel(correlationId);
+        return false;
+    }
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+HyperCubeClientCore::EventLoopActivity::EventLoopActivity(HyperCubeClientCore& _rhyperCubeClientCore) :
+    CstdThread(this),
+    rhyperCubeClientCore{ _rhyperCubeClientCore }
+{};
+
+HyperCubeClientCore::EventLoopActivity::~EventLoopActivity() {};
+
+bool HyperCubeClientCore::EventLoopActivity::init(void)
+{
+#ifdef _WIN64
+    LOG_WARNING("HyperCubeClientCore::EventLoopActivity::init()", "event loop mode not supported on windows", 0);
+    return false;
+#else
+    if (isStarted()) return true;
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((epollFd < 0) || (wakeFd < 0)) {
+        LOG_WARNING("HyperCubeClientCore::EventLoopActivity::init()", "epoll/eventfd create failed", errno);
+        return false;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = wakeFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+    wakePending = false;
+    CstdThread::init(true);
+    return true;
+#endif
+}
+
+bool HyperCubeClientCore::EventLoopActivity::deinit(void)
+{
+#ifndef _WIN64
+    if (isStarted()) {
+        setShouldExit();
+        wakePending = false;
+        wake();
+    }
+    CstdThread::deinit(true);
+    if (wakeFd >= 0) close(wakeFd);
+    if (epollFd >= 0) close(epollFd);
+    wakeFd = -1;
+    epollFd = -1;
+    registeredSocket = -1;
+#endif
+    return true;
+}
+
+/// called by any thread that queued packets for sending. Wakes are coalesced until the loop runs
+void HyperCubeClientCore::EventLoopActivity::wake(void)
+{
+#ifndef _WIN64
+    if (wakePending.exchange(true)) return;
+    uint64_t count = 1;
+    if (write(wakeFd, &count, sizeof(count)) < 0) {
+        LOG_WARNING("HyperCubeClientCore::EventLoopActivity::wake()", "eventfd write failed", errno);
+    }
+#endif
+}
+
+bool HyperCubeClientCore::EventLoopActivity::registerSocket(void)
+{
+#ifndef _WIN64
+    registeredSocket = rhyperCubeClientCore.tcpGetSocket();
+    rhyperCubeClientCore.tcpSetNonBlocking(true);
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = registeredSocket;
+    writeArmed = false;
+    readArmed = true;
+    socketParked = false;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, registeredSocket, &event) < 0) {
+        LOG_WARNING("HyperCubeClientCore::EventLoopActivity::registerSocket()", "epoll_ctl failed", errno);
+        registeredSocket = -1;
+        return false;
+    }
+#endif
+    return true;
+}
+
+void HyperCubeClientCore::EventLoopActivity::unregisterSocket(void)
+{
+#ifndef _WIN64
+    // the socket may already be closed, which removes it from the epoll set anyway
+    if ((registeredSocket >= 0) && !socketParked) epoll_ctl(epollFd, EPOLL_CTL_DEL, registeredSocket, NULL);
+    registeredSocket = -1;
+    writeArmed = false;
+    readArmed = true;
+    socketParked = false;
+#endif
+}
+
+/// set the socket's events from readArmed and writeArmed, putting a parked socket back in the set
+bool HyperCubeClientCore::EventLoopActivity::updateEvents(void)
+{
+#ifndef _WIN64
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = (readArmed ? (EPOLLIN | EPOLLRDHUP) : 0) | (writeArmed ? EPOLLOUT : 0);
+    event.data.fd = registeredSocket;
+    if (epoll_ctl(epollFd, socketParked ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, registeredSocket, &event) < 0) return false;
+    socketParked = false;
+#endif
+    return true;
+}
+
+/// ask for EPOLLOUT only while SendActivity has data the socket would not take
+bool HyperCubeClientCore::EventLoopActivity::armWrite(bool arm)
+{
+    if ((registeredSocket < 0) || (arm == writeArmed)) return true;
+    writeArmed = arm;
+    // a parked socket gets its events back when reading resumes
+    return socketParked || updateEvents();
+}
+
+/// ask for EPOLLIN only while RecvActivity is not holding a packet for a full inPacketQ
+bool HyperCubeClientCore::EventLoopActivity::armRead(bool arm)
+{
+    if ((registeredSocket < 0) || (arm == readArmed)) return true;
+    readArmed = arm;
+    return updateEvents();
+}
+
+/// EPOLLHUP and EPOLLERR are reported even without EPOLLIN. While reading is paused they would
+/// wake the loop over and over, so the socket leaves the epoll set until armRead(true)
+void HyperCubeClientCore::EventLoopActivity::parkSocket(void)
+{
+#ifndef _WIN64
+    if ((registeredSocket < 0) || socketParked) return;
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, registeredSocket, NULL);
+    socketParked = true;
+#endif
+}
+
+bool HyperCubeClientCore::EventLoopActivity::threadFunction(void)
+{
+#ifndef _WIN64
+    LOG_INFO("HyperCubeClientCore::EventLoopActivity::threadFunction()", "ThreadStarted", 0);
+    loopThreadId = std::this_thread::get_id();
+    struct epoll_event events[HYPERCUBE_EVENTLOOP_MAXEVENTS];
+    SignallingObject& rsignallingObject = rhyperCubeClientCore.signallingObject;
+    RecvActivity& rreceiveActivity = rhyperCubeClientCore.receiveActivity;
+
+    while (!checkIfShouldExit()) {
+        int timeoutMs = -1;
+        if (!rhyperCubeClientCore.tcpSocketValid()) {
+            // just lost the connection, onDisconnect() has told the reconnect scheduler
+            if (registeredSocket >= 0) unregisterSocket();
+            if (rsignallingObject.msUntilNextConnectAttempt() == 0) {
+                if (rsignallingObject.tryConnect()) registerSocket();
+            }
+            if (registeredSocket < 0) timeoutMs = rsignallingObject.msUntilNextConnectAttempt();
+        }
+        int expireMs = rsignallingObject.expireRequests();
+        if ((expireMs >= 0) && ((timeoutMs < 0) || (expireMs < timeoutMs))) timeoutMs = expireMs;
+
+        int numEvents = epoll_wait(epollFd, events, HYPERCUBE_EVENTLOOP_MAXEVENTS, timeoutMs);
+        if (numEvents < 0) {
+            if (errno != EINTR) LOG_WARNING("HyperCubeClientCore::EventLoopActivity::threadFunction()", "epoll_wait failed", errno);
+            continue;
+        }
+
+        bool sendPending = false;
+        for (int i = 0; i < numEvents; i++) {
+            if (events[i].data.fd == wakeFd) {
+                uint64_t count = 0;
+                if (read(wakeFd, &count, sizeof(count)) < 0) {}
+                wakePending = false;
+                sendPending = true;
+                continue;
+            }
+            if (events[i].data.fd != registeredSocket) continue;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                if (rreceiveActivity.isInputHeld()) {
+                    // only EPOLLHUP or EPOLLERR get here while reading is paused, they can wait
+                    parkSocket();
+                    continue;
+                }
+                if (!rreceiveActivity.onReadable()) continue;
+            }
+            if (events[i].events & EPOLLOUT) sendPending = true;
+        }
+
+        // a full inPacketQ pauses reading instead of blocking the loop. onPacketsPopped() wakes
+        // the loop when the consumer makes room, then the held packet goes in and reading resumes
+        if (rreceiveActivity.isInputHeld() && rreceiveActivity.resumeHeld() && (registeredSocket >= 0) && rhyperCubeClientCore.tcpSocketValid()) {
+            rreceiveActivity.onReadable();
+        }
+        armRead(!rreceiveActivity.isInputHeld());
+
+        if (sendPending && (registeredSocket >= 0) && rhyperCubeClientCore.tcpSocketValid()) {
+            bool allSent = rhyperCubeClientCore.sendActivity.onWritable();
+            armWrite(!allSent);
+        }
+    }
+    unregisterSocket();
+#endif
+    exiting();
+    return true;
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -591,7 +2035,10 @@ HyperCubeClientCore::HyperCubeClientCore() :
     IHyperCubeClientCore{ client },
     signallingObject{ this },
     receiveActivity{ this, signallingObject },
-    sendActivity{ this }
+    sendActivity{ this },
+    eventLoopActivity{ *this },
+    latencyDumpActivity{ *this },
+    metricsExportActivity{ *this }
 {
 };
 
@@ -599,23 +2046,169 @@ HyperCubeClientCore::~HyperCubeClientCore() {
 
 };
 
-bool HyperCubeClientCore::init(std::string _serverIpAddress, bool reInit)
+bool HyperCubeClientCore::init(std::string _serverIpAddress, bool reInit, HYPERCUBE_THREADINGMODE _threadingMode)
 {
-    receiveActivity.init();
-    sendActivity.init();
-    signallingObject.init(_serverIpAddress);
+#ifdef _WIN64
+    if (_threadingMode == HYPERCUBE_THREADINGMODE::EVENTLOOP) {
+        LOG_WARNING("HyperCubeClientCore::init()", "event loop mode needs epoll, using threads", 0);
+        _threadingMode = HYPERCUBE_THREADINGMODE::THREADED;
+    }
+#endif
+    threadingMode = _threadingMode;
+    if (threadingMode == HYPERCUBE_THREADINGMODE::EVENTLOOP) {
+        receiveActivity.init(false, &eventLoopActivity);
+        sendActivity.init(false, &eventLoopActivity);
+        signallingObject.init(_serverIpAddress, false);
+        eventLoopActivity.init();
+    }
+    else {
+        receiveActivity.init();
+        sendActivity.init();
+        signallingObject.init(_serverIpAddress);
+    }
     return true;
 }
 
 bool HyperCubeClientCore::deinit(void)
 {
+    latencyDumpActivity.deinit();
+    metricsExportActivity.deinit();
     signallingObject.deinit();
+    eventLoopActivity.deinit();
     client.close();
     receiveActivity.deinit();
     sendActivity.deinit();
+    AsyncLog::instance().flush();
     return true;
 };
 
+void HyperCubeClientCore::resetLatencies(void)
+{
+    for (auto& rrecorder : latencies.recorders) rrecorder.reset();
+}
+
+void HyperCubeClientCore::setLatencyDumpInterval(int intervalMs)
+{
+    latencyDumpActivity.deinit();
+    if (intervalMs > 0) latencyDumpActivity.init(intervalMs);
+}
+
+void HyperCubeClientCore::updateMetricGauges(void)
+{
+    HyperCubeSendStats sendStats = sendActivity.getSendStats();
+    metrics.set(HYPERCUBE_METRIC::QUEUEDPACKETS, (int64_t)sendStats.queuedPackets);
+    metrics.set(HYPERCUBE_METRIC::QUEUEDBYTES, (int64_t)sendStats.queuedBytes);
+    metrics.set(HYPERCUBE_METRIC::OUTSTANDINGREQUESTS, (int64_t)getRequestStats().outstanding);
+    metrics.set(HYPERCUBE_METRIC::CONNECTED, isConnected() ? 1 : 0);
+}
+
+int64_t HyperCubeClientCore::getMetric(HYPERCUBE_METRIC metric)
+{
+    if (metric >= HYPERCUBE_METRIC::QUEUEDPACKETS) updateMetricGauges();
+    return metrics.registry.get((int)metric);
+}
+
+std::string HyperCubeClientCore::metricsReport(void)
+{
+    updateMetricGauges();
+    return metrics.registry.prometheusText();
+}
+
+void HyperCubeClientCore::setMetricsExport(std::string path, int intervalMs)
+{
+    metricsExportActivity.deinit();
+    if ((intervalMs > 0) && !path.empty()) metricsExportActivity.init(path, intervalMs);
+}
+
+std::string HyperCubeClientCore::latencyReport(void)
+{
+    static const char* names[] = { "sendDwell", "socketWrite", "recvDelivery", "signallingRtt", "reconnect", "setup", "openForData" };
+    std::string report;
+    for (int i = 0; i < (int)HYPERCUBE_LATENCY::NUMLATENCIES; i++) {
+        report += std::string(names[i]) + " " + getLatency((HYPERCUBE_LATENCY)i).to_string() + "\n";
+    }
+    return report;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+HyperCubeClientCore::LatencyDumpActivity::LatencyDumpActivity(HyperCubeClientCore& _rhyperCubeClientCore) :
+    CstdThread(this),
+    rhyperCubeClientCore{ _rhyperCubeClientCore }
+{
+}
+
+bool HyperCubeClientCore::LatencyDumpActivity::init(int _intervalMs)
+{
+    intervalMs = _intervalMs;
+    eventStop.reset();
+    CstdThread::init(true);
+    return true;
+}
+
+bool HyperCubeClientCore::LatencyDumpActivity::deinit(void)
+{
+    if (intervalMs == 0) return true;
+    CstdThread::setShouldExit();
+    eventStop.notify();
+    CstdThread::deinit(true);
+    intervalMs = 0;
+    return true;
+}
+
+bool HyperCubeClientCore::LatencyDumpActivity::threadFunction(void)
+{
+    while (!checkIfShouldExit()) {
+        eventStop.waitUntil(intervalMs);
+        if (checkIfShouldExit()) break;
+        LOG_INFO("HyperCubeClientCore::LatencyDumpActivity::threadFunction()", rhyperCubeClientCore.latencyReport(), 0);
+    }
+    exiting();
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+HyperCubeClientCore::MetricsExportActivity::MetricsExportActivity(HyperCubeClientCore& _rhyperCubeClientCore) :
+    CstdThread(this),
+    rhyperCubeClientCore{ _rhyperCubeClientCore }
+{
+}
+
+bool HyperCubeClientCore::MetricsExportActivity::init(std::string _path, int _intervalMs)
+{
+    path = _path;
+    intervalMs = _intervalMs;
+    eventStop.reset();
+    CstdThread::init(true);
+    return true;
+}
+
+bool HyperCubeClientCore::MetricsExportActivity::deinit(void)
+{
+    if (intervalMs == 0) return true;
+    CstdThread::setShouldExit();
+    eventStop.notify();
+    CstdThread::deinit(true);
+    intervalMs = 0;
+    return true;
+}
+
+/// the only place the metrics are formatted. A failed write is logged once, not every interval
+bool HyperCubeClientCore::MetricsExportActivity::threadFunction(void)
+{
+    bool failing = false;
+    while (!checkIfShouldExit()) {
+        eventStop.waitUntil(intervalMs);
+        if (checkIfShouldExit()) break;
+        rhyperCubeClientCore.updateMetricGauges();
+        bool stat = rhyperCubeClientCore.metrics.registry.exportFile(path);
+        if (!stat && !failing) LOG_WARNING("HyperCubeClientCore::MetricsExportActivity::threadFunction()", "could not write " + path, 0);
+        failing = !stat;
+    }
+    exiting();
+    return true;
+}
 
 /*
 bool HyperCubeClientCore::sendOut(Packet::UniquePtr& ppacket)
@@ -640,6 +2233,7 @@ bool HyperCubeClientCore::onConnect(void)
 {
     std::string line = "connected on socket# " + std::to_string(client.getSocket());
     LOG_INFO("HyperCubeClientCore::onConnect()", line, 0);
+    if (numConnects++ > 0) metrics.count(HYPERCUBE_METRIC::RECONNECTS);
     signallingObject.onConnect();
     receiveActivity.onConnect();
     sendActivity.onConnect();
@@ -673,19 +2267,182 @@ bool HyperCubeClientCore::isSignallingMsg(std::unique_ptr<Packet>& rppacket)
     return signallingObject.isSignallingMsg(rppacket);
 }
 
+bool HyperCubeClientCore::dispatchIn(std::unique_ptr<Packet>& rppacket, int64_t recvNs)
+{
+    if (!dispatcher.hasRoutes()) return false;
+    int subSys = 0;
+    int command = 0;
+    if (!PacketClassifier::instance().classify(*rppacket, subSys, command)) return false;
+    MsgDispatcher::RouteHandler* proute = dispatcher.findRoute(subSys, command);
+    if (!proute) return false;
+    latencies.recordSince(HYPERCUBE_LATENCY::RECVDELIVERY, recvNs);
+    dispatcher.dispatch(*proute, rppacket);
+    return true;
+}
+
 bool HyperCubeClientCore::onReceivedData(void)
 {
-    LOG_STATEINT("HyperCubeClientCore-numInputMsgs", ++numInputMsgs);
+    metrics.count(HYPERCUBE_METRIC::MSGSIN);
+    return true;
+}
+
+
+/// MsgJson payloads over compressThreshold are compressed in place for msgToPacket() and
+/// put back afterwards, so the caller's message is unchanged and keeps its own type
+bool HyperCubeClientCore::msgToPacket(Msg& msg, Packet::UniquePtr& rppacket)
+{
+    MsgJson* pmsgJson = 0;
+    if (signallingObject.isCompressing()) pmsgJson = dynamic_cast<MsgJson*>(&msg);
+    if (!pmsgJson || (pmsgJson->jsonData.size() < (size_t)compressThreshold)) return mserdes.msgToPacket(msg, rppacket);
+
+    std::string compressed;
+    int64_t startNs = latencyNowNs();
+    LzCodec::compress(pmsgJson->jsonData, compressed);
+    compressNs += latencyNowNs() - startNs;
+    if (compressed.size() >= pmsgJson->jsonData.size()) {
+        numIncompressible++;
+        return mserdes.msgToPacket(msg, rppacket);
+    }
+    numCompressed++;
+    compressBytesIn += pmsgJson->jsonData.size();
+    compressBytesOut += compressed.size();
+    pmsgJson->jsonData.swap(compressed);
+    pmsgJson->command |= HYPERCUBE_MSGFLAG_COMPRESSED;
+    bool stat = mserdes.msgToPacket(msg, rppacket);
+    pmsgJson->command &= ~HYPERCUBE_MSGFLAG_COMPRESSED;
+    pmsgJson->jsonData.swap(compressed);
+    return stat;
+}
+
+/// Only looked at once compression has been negotiated, the server does not compress before.
+/// The packet is rebuilt as a plain MsgJson, which is how packets are decoded on this side
+bool HyperCubeClientCore::decompressIn(std::unique_ptr<Packet>& rppacket)
+{
+    if (!signallingObject.isCompressing()) return true;
+    int subSys = 0;
+    int command = 0;
+    if (!PacketClassifier::instance().classify(*rppacket, subSys, command) || !(command & HYPERCUBE_MSGFLAG_COMPRESSED)) return true;
+    MsgJson msgJson;
+    std::string data;
+    int64_t startNs = latencyNowNs();
+    // the length in the codec header comes from the peer, nothing bigger than a packet is allocated
+    if (!mserdes.packetToMsg(rppacket.get(), msgJson) || !LzCodec::decompress(msgJson.jsonData, data, COMMON_PACKETSIZE_MAX)) {
+        numDecompressDropped++;
+        ALOG_WARNING("HyperCubeClientCore::decompressIn()", "corrupt or oversized compressed packet dropped", rppacket->getLength());
+        return false;
+    }
+    msgJson.jsonData.swap(data);
+    msgJson.subSys = subSys;
+    msgJson.command = command & ~HYPERCUBE_MSGFLAG_COMPRESSED;
+    mserdes.msgToPacket(msgJson, rppacket);
+    decompressNs += latencyNowNs() - startNs;
+    numDecompressed++;
+    decompressedBytes += msgJson.jsonData.size();
     return true;
 }
 
+void HyperCubeClientCore::setReliableSession(bool enabled, const ReplayBufferLimits& limits)
+{
+    sendActivity.setReliableSession(enabled, limits);
+    signallingObject.setSessionOffered(enabled);
+}
+
+HyperCubeSessionStats HyperCubeClientCore::getSessionStats(void)
+{
+    HyperCubeSessionStats sessionStats = sendActivity.getSessionStats();
+    sessionStats.sessionId = signallingObject.getSessionId();
+    return sessionStats;
+}
+
+/// a handler that resolves rfuture
+static ReplyHandler futureReplyHandler(std::future<RequestReply>& rfuture)
+{
+    std::shared_ptr<std::promise<RequestReply>> ppromise = std::make_shared<std::promise<RequestReply>>();
+    rfuture = ppromise->get_future();
+    return [ppromise](const RequestReply& rreply) { ppromise->set_value(rreply); };
+}
+
+std::future<RequestReply> HyperCubeClientCore::remotePingAsync(std::string data, int timeoutMs)
+{
+    std::future<RequestReply> future;
+    signallingObject.remotePing(data, futureReplyHandler(future), timeoutMs);
+    return future;
+}
+
+std::future<RequestReply> HyperCubeClientCore::echoDataAsync(std::string data, int timeoutMs)
+{
+    std::future<RequestReply> future;
+    signallingObject.echoData(data, futureReplyHandler(future), timeoutMs);
+    return future;
+}
+
+std::future<RequestReply> HyperCubeClientCore::createGroupAsync(std::string groupName, int timeoutMs)
+{
+    std::future<RequestReply> future;
+    signallingObject.createGroup(groupName, futureReplyHandler(future), timeoutMs);
+    return future;
+}
+
+std::future<RequestReply> HyperCubeClientCore::subscribeAsync(std::string groupName, int timeoutMs)
+{
+    std::future<RequestReply> future;
+    signallingObject.subscribe(groupName, futureReplyHandler(future), timeoutMs);
+    return future;
+}
+
+void HyperCubeClientCore::setCompression(bool enabled, int thresholdBytes)
+{
+    signallingObject.setCompressionOffered(enabled);
+    compressThreshold = thresholdBytes;
+}
+
+HyperCubeCompressionStats HyperCubeClientCore::getCompressionStats(void)
+{
+    HyperCubeCompressionStats stats;
+    stats.numCompressed = numCompressed;
+    stats.numIncompressible = numIncompressible;
+    stats.bytesIn = compressBytesIn;
+    stats.bytesOut = compressBytesOut;
+    stats.compressNs = compressNs;
+    stats.numDecompressed = numDecompressed;
+    stats.numDecompressDropped = numDecompressDropped;
+    stats.decompressedBytes = decompressedBytes;
+    stats.decompressNs = decompressNs;
+    return stats;
+}
 
 bool HyperCubeClientCore::sendMsgOut(Msg& msg) {
+    return sendMsgOut(msg, HYPERCUBE_LANE::DATA);
+}
+
+bool HyperCubeClientCore::sendMsgOut(Msg& msg, HYPERCUBE_LANE lane) {
+    return sendMsgOut(msg, lane, nullptr);
+}
+
+bool HyperCubeClientCore::sendMsgOut(Msg& msg, HYPERCUBE_LANE lane, SentHandler onSent) {
+    // only the DATA lane is numbered, the server could not tell other lanes' data apart
+    if (sendActivity.isReliable()) lane = HYPERCUBE_LANE::DATA;
+    Packet::UniquePtr ppacket = 0;
+    ppacket = PacketPool::instance().acquire();
+    msgToPacket(msg, ppacket);
+    bool dropped = false;
+    bool stat = sendActivity.sendOut(ppacket, lane, onSent, &dropped);
+    // a rejected or dropped packet is counted in REJECTS or DROPS by sendOut()
+    if (stat && !dropped) metrics.count(HYPERCUBE_METRIC::MSGSOUT);
+    else PacketPool::instance().recycle(ppacket);
+    return stat;
+}
+
+/// signalling commands skip the send queue limits, the connection cannot run without them
+bool HyperCubeClientCore::sendSigMsgOut(Msg& msg, HYPERCUBE_LANE lane) {
     Packet::UniquePtr ppacket = 0;
-    ppacket = Packet::create();
-    mserdes.msgToPacket(msg, ppacket);
-    bool stat = sendActivity.sendOut(ppacket);
-    LOG_STATEINT("HyperCubeClientCore-numOutputMsgs", ++numOutputMsgs);
+    ppacket = PacketPool::instance().acquire();
+    msgToPacket(msg, ppacket);
+    bool stat = sendActivity.sendOut(ppacket, lane);
+    if (!stat) {
+        PacketPool::instance().recycle(ppacket);
+        ALOG_WARNING("HyperCubeClientCore::sendSigMsgOut()", "outPacketQ full, command not sent", HYPERCUBE_OUTPACKETQ_SIZE);
+    }
     return stat;
 }
 
@@ -711,7 +2468,42 @@ bool HyperCubeClientCore::getPacket(Packet& packet)
 {
     Packet::UniquePtr ppacket = 0;
     bool stat = receiveActivity.receiveIn(ppacket);
-    if (stat) packet = std::move(*ppacket);
+    if (stat) {
+        packet = std::move(*ppacket);
+        PacketPool::instance().recycle(ppacket);
+    }
+    return stat;
+}
+
+int HyperCubeClientCore::getPackets(Packet::UniquePtr* ppackets, int maxPackets)
+{
+    return receiveActivity.receiveIn(ppackets, maxPackets);
+}
+
+int HyperCubeClientCore::getPackets(Packet* packets, int maxPackets)
+{
+    const int CHUNKSIZE = 64;
+    Packet::UniquePtr ppackets[CHUNKSIZE];
+    int numPackets = 0;
+    while (numPackets < maxPackets) {
+        int numInChunk = receiveActivity.receiveIn(ppackets, std::min(CHUNKSIZE, maxPackets - numPackets));
+        for (int i = 0; i < numInChunk; i++) {
+            packets[numPackets++] = std::move(*ppackets[i]);
+            PacketPool::instance().recycle(ppackets[i]);
+        }
+        if (numInChunk < CHUNKSIZE) break;
+    }
+    return numPackets;
+}
+
+bool HyperCubeClientCore::waitForPacket(Packet& packet, int timeoutMs)
+{
+    Packet::UniquePtr ppacket = 0;
+    bool stat = receiveActivity.waitReceiveIn(ppacket, timeoutMs);
+    if (stat) {
+        packet = std::move(*ppacket);
+        PacketPool::instance().recycle(ppacket);
+    }
     return stat;
 }
 
@@ -1,20 +1,207 @@
+#pragma once
+
 #include <stdio.h>
 #include <queue>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <map>
+#include <unordered_map>
+#include <future>
 
 #include "tcp.h"
 #include "sthread.h"
 #include "Messages.h"
 #include "mserdes.h"
 #include "Packet.h"
-
-#define HYPERCUBE_CONNECTIONINTERVAL_MS 8000			// connection attempt interval in milliseconds
+#include "packetQ.h"
+#include "packetPool.h"
+#include "latencyHistogram.h"
+#include "reconnectScheduler.h"
+#include "lzCodec.h"
+#include "replayBuffer.h"
+#include "requestTracker.h"
+#include "metricsRegistry.h"
+#include "msgDispatcher.h"
+
+#define HYPERCUBE_CONNECTIONINTERVAL_MS 8000			// connection check interval in milliseconds, see ReconnectPolicy for retries
+#define HYPERCUBE_SENDBATCH_MAXPACKETS 64           // max packets coalesced into one vectored send
+#define HYPERCUBE_SENDBATCH_MAXBYTES (256*1024)     // stop adding packets to a batch past this many bytes
+#define HYPERCUBE_RECVBUFFER_SIZE (256*1024)        // bytes asked for by each recv()
+#define HYPERCUBE_RECVQFULL_WAITMS 100              // longest wait for room in a full inPacketQ before checking for exit
+#define HYPERCUBE_EVENTLOOP_MAXEVENTS 16            // epoll events handled per wakeup
+#define HYPERCUBE_SENDSTALL_POLLMS 100              // longest poll() for writability before checking for exit
+#define HYPERCUBE_SENDQUEUE_MAXBYTES (16*1024*1024) // default cap on bytes waiting in outPacketQs
+#define HYPERCUBE_COMPRESS_THRESHOLD 1024           // MsgJson payloads this long or longer are compressed, once negotiated
+#define HYPERCUBE_MSGFLAG_COMPRESSED 0x8000         // set in Msg::command when the payload is LzCodec compressed
+#define HYPERCUBE_SESSION_ACKEVERY 64               // a reliable session asks the server to ack every this many DATA packets
 
 #ifdef _WIN64
 #define uint128_t   UUID
+typedef WSABUF IoVec;
+inline void setIoVec(IoVec& riov, const void* pdata, const int dataLen) { riov.buf = (CHAR*)pdata; riov.len = (ULONG)dataLen; }
 #else
 #define uint128_t   __int128
+#include <sys/uio.h>
+typedef struct iovec IoVec;
+inline void setIoVec(IoVec& riov, const void* pdata, const int dataLen) { riov.iov_base = (void*)pdata; riov.iov_len = (size_t)dataLen; }
 #endif
 
+enum class HYPERCUBE_THREADINGMODE {
+    THREADED,       // receive, send and signalling threads per client
+    EVENTLOOP,      // one epoll thread drives a non-blocking socket (linux only)
+};
+
+enum class HYPERCUBE_BACKPRESSURE {
+    BLOCK,          // sendMsgOut() waits for room, up to blockTimeoutMs
+    FAILFAST,       // sendMsgOut() returns false, the caller keeps its message
+    DROPOLDEST,     // the oldest queued packet is discarded to make room
+    DROPNEWEST,     // the new packet is discarded and sendMsgOut() returns true
+};
+
+/// Send lanes, highest priority first. Each has its own queue in SendActivity
+enum class HYPERCUBE_LANE {
+    URGENT,         // remote pings and command acks. Always sent first, and put ahead of queued data not yet started
+    SIGNALLING,     // other signalling commands
+    DATA,           // sendMsgOut()
+    NUMLANES,
+};
+
+enum class HYPERCUBE_LANESCHEDULE {
+    STRICT,         // SIGNALLING always before DATA
+    WEIGHTED,       // SIGNALLING and DATA take turns, up to weights[lane] packets each
+};
+
+/// how SendActivity picks the next lane to send from. URGENT is strict in both
+struct HyperCubeLaneSchedule {
+    HYPERCUBE_LANESCHEDULE schedule = HYPERCUBE_LANESCHEDULE::STRICT;
+    int weights[(int)HYPERCUBE_LANE::NUMLANES] = { 1, 4, 1 };
+};
+
+/// Limits on outPacketQs. Signalling commands are counted but never blocked or dropped.
+/// The watermarks are in bytes, see HyperCubeClientCore::onSendQueueHigh()/onSendQueueLow()
+struct HyperCubeSendQueueLimits {
+    int maxPackets = HYPERCUBE_OUTPACKETQ_SIZE;
+    int64_t maxBytes = HYPERCUBE_SENDQUEUE_MAXBYTES;
+    HYPERCUBE_BACKPRESSURE policy = HYPERCUBE_BACKPRESSURE::FAILFAST;
+    int blockTimeoutMs = 1000;          // BLOCK only, 0 waits until there is room
+    int64_t highWatermarkBytes = HYPERCUBE_SENDQUEUE_MAXBYTES / 4 * 3;
+    int64_t lowWatermarkBytes = HYPERCUBE_SENDQUEUE_MAXBYTES / 4;
+};
+
+struct HyperCubeRecvStats {
+    uint64_t numPacketsReceived = 0;
+    uint64_t numBytesReceived = 0;
+    uint64_t numRecvCalls = 0;      // recv() syscalls
+    double recvCallsPerPacket(void) const { return numPacketsReceived ? (double)numRecvCalls / (double)numPacketsReceived : 0; }
+};
+
+struct HyperCubeSendStats {
+    uint64_t numPacketsSent = 0;
+    uint64_t numBytesSent = 0;
+    uint64_t numSendCalls = 0;      // send()/sendmsg() syscalls
+    uint64_t queuedPackets = 0;     // waiting in outPacketQs right now
+    uint64_t queuedBytes = 0;
+    uint64_t numDropped = 0;        // discarded by DROPOLDEST/DROPNEWEST
+    uint64_t numRejected = 0;       // refused by FAILFAST, or BLOCK timing out
+    uint64_t numBlocked = 0;        // sendMsgOut() calls that had to wait for room
+    uint64_t numHighWatermarks = 0; // times the queue crossed highWatermarkBytes
+    uint64_t numWouldBlock = 0;     // sends that found the socket buffer full
+    uint64_t stallNs = 0;           // time spent waiting for the socket to take data again
+    double sendCallsPerPacket(void) const { return numPacketsSent ? (double)numSendCalls / (double)numPacketsSent : 0; }
+};
+
+/// Payload compression, see HyperCubeClientCore::setCompression()
+struct HyperCubeCompressionStats {
+    uint64_t numCompressed = 0;
+    uint64_t numIncompressible = 0;     // came out no smaller, sent as they were
+    uint64_t bytesIn = 0;               // payload bytes of the compressed messages, before
+    uint64_t bytesOut = 0;              // and after
+    uint64_t compressNs = 0;            // all the compress() calls, incompressible ones too
+    uint64_t numDecompressed = 0;
+    uint64_t numDecompressDropped = 0;  // corrupt, or would have come out bigger than a packet
+    uint64_t decompressedBytes = 0;
+    uint64_t decompressNs = 0;
+    double ratio(void) const { return bytesOut ? (double)bytesIn / (double)bytesOut : 0; }
+    double compressNsPerKB(void) const { return bytesIn ? (double)compressNs * 1024 / (double)bytesIn : 0; }
+    double decompressNsPerKB(void) const { return decompressedBytes ? (double)decompressNs * 1024 / (double)decompressedBytes : 0; }
+};
+
+/// Reliable session, see HyperCubeClientCore::setReliableSession()
+struct HyperCubeSessionStats {
+    uint64_t sessionId = 0;
+    bool open = false;              // the server resumed the session on this connection
+    uint64_t lastSeq = 0;           // DATA packets numbered so far
+    uint64_t ackedSeq = 0;          // the server has every packet up to here
+    uint64_t numResumes = 0;
+    uint64_t numRefused = 0;        // connections where the server did not take the session
+    uint64_t numFullStalls = 0;     // times DATA waited for acks to make room in the replay buffer
+    ReplayBufferStats replay;
+};
+
+/// Connection setup, see HyperCubeClientCore::setConnectionResume()
+struct HyperCubeSetupStats {
+    uint64_t numSetups = 0;
+    uint64_t numResumed = 0;        // the resume token restored the connection in one round trip
+    uint64_t numFallbacks = 0;      // the server did not know the token, the group was set up again
+    uint64_t numFailedAcks = 0;     // setup commands acked with a failed status
+    int pendingAcks = 0;            // setup commands of this connection not acked yet
+    int64_t lastSetupNs = 0;        // connected until the last setup ack
+    int64_t lastOpenForDataNs = 0;  // connected until open for data
+};
+
+struct HyperCubeLaneStats {
+    uint64_t queuedPackets = 0;
+    uint64_t queuedBytes = 0;
+    uint64_t numPacketsSent = 0;
+    LatencySnapshot dwell;          // queued until the last byte is handed to the socket
+};
+
+enum class HYPERCUBE_LATENCY {
+    SENDDWELL,      // sendMsgOut() until the packet's last byte is handed to the socket
+    SOCKETWRITE,    // each send()/sendmsg() call
+    RECVDELIVERY,   // recv() returning the bytes until the packet is delivered to the application
+    SIGNALLINGRTT,  // signalling command sent until its ack arrives
+    RECONNECT,      // connection lost until connected again
+    SETUP,          // tcp connected until every connection setup command is acked
+    OPENFORDATA,    // tcp connected until the server says the client is open for data
+    NUMLATENCIES,
+};
+
+/// The client's latency recorders. now() returns 0 when tracking is off, and 0 start
+/// times record nothing, so turning it off removes the clock reads as well
+struct HyperCubeLatencies {
+    std::atomic<bool> enabled = true;
+    LatencyRecorder recorders[(int)HYPERCUBE_LATENCY::NUMLATENCIES];
+    int64_t now(void) { return enabled ? latencyNowNs() : 0; }
+    void recordSince(HYPERCUBE_LATENCY latency, int64_t startNs) { recorders[(int)latency].recordSince(startNs); }
+};
+
+enum class HYPERCUBE_METRIC {
+    MSGSOUT,            // messages sendMsgOut() queued. Refused ones are in REJECTS, DROPNEWEST ones in DROPS
+    MSGSIN,             // data packets delivered or queued for the application
+    BYTESOUT,           // handed to the socket, framing included
+    BYTESIN,            // read from the socket
+    DROPS,              // discarded by DROPOLDEST/DROPNEWEST
+    REJECTS,            // refused by FAILFAST, or BLOCK timing out
+    RECONNECTS,         // connects after the first
+    QUEUEDPACKETS,      // gauges, taken when the metrics are read
+    QUEUEDBYTES,
+    OUTSTANDINGREQUESTS,
+    CONNECTED,
+    NUMMETRICS,
+};
+
+/// The client's counters and gauges, see HyperCubeClientCore::setMetricsExport()
+struct HyperCubeMetrics {
+    MetricsRegistry registry;
+    HyperCubeMetrics();
+    void count(HYPERCUBE_METRIC metric, uint64_t value = 1) { registry.add((int)metric, value); }
+    void set(HYPERCUBE_METRIC metric, int64_t value) { registry.set((int)metric, value); }
+};
+
 class IHyperCubeClientCore
 {
     Ctcp::Client& rtcpClient;
@@ -25,53 +212,126 @@ public:
 //    virtual bool tcpClose(void) { return rtcpClient.close(); }
     virtual bool tcpConnect(std::string addrString, int port) { return rtcpClient.connect(addrString, port); }
     virtual bool tcpSocketValid(void) { return rtcpClient.socketValid(); }
+    /// non-blocking connect, closed again straight away. True if addrString:port accepted within timeoutMs
+    bool tcpProbe(std::string addrString, int port, int timeoutMs);
     virtual int tcpGetSocket(void) { return (int)rtcpClient.getSocket(); }
     int tcpRecv(char* buf, const int bufSize) { return rtcpClient.recv(buf, bufSize); }
     int tcpSend(const char* buf, const int bufSize) { return rtcpClient.send(buf, bufSize); }
+    /// dontWait makes this one call non-blocking on a blocking socket (linux only)
+    int tcpSendv(const IoVec* piov, const int iovCount, bool dontWait = false);
+    bool tcpSetNonBlocking(bool nonBlocking);
 
     virtual bool sendMsgOut(Msg& msg) = 0;
+    virtual bool sendSigMsgOut(Msg& msg, HYPERCUBE_LANE lane) = 0;   // not subject to the send queue limits
     virtual bool onReceivedData(void) = 0;
     virtual bool onConnect(void) = 0;   // tcp connection established
     virtual bool onDisconnect(void) = 0;    // tcp connection closed
     virtual bool isSignallingMsg(std::unique_ptr<Packet>& rppacket) = 0;
+    /// hands a data packet to its MsgDispatcher route, if it has one. recvNs as for latencies
+    virtual bool dispatchIn(std::unique_ptr<Packet>& rppacket, int64_t recvNs) = 0;
+    virtual bool decompressIn(std::unique_ptr<Packet>& rppacket) = 0;  // false drops the packet
     virtual bool onOpenForData(void) = 0;  // open for data
     virtual bool onClosedForData(void) = 0; // closed for data
+    virtual void onSendQueueHigh(void) {}
+    virtual void onSendQueueLow(void) {}
+    // reliable session, see HyperCubeClientCore::setReliableSession()
+    virtual void onSessionOpened(bool resumed, uint64_t receivedSeq) = 0;
+    virtual void onSessionAck(uint64_t ackedSeq) = 0;
+    virtual bool requestSessionAck(void) = 0;
+    virtual void holdSends(bool hold) = 0;  // queue without waking the sender, to send several commands together
+
+    HyperCubeLatencies latencies;
+    HyperCubeMetrics metrics;
+    MsgDispatcher dispatcher;
 };
 
+class EchoWindow;
+
 class HyperCubeClientCore : IHyperCubeClientCore
 {
+    friend class EchoWindow;
+
+    public:
+        /// called on the receive thread for each data packet. Move rppacket out to keep it
+        typedef std::function<void(Packet::UniquePtr& rppacket)> PacketHandler;
+        /// called once for a packet given to sendMsgOut() with one. true when it has all been written
+        /// to the socket, false if it was dropped, rejected or cut short by a disconnect. Runs on the
+        /// thread that let go of the send lock after it was done, usually the send or event loop thread
+        typedef std::function<void(bool sent)> SentHandler;
+
     private:
 
         class SignallingObject;
-
-        class PacketQWithLock : std::deque<Packet::UniquePtr> {
-            std::mutex qLock;
-        public:
-            void init(void);
-            void deinit(void);
-            void push(std::unique_ptr<Packet>& rpacket);
-            bool pop(std::unique_ptr<Packet>& rpacket);
-            bool isEmpty(void);
-        };
+        class EventLoopActivity;
+
+        // inPacketQ has one producer (RecvActivity). Its consumer side is serialized by consumerLock,
+        // so getPacket() and friends can still be called from any number of threads.
+        // outPacketQs, one per HYPERCUBE_LANE, are fed by the application and by the signalling and receive threads.
+        // Define HYPERCUBE_PACKETQ_WITHLOCK to go back to the mutex protected deques.
+#ifdef HYPERCUBE_PACKETQ_WITHLOCK
+        typedef PacketQWithLock InPacketQ;
+        typedef PacketQWithLock OutPacketQ;
+#else
+        typedef PacketQSpsc InPacketQ;
+        typedef PacketQMpsc OutPacketQ;
+#endif
 
         class RecvActivity : CstdThread, RecvPacketBuilder::IReadDataObject {
         private:
             IHyperCubeClientCore* pIHyperCubeClientCore = 0;
             RecvPacketBuilder recvPacketBuilder;
             std::mutex recvPacketBuilderLock;
-            PacketQWithLock inPacketQ;
+            InPacketQ inPacketQ;
+            std::mutex consumerLock;        // the ring allows one consumer at a time
             std::unique_ptr<Packet> pinputPacket = 0;
+            EventLoopActivity* peventLoopActivity = 0;
+            std::atomic<bool> inputHeld = false;    // pinputPacket is waiting for room in inPacketQ
+            CstdConditional eventRoomInQ;           // threaded mode, set by onPacketsPopped() while inputHeld
             CstdConditional eventReadyToRead;
+            bool readWouldBlock = false;
+
+            // bulk receive buffer. One recv() per readPackets() pass fills it and
+            // recvPacketBuilder frames as many packets as it holds
+            std::vector<char> recvBuffer;
+            int recvBufferHead = 0;
+            int recvBufferTail = 0;
+            bool recvAllowed = false;
+            int64_t recvBufferNs = 0;       // when the bytes in recvBuffer came off the socket
+            std::atomic<uint64_t> numPacketsReceived = 0;
+            std::atomic<uint64_t> numBytesReceived = 0;
+            std::atomic<uint64_t> numRecvCalls = 0;
+
+            // consumer wakeups, see waitReceiveIn() and getPacketReadyFd()
+            PacketHandler packetHandler;
+            std::mutex packetWaitLock;
+            std::condition_variable packetWaitCondition;
+            std::atomic<int> numPacketWaiters = 0;
+            int packetReadyFd = -1;
+            std::atomic<bool> packetReadySignalled = false;
+            void onPacketQueued(void);
+            void onPacketsPopped(void);
+            bool pushHeld(void);
+            bool waitForRoom(void);
+            int popIn(Packet::UniquePtr* ppackets, int maxPackets);
             virtual bool threadFunction(void);
             RecvPacketBuilder::READSTATUS readPackets(void);
+            bool processReadStatus(RecvPacketBuilder::READSTATUS readStatus);
             int readData(void* pdata, int dataLen);
         public:
             RecvActivity(IHyperCubeClientCore* pIHyperCubeClientCore, SignallingObject& _signallingObject);
-            bool init(void);
+            bool init(bool startThread = true, EventLoopActivity* _peventLoopActivity = 0);
             bool deinit(void);
             bool receiveIn(Packet::UniquePtr& rppacket);
+            int receiveIn(Packet::UniquePtr* ppackets, int maxPackets);
+            bool waitReceiveIn(Packet::UniquePtr& rppacket, int timeoutMs);
+            int getPacketReadyFd(void);
+            void setPacketHandler(PacketHandler _packetHandler);
             bool onConnect(void);
             bool onDisconnect(void);
+            bool onReadable(void);
+            bool isInputHeld(void) { return inputHeld.load(); }
+            bool resumeHeld(void);
+            HyperCubeRecvStats getRecvStats(void);
         };
 
         class SendActivity : public CstdThread {
@@ -79,78 +339,308 @@ class HyperCubeClientCore : IHyperCubeClientCore
             IHyperCubeClientCore* pIHyperCubeClientCore = 0;
             WritePacketBuilder writePacketBuilder;
             std::mutex writePacketBuilderLock;
-            PacketQWithLock outPacketQ;
+            OutPacketQ outPacketQs[(int)HYPERCUBE_LANE::NUMLANES];
             virtual bool threadFunction(void);
             bool writePacket(void);
+            bool writeBatch(void);
             bool writePackets(void);
 
+            struct LanePacket {
+                Packet::UniquePtr ppacket = 0;
+                int64_t queuedNs = 0;
+                int lane = 0;
+                uint64_t seq = 0;           // reliable session DATA, kept in replayBuffer once sent
+            };
+            // packets popped from outPacketQs and not yet fully sent in batched mode.
+            // sendBatchOffset is how much of sendBatch.front() has already gone out.
+            // URGENT packets are kept together right after the one being sent
+            std::vector<LanePacket> sendBatch;
+            int sendBatchOffset = 0;
+            std::atomic<bool> batchedSends = true;
+            bool lastSendStalled = false;       // the last send took nothing
+            bool lastSendWouldBlock = false;    // because the socket buffer was full, rather than an error
+            int64_t stallStartNs = 0;           // event loop mode, waiting for EPOLLOUT since
+            std::atomic<uint64_t> numWouldBlock = 0;
+            std::atomic<uint64_t> stallNs = 0;
+            bool waitWritable(void);
+            EventLoopActivity* peventLoopActivity = 0;
+
             CstdConditional eventPacketsAvailableToSend;
+            std::atomic<int> numSendHolds = 0;
+            void wakeSender(void);
+            int64_t writePacketQueuedNs = 0;    // queue time of the packet in writePacketBuilder
+            int writePacketLane = 0;
+            uint64_t writePacketSeq = 0;
+            Packet::UniquePtr writePacketRetained = 0;  // the packet in writePacketBuilder, if numbered for replayBuffer or awaited by a SentHandler
             int totalBytesSent = 0;
+            std::atomic<uint64_t> numPacketsSent = 0;
+            std::atomic<uint64_t> numBytesSent = 0;
+            std::atomic<uint64_t> numSendCalls = 0;
+
+            // limits across the outPacketQs. Every pop happens under writePacketBuilderLock,
+            // which is what lets DROPOLDEST pop from a producer thread
+            HyperCubeSendQueueLimits sendQueueLimits;
+            std::atomic<int64_t> queuedPackets = 0;
+            std::atomic<int64_t> queuedBytes = 0;
+            std::atomic<bool> aboveHighWatermark = false;
+            std::atomic<uint64_t> numDropped = 0;
+            std::atomic<uint64_t> numRejected = 0;
+            std::atomic<uint64_t> numBlocked = 0;
+            std::atomic<uint64_t> numHighWatermarks = 0;
+            std::mutex queueSpaceLock;
+            std::condition_variable queueSpaceCondition;
+            std::atomic<int> numBlockedProducers = 0;
+
+            // lanes. Pops happen under writePacketBuilderLock, so laneCredits needs no lock of its own
+            HyperCubeLaneSchedule laneSchedule;
+            int laneCredits[(int)HYPERCUBE_LANE::NUMLANES] = {};
+            std::atomic<int64_t> laneQueuedPackets[(int)HYPERCUBE_LANE::NUMLANES] = {};
+            std::atomic<int64_t> laneQueuedBytes[(int)HYPERCUBE_LANE::NUMLANES] = {};
+            std::atomic<uint64_t> lanePacketsSent[(int)HYPERCUBE_LANE::NUMLANES] = {};
+            LatencyRecorder laneDwell[(int)HYPERCUBE_LANE::NUMLANES];
+            int nextLane(bool includeUrgent);
+            bool laneReady(int lane);
+            bool outPacketQsEmpty(void);
+            void onPacketSent(int lane, int64_t queuedNs);
+            bool spliceUrgent(void);
+
+            // reliable session. DATA is held from connect until the server answers the offer,
+            // then numbered as it is popped. lastSeq is only changed under writePacketBuilderLock
+            enum class SESSIONSTATE { OFF, RESUMING, OPEN };
+            std::atomic<bool> reliable = false;
+            std::atomic<SESSIONSTATE> sessionState = SESSIONSTATE::OFF;
+            std::atomic<uint64_t> lastSeq = 0;
+            std::atomic<bool> sessionAckRequested = false;     // replay buffer full, ack asked for
+            std::atomic<bool> sessionAckWanted = false;        // to be asked for once the send lock is let go
+            std::atomic<uint64_t> numResumes = 0;
+            std::atomic<uint64_t> numRefused = 0;
+            std::atomic<uint64_t> numFullStalls = 0;
+            ReplayBuffer replayBuffer;
+
+            // SentHandlers by packet. A packet's handler is moved to sentHandlersDue under the send
+            // lock and run by runSentHandlers() once that is let go, as a handler may send again
+            std::mutex sentHandlersLock;
+            std::unordered_map<const Packet*, SentHandler> sentHandlers;
+            std::vector<std::pair<SentHandler, bool>> sentHandlersDue;
+            std::atomic<int> numSentHandlers = 0;      // registered or due
+            std::atomic<std::thread::id> sendThreadId;
+            bool onSenderThread(void);
+            bool awaitingSent(const Packet* ppacket);
+            void onPacketDone(const Packet* ppacket, bool sent);
+            void runSentHandlers(void);
+            void failSentHandlers(void);
+            bool popOutSession(Packet::UniquePtr& rppacket, int64_t* pqueuedNs, uint64_t* pseq);
+            void retainUnsent(void);
+            void requestSessionAckIfWanted(void);
+
+            bool queueOut(Packet::UniquePtr& rppacket, int length, int64_t queuedNs, int lane, bool applyLimits);
+            bool popOut(Packet::UniquePtr& rppacket, int64_t* pqueuedNs = 0, int* plane = 0, bool includeUrgent = true, uint64_t* pseq = 0);
+            bool popOutLane(int lane, Packet::UniquePtr& rppacket, int64_t* pqueuedNs = 0);
+            bool dropOldest(void);
+            bool waitForQueueSpace(std::chrono::steady_clock::time_point deadline, bool waitForever);
+            void onDequeued(int64_t numPackets, int64_t numBytes);
+            void clearOutPacketQ(bool keepData = false);
+
             int sendDataOut(const void* pdata, const int dataLen);
+            int sendDataOutv(const IoVec* piov, const int iovCount);
+            void clearSendBatch(void);
 
         public:
             SendActivity(IHyperCubeClientCore* _pIHyperCubeClientCore);
             ~SendActivity();
-            bool init(void);
+            bool init(bool startThread = true, EventLoopActivity* _peventLoopActivity = 0);
             bool deinit(void);
-            bool sendOut(Packet::UniquePtr& rppacket);
+            /// true under DROPNEWEST too, *pdropped tells that the packet was thrown away
+            bool sendOut(Packet::UniquePtr& rppacket, HYPERCUBE_LANE lane = HYPERCUBE_LANE::DATA, SentHandler onSent = nullptr, bool* pdropped = 0);
             bool onConnect(void);
             bool onDisconnect(void);
+            bool onWritable(void);
+            void setBatchedSends(bool _batchedSends) { batchedSends = _batchedSends; }
+            void setSendQueueLimits(const HyperCubeSendQueueLimits& limits) { sendQueueLimits = limits; }
+            void setLaneSchedule(const HyperCubeLaneSchedule& schedule) { laneSchedule = schedule; }
+            HyperCubeSendStats getSendStats(void);
+            HyperCubeLaneStats getLaneStats(HYPERCUBE_LANE lane);
+            /// while held, sendOut() queues without waking the sender. The last release wakes it
+            void holdSends(bool hold);
+            void setReliableSession(bool enabled, const ReplayBufferLimits& limits);
+            bool isReliable(void) { return reliable; }
+            void onSessionOpened(bool resumed, uint64_t receivedSeq);
+            void onSessionAck(uint64_t ackedSeq);
+            HyperCubeSessionStats getSessionStats(void);
         };
 
         class SignallingObject : CstdThread {
             MSerDes mserdes;
             CstdConditional eventDisconnectedFromServer;
             std::atomic<bool> connected = false;
-            std::atomic<bool> justDisconnected = false;
             bool alreadyWarnedOfFailedConnectionAttempt = false;
             int numFailedConnectionAttempts = 0;
             int numSuccessfullConnectionAttempts = 0;
             ConnectionInfo connectionInfo;
+            std::atomic<bool> binarySigCodec = false;     // server accepted SIGCODEC_NAME for this connection
+            std::atomic<bool> compressionOffered = true;
+            std::atomic<bool> compression = false;        // server accepted LZCODEC_NAME for this connection
+            std::atomic<bool> sessionOffered = false;
+            std::atomic<uint64_t> sessionId = 0;
+            std::atomic<uint64_t> sessionAckedSeq = 0;     // offered with the id, for a server that lost the session
+            void newSession(void);
+            bool onSessionMsg(const json& session);
+
+            // connection setup, see setupConnection()
+            enum SETUPACK { SETUPACK_CONNECTIONINFO = 1, SETUPACK_CREATEGROUP = 2, SETUPACK_LOCALPING = 4 };
+            std::string groupName = "TeamPegasus";
+            std::atomic<int> setupAcksPending = 0;
+            std::atomic<int64_t> connectedNs = 0;
+            std::atomic<int64_t> openForDataPendingNs = 0;     // connected and not open for data yet
+            std::atomic<bool> resumeOffered = true;
+            std::atomic<bool> resumeTokenOffered = false;      // on this connection
+            std::mutex resumeTokenLock;
+            std::string resumeToken;                            // from the server's last CONNECTIONINFOACK
+            std::atomic<uint64_t> numSetups = 0;
+            std::atomic<uint64_t> numResumed = 0;
+            std::atomic<uint64_t> numFallbacks = 0;
+            std::atomic<uint64_t> numFailedSetupAcks = 0;
+            std::atomic<int64_t> lastSetupNs = 0;
+            std::atomic<int64_t> lastOpenForDataNs = 0;
+            void onSetupAck(int setupAck, bool status);
+            // every command that expects an ack, see sendRequest()
+            std::atomic<bool> correlationIds = false;     // server takes them in binary commands, for this connection
+            RequestTracker requestTracker;
+            static HYPERCUBECOMMANDS ackCommandFor(HYPERCUBECOMMANDS command);
+            static bool isAckCommand(HYPERCUBECOMMANDS command);
+            void onReply(HyperCubeCommand& hyperCubeCommand, uint32_t correlationId);
+            ReconnectScheduler reconnectScheduler;
 
             IHyperCubeClientCore* pIHyperCubeClientCore = 0;
             bool socketValid(void) { return pIHyperCubeClientCore->tcpSocketValid(); }
             bool connect(void);
             std::string serverIpAddress;
-            bool connectIfNotConnected(void);
             bool processSigMsgJson(const Packet* ppacket);
             bool threadFunction(void);
-            bool sendMsgOut(Msg& msg) {
-                return pIHyperCubeClientCore->sendMsgOut(msg);
-            }
-            bool sendCmdOut(HYPERCUBECOMMANDS command, CommonInfoBase& commonInfoBase, bool ack = false ) {
-                HyperCubeCommand hypeCubeCommand(command, commonInfoBase.to_json(), true);
-                hypeCubeCommand.ack = ack;
-                SigMsg signallingMsg(hypeCubeCommand.to_json().dump());
-                return sendMsgOut(signallingMsg);
+            bool sendMsgOut(Msg& msg, HYPERCUBE_LANE lane = HYPERCUBE_LANE::SIGNALLING) {
+                return pIHyperCubeClientCore->sendSigMsgOut(msg, lane);
             }
+            /// correlationId 0 sends none, acks echo the one the command came with
+            bool sendCmdOut(HYPERCUBECOMMANDS command, CommonInfoBase& commonInfoBase, bool ack = false, uint32_t correlationId = 0);
+            bool sendRequest(HYPERCUBECOMMANDS command, CommonInfoBase& commonInfoBase, ReplyHandler handler, int timeoutMs);
             bool sendConnectionInfo(std::string _connectionName);
-            bool createGroup(std::string _groupName);
             bool publish(void);
-            bool subscribe(std::string _groupName);
-            bool echoData(std::string data = "");
             bool localPing(bool ack = false, std::string data = "localPingFromMatrix");
-            bool remotePing(bool ack = false, std::string data = "remotePingFromMatrix");
             bool setupConnection(void);
 
-            bool onCreateGroupAck(HyperCubeCommand& hyperCubeCommand);
-            bool onConnectionInfoAck(HyperCubeCommand& hyperCubeCommand);
-            bool onRemotePing(HyperCubeCommand& hyperCubeCommand);
-            bool onEchoData(HyperCubeCommand& hyperCubeCommand);
+            /// a received command as its handler sees it
+            struct SigCommandIn {
+                HyperCubeCommand& rcommand;
+                const json& rjsonData;          // the whole command, empty if it came binary
+                uint32_t correlationId = 0;
+                const char* plogText = "";      // the start of a JSON command, for the log
+                size_t logTextLength = 0;
+            };
+            typedef bool (SignallingObject::*SigCommandHandler)(SigCommandIn& rin);
+            /// indexed by HYPERCUBECOMMANDS, filled in by SignallingObject()
+            SigCommandHandler sigCommandHandlers[MSGDISPATCHER_MAXCOMMANDS] = {};
+
+            bool onCreateGroupAck(SigCommandIn& rin);
+            bool onConnectionInfoAck(SigCommandIn& rin);
+            bool onRemotePing(SigCommandIn& rin);
+            bool onEchoData(SigCommandIn& rin);
+            bool onSubscribeAck(SigCommandIn& rin);
+            bool onUnsubscribeAck(SigCommandIn& rin);
+            bool onSubscriber(SigCommandIn& rin);
+            bool onUnsubscriber(SigCommandIn& rin);
+            bool onClosedForDataCommand(SigCommandIn& rin);
+            bool onLocalPing(SigCommandIn& rin);
 
         public:
             uint64_t connectionId;
             //uuid_t applicationInstanceUUID;
 
             SignallingObject(IHyperCubeClientCore* _pIHyperCubeClientCore);
-            void init(std::string _serverIpAddress);
+            void init(std::string _serverIpAddress, bool startThread = true);
             void deinit(void);
+            bool connectIfNotConnected(void);
+            bool tryConnect(void);
+            bool isConnected(void) { return connected; }
+            int msUntilNextConnectAttempt(void) { return reconnectScheduler.msUntilNextAttempt(); }
+            void setReconnectPolicy(const ReconnectPolicy& policy) { reconnectScheduler.setPolicy(policy); }
+            ReconnectStats getReconnectStats(void) { return reconnectScheduler.getStats(); }
+            /// the group connection setup creates, set before init()
+            void setGroupName(const std::string& _groupName) { groupName = _groupName; }
+            const std::string& getGroupName(void) { return groupName; }
+            bool remotePing(std::string data = "remotePingFromMatrix", ReplyHandler handler = nullptr, int timeoutMs = REQUEST_TIMEOUT_MS);
+            bool echoData(std::string data = "", ReplyHandler handler = nullptr, int timeoutMs = REQUEST_TIMEOUT_MS);
+            bool createGroup(std::string _groupName, ReplyHandler handler = nullptr, int timeoutMs = REQUEST_TIMEOUT_MS);
+            bool subscribe(std::string _groupName, ReplyHandler handler = nullptr, int timeoutMs = REQUEST_TIMEOUT_MS);
+            /// time out overdue requests. ms until the next one is due, -1 if none are outstanding
+            int expireRequests(void) { return requestTracker.expire(); }
+            RequestStats getRequestStats(void) { return requestTracker.getStats(); }
             virtual bool isSignallingMsg(std::unique_ptr<Packet>& rppacket);
             virtual bool onConnect(void);
             virtual bool onDisconnect(void);
             virtual bool onOpenForData(void);
             virtual bool onClosedForData(void);
             void setConnectionInfo(const ConnectionInfo& rconnectionInfo) { connectionInfo = rconnectionInfo; }
+            void setCompressionOffered(bool offered) { compressionOffered = offered; }
+            bool isCompressing(void) { return compression; }
+            void setSessionOffered(bool offered) { sessionOffered = offered; }
+            void setResumeOffered(bool offered) { resumeOffered = offered; }
+            HyperCubeSetupStats getSetupStats(void);
+            uint64_t getSessionId(void) { return sessionId; }
+            bool requestSessionAck(void);
+        };
+
+        /// Replaces the three threads above in HYPERCUBE_THREADINGMODE::EVENTLOOP.
+        /// One thread waits on epoll for socket readability/writability and for an eventfd
+        /// that sendOut() signals, and runs the reconnect timer itself.
+        class EventLoopActivity : CstdThread {
+            HyperCubeClientCore& rhyperCubeClientCore;
+            int epollFd = -1;
+            int wakeFd = -1;
+            int registeredSocket = -1;
+            bool writeArmed = false;
+            bool readArmed = true;
+            bool socketParked = false;      // taken out of the epoll set while reading is paused, see parkSocket()
+            std::atomic<bool> wakePending = false;
+            std::atomic<std::thread::id> loopThreadId;
+            virtual bool threadFunction(void);
+            bool registerSocket(void);
+            void unregisterSocket(void);
+            bool updateEvents(void);
+            bool armWrite(bool arm);
+            bool armRead(bool arm);
+            void parkSocket(void);
+        public:
+            EventLoopActivity(HyperCubeClientCore& _rhyperCubeClientCore);
+            ~EventLoopActivity();
+            bool init(void);
+            bool deinit(void);
+            void wake(void);
+            bool onLoopThread(void) { return loopThreadId.load() == std::this_thread::get_id(); }
+        };
+
+        /// logs latencyReport() every intervalMs, see setLatencyDumpInterval()
+        class LatencyDumpActivity : CstdThread {
+            HyperCubeClientCore& rhyperCubeClientCore;
+            CstdConditional eventStop;
+            std::atomic<int> intervalMs = 0;
+            virtual bool threadFunction(void);
+        public:
+            LatencyDumpActivity(HyperCubeClientCore& _rhyperCubeClientCore);
+            bool init(int _intervalMs);
+            bool deinit(void);
+        };
+
+        /// writes metricsReport() to a file every intervalMs, see setMetricsExport()
+        class MetricsExportActivity : CstdThread {
+            HyperCubeClientCore& rhyperCubeClientCore;
+            CstdConditional eventStop;
+            std::atomic<int> intervalMs = 0;
+            std::string path;
+            virtual bool threadFunction(void);
+        public:
+            MetricsExportActivity(HyperCubeClientCore& _rhyperCubeClientCore);
+            bool init(std::string _path, int _intervalMs);
+            bool deinit(void);
         };
 
         virtual bool onConnect(void);
@@ -158,12 +648,22 @@ class HyperCubeClientCore : IHyperCubeClientCore
         virtual bool onOpenForData(void);
         virtual bool onClosedForData(void);
         virtual bool isSignallingMsg(std::unique_ptr<Packet>& rppacket);
+        virtual bool dispatchIn(std::unique_ptr<Packet>& rppacket, int64_t recvNs);
+        virtual bool decompressIn(std::unique_ptr<Packet>& rppacket);
+        virtual void onSessionOpened(bool resumed, uint64_t receivedSeq) { sendActivity.onSessionOpened(resumed, receivedSeq); }
+        virtual void onSessionAck(uint64_t ackedSeq) { sendActivity.onSessionAck(ackedSeq); }
+        virtual bool requestSessionAck(void) { return signallingObject.requestSessionAck(); }
+        virtual void holdSends(bool hold) { sendActivity.holdSends(hold); }
 
 protected:
 
         SignallingObject signallingObject;
         RecvActivity receiveActivity;
         SendActivity sendActivity;
+        EventLoopActivity eventLoopActivity;
+        LatencyDumpActivity latencyDumpActivity;
+        MetricsExportActivity metricsExportActivity;
+        HYPERCUBE_THREADINGMODE threadingMode = HYPERCUBE_THREADINGMODE::THREADED;
 
         Ctcp::Client client;
 
@@ -171,27 +671,141 @@ protected:
 
         MSerDes mserdes;
 
+        std::atomic<int> compressThreshold = HYPERCUBE_COMPRESS_THRESHOLD;
+        std::atomic<uint64_t> numCompressed = 0;
+        std::atomic<uint64_t> numIncompressible = 0;
+        std::atomic<uint64_t> compressBytesIn = 0;
+        std::atomic<uint64_t> compressBytesOut = 0;
+        std::atomic<uint64_t> compressNs = 0;
+        std::atomic<uint64_t> numDecompressed = 0;
+        std::atomic<uint64_t> numDecompressDropped = 0;
+        std::atomic<uint64_t> decompressedBytes = 0;
+        std::atomic<uint64_t> decompressNs = 0;
+        bool msgToPacket(Msg& msg, Packet::UniquePtr& rppacket);
+
         double totalTime = 0;
         std::string dataString;
 
-        int numOutputMsgs = 0;
-        int numInputMsgs = 0;
+        std::atomic<uint64_t> numConnects = 0;
+        void updateMetricGauges(void);
 
 protected:
         bool sendMsgOut(Msg& msg);
+        /// data that must not wait behind bulk sends, HYPERCUBE_LANE::URGENT for instance
+        bool sendMsgOut(Msg& msg, HYPERCUBE_LANE lane);
+        /// onSent hears when the packet has gone out, see SentHandler. It is called with false
+        /// straight away if the packet could not be queued
+        bool sendMsgOut(Msg& msg, HYPERCUBE_LANE lane, SentHandler onSent);
+        bool sendSigMsgOut(Msg& msg, HYPERCUBE_LANE lane);
         virtual bool onReceivedData(void);
 public:
         HyperCubeClientCore();
         ~HyperCubeClientCore();
 
-        bool init(std::string _serverIpAddress, bool reInit = true);
+        bool init(std::string _serverIpAddress, bool reInit = true, HYPERCUBE_THREADINGMODE _threadingMode = HYPERCUBE_THREADINGMODE::THREADED);
         bool deinit(void);
+        bool isConnected(void) { return signallingObject.isConnected(); }
+        /// signalling round trip through the server, the ack is timed in HYPERCUBE_LATENCY::SIGNALLINGRTT
+        bool remotePing(std::string data = "remotePingFromMatrix") { return signallingObject.remotePing(data); }
+        /// Signalling requests, any number may be outstanding. Each carries a correlation id that
+        /// the ack echoes. The handler runs once, on the receive thread with the ack, or with acked
+        /// false once timeoutMs has passed or the connection went first. Keep it short
+        bool remotePing(std::string data, ReplyHandler handler, int timeoutMs = REQUEST_TIMEOUT_MS) { return signallingObject.remotePing(data, handler, timeoutMs); }
+        bool echoData(std::string data, ReplyHandler handler, int timeoutMs = REQUEST_TIMEOUT_MS) { return signallingObject.echoData(data, handler, timeoutMs); }
+        bool createGroup(std::string groupName, ReplyHandler handler, int timeoutMs = REQUEST_TIMEOUT_MS) { return signallingObject.createGroup(groupName, handler, timeoutMs); }
+        bool subscribe(std::string groupName, ReplyHandler handler, int timeoutMs = REQUEST_TIMEOUT_MS) { return signallingObject.subscribe(groupName, handler, timeoutMs); }
+        /// the same, resolved by the ack. A request that could not be queued is resolved at once
+        std::future<RequestReply> remotePingAsync(std::string data = "remotePingFromMatrix", int timeoutMs = REQUEST_TIMEOUT_MS);
+        std::future<RequestReply> echoDataAsync(std::string data = "", int timeoutMs = REQUEST_TIMEOUT_MS);
+        std::future<RequestReply> createGroupAsync(std::string groupName, int timeoutMs = REQUEST_TIMEOUT_MS);
+        std::future<RequestReply> subscribeAsync(std::string groupName, int timeoutMs = REQUEST_TIMEOUT_MS);
+        /// ack latency is HYPERCUBE_LATENCY::SIGNALLINGRTT
+        RequestStats getRequestStats(void) { return signallingObject.getRequestStats(); }
 
         virtual bool connectionClosed(void) { return true; };
 
+        /// getPacket(), getPackets() and waitForPacket() may be called from several threads,
+        /// the receive queue hands out each packet once
         bool getPacket(Packet& packet);
+        /// move up to maxPackets waiting packets into packets[], returns how many
+        int getPackets(Packet* packets, int maxPackets);
+        /// same, handing over the queued packets themselves. Give them back with
+        /// PacketPool::instance().recycle() when done so they are reused
+        int getPackets(Packet::UniquePtr* ppackets, int maxPackets);
+        /// like getPacket() but waits up to timeoutMs for a packet to arrive
+        bool waitForPacket(Packet& packet, int timeoutMs);
+        /// eventfd that becomes readable when packets are waiting, for the caller's own epoll set.
+        /// Read it, then call getPacket() until it returns false. -1 if not supported
+        int getPacketReadyFd(void) { return receiveActivity.getPacketReadyFd(); }
+        /// deliver data packets straight from the receive thread instead of queueing them
+        void setPacketHandler(PacketHandler packetHandler) { receiveActivity.setPacketHandler(packetHandler); }
+        /// Deliver the data packets of one (subSys, command) straight from the receive thread to
+        /// their own handler. Routed packets skip the packet handler and are not queued for
+        /// getPacket(). Register before init(), see MsgDispatcher
+        bool addRoute(int subSys, int command, MsgDispatcher::RouteHandler handler) { return dispatcher.addRoute(subSys, command, handler); }
+        /// the same, decoded into an MSG first: addMsgRoute<MsgCmd>(SUBSYS_CMD, CMD_JSON, [](MsgCmd& msgCmd) {})
+        template <class MSG>
+        bool addMsgRoute(int subSys, int command, std::function<void(MSG& msg)> handler) { return dispatcher.addMsgRoute<MSG>(subSys, command, handler); }
+        /// signalling commands from the server, once the client has handled them itself
+        bool addCommandHandler(HYPERCUBECOMMANDS command, MsgDispatcher::CommandHandler handler) { return dispatcher.addCommandHandler(command, handler); }
+        template <class INFO>
+        bool addCommandHandler(HYPERCUBECOMMANDS command, std::function<void(INFO& info, HyperCubeCommand& rcommand)> handler) { return dispatcher.addCommandHandler<INFO>(command, handler); }
 
         SOCKET getSocket(void) { return client.getSocket(); }
+        /// coalesce queued packets into one vectored send per wakeup (default), or send one packet per call
+        void setBatchedSends(bool batchedSends) { sendActivity.setBatchedSends(batchedSends); }
+        HyperCubeSendStats getSendStats(void) { return sendActivity.getSendStats(); }
+        /// cap and backpressure policy for outgoing packets. Set before init()
+        void setSendQueueLimits(const HyperCubeSendQueueLimits& limits) { sendActivity.setSendQueueLimits(limits); }
+        /// strict or weighted between the SIGNALLING and DATA lanes. Set before init()
+        void setLaneSchedule(const HyperCubeLaneSchedule& schedule) { sendActivity.setLaneSchedule(schedule); }
+        /// queue depth, packets sent and send dwell of one lane
+        HyperCubeLaneStats getLaneStats(HYPERCUBE_LANE lane) { return sendActivity.getLaneStats(lane); }
+        /// queued bytes rose past highWatermarkBytes. Called on the sending thread, once per crossing
+        virtual void onSendQueueHigh(void) {}
+        /// queued bytes fell back under lowWatermarkBytes. Called on the send or event loop thread
+        /// while it holds the send lock, so just flag the producers, do not send from here
+        virtual void onSendQueueLow(void) {}
+        HyperCubeRecvStats getRecvStats(void) { return receiveActivity.getRecvStats(); }
+        /// backoff between connection attempts and the connect timeout
+        void setReconnectPolicy(const ReconnectPolicy& policy) { signallingObject.setReconnectPolicy(policy); }
+        /// time to reconnect is also recorded in HYPERCUBE_LATENCY::RECONNECT
+        ReconnectStats getReconnectStats(void) { return signallingObject.getReconnectStats(); }
+        /// offer LzCodec payload compression at connection setup (on by default). Once the server
+        /// accepts, MsgJson payloads of thresholdBytes or more go out compressed. Set before init()
+        void setCompression(bool enabled, int thresholdBytes = HYPERCUBE_COMPRESS_THRESHOLD);
+        bool isCompressing(void) { return signallingObject.isCompressing(); }
+        HyperCubeCompressionStats getCompressionStats(void);
+        PacketPoolStats getPacketPoolStats(void) { return PacketPool::instance().getStats(); }
+        /// Offer a reliable session at connection setup (off by default). Once the server takes it,
+        /// DATA packets are kept in a replay buffer of at most limits until acked, and after a
+        /// reconnect the ones the server never got are sent again, in order, before anything new.
+        /// Every sendMsgOut() goes on the DATA lane so that it is numbered. Set before init()
+        void setReliableSession(bool enabled, const ReplayBufferLimits& limits = ReplayBufferLimits());
+        HyperCubeSessionStats getSessionStats(void);
+        /// Keep the resume token the server hands out (on by default). On reconnect CONNECTIONINFO
+        /// carries it and a server that still knows it restores the connection and its group in
+        /// one round trip, otherwise the group is set up again. Set before init()
+        void setConnectionResume(bool enabled) { signallingObject.setResumeOffered(enabled); }
+        /// connect to open for data is also recorded in HYPERCUBE_LATENCY::OPENFORDATA
+        HyperCubeSetupStats getSetupStats(void) { return signallingObject.getSetupStats(); }
+
+        /// percentiles merged over every thread that recorded this latency
+        LatencySnapshot getLatency(HYPERCUBE_LATENCY latency) { return latencies.recorders[(int)latency].snapshot(); }
+        void resetLatencies(void);
+        /// on by default. Costs two clock reads per packet on each side
+        void setLatencyTracking(bool enabled) { latencies.enabled = enabled; }
+        /// log latencyReport() every intervalMs, 0 stops
+        void setLatencyDumpInterval(int intervalMs);
+        std::string latencyReport(void);
+        /// Messages, bytes, drops and reconnects are counted per thread without locks or strings.
+        /// Queue depth and the other gauges are read when the metrics are
+        int64_t getMetric(HYPERCUBE_METRIC metric);
+        /// every metric in the Prometheus text format, to serve from the application's own endpoint
+        std::string metricsReport(void);
+        /// write metricsReport() to path every intervalMs for a node exporter textfile collector
+        /// or similar, 0 stops. The file is replaced whole each time
+        void setMetricsExport(std::string path, int intervalMs);
         void setConnectionInfo(const ConnectionInfo& rconnectionInfo) { signallingObject.setConnectionInfo(rconnectionInfo); }
 };
 
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <algorithm>
+
+#include "Logger.h"
+#include "hyperCubeClientPool.h"
+
+// ------------------------------------------------------------------------------------------------
+
+/// HyperCubeClient seeds connectionId from the time in seconds, which every shard created
+/// together would share, so the server could not tell the connections apart. Each shard also
+/// creates a group of its own, the server turns down a second createGroup of the same name
+HyperCubeClientPool::Shard::Shard(int shardIndex)
+{
+    signallingObject.connectionId += shardIndex;
+    if (shardIndex > 0) signallingObject.setGroupName(signallingObject.getGroupName() + "." + std::to_string(shardIndex));
+}
+
+// ------------------------------------------------------------------------------------------------
+
+HyperCubeClientPool::HyperCubeClientPool()
+{
+}
+
+HyperCubeClientPool::~HyperCubeClientPool()
+{
+    deinit();
+}
+
+bool HyperCubeClientPool::init(std::string serverIpAddress, int numShards, HYPERCUBE_THREADINGMODE threadingMode)
+{
+    deinit();
+    numShards = std::max(1, std::min(numShards, HYPERCUBE_POOL_MAXSHARDS));
+    for (int i = 0; i < numShards; i++) {
+        std::unique_ptr<Shard> pshard(new Shard(i));
+        pshard->setSendQueueLimits(sendQueueLimits);
+        pshard->setReconnectPolicy(reconnectPolicy);
+        pshard->init(serverIpAddress, true, threadingMode);
+        shards.push_back(std::move(pshard));
+    }
+    LOG_INFO("HyperCubeClientPool::init()", "shards", numShards);
+    return true;
+}
+
+bool HyperCubeClientPool::deinit(void)
+{
+    for (auto& rpshard : shards) rpshard->deinit();
+    shards.clear();
+    return true;
+}
+
+bool HyperCubeClientPool::isConnected(void)
+{
+    return !shards.empty() && (getNumConnected() == (int)shards.size());
+}
+
+int HyperCubeClientPool::getNumConnected(void)
+{
+    int numConnected = 0;
+    for (auto& rpshard : shards) {
+        if (rpshard->isConnected()) numConnected++;
+    }
+    return numConnected;
+}
+
+int HyperCubeClientPool::shardFor(const std::string& key)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char ch : key) {
+        hash ^= ch;
+        hash *= 1099511628211ULL;
+    }
+    return shardFor(hash);
+}
+
+bool HyperCubeClientPool::getPacket(Packet& packet)
+{
+    uint32_t numShards = (uint32_t)shards.size();
+    if (numShards == 0) return false;
+    // one step per call, whichever shard has the packet
+    uint32_t firstShard = nextRecvShard.fetch_add(1, std::memory_order_relaxed) % numShards;
+    for (uint32_t i = 0; i < numShards; i++) {
+        uint32_t shardIndex = (firstShard + i) % numShards;
+        if (shards[shardIndex]->getPacket(packet)) return true;
+    }
+    return false;
+}
+
+int HyperCubeClientPool::getPackets(Packet::UniquePtr* ppackets, int maxPackets)
+{
+    uint32_t numShards = (uint32_t)shards.size();
+    if (numShards == 0) return 0;
+    uint32_t firstShard = nextRecvShard.fetch_add(1, std::memory_order_relaxed) % numShards;
+    int numPackets = 0;
+    for (uint32_t i = 0; (i < numShards) && (numPackets < maxPackets); i++) {
+        uint32_t shardIndex = (firstShard + i) % numShards;
+        numPackets += shards[shardIndex]->getPackets(ppackets + numPackets, maxPackets - numPackets);
+    }
+    return numPackets;
+}
+
+HyperCubeSendStats HyperCubeClientPool::getSendStats(void)
+{
+    HyperCubeSendStats total;
+    for (auto& rpshard : shards) {
+        HyperCubeSendStats stats = rpshard->getSendStats();
+        total.numPacketsSent += stats.numPacketsSent;
+        total.numBytesSent += stats.numBytesSent;
+        total.numSendCalls += stats.numSendCalls;
+        total.queuedPackets += stats.queuedPackets;
+        total.queuedBytes += stats.queuedBytes;
+        total.numDropped += stats.numDropped;
+        total.numRejected += stats.numRejected;
+        total.numBlocked += stats.numBlocked;
+        total.numHighWatermarks += stats.numHighWatermarks;
+        total.numWouldBlock += stats.numWouldBlock;
+        total.stallNs += stats.stallNs;
+    }
+    return total;
+}
+
+HyperCubeRecvStats HyperCubeClientPool::getRecvStats(void)
+{
+    HyperCubeRecvStats total;
+    for (auto& rpshard : shards) {
+        HyperCubeRecvStats stats = rpshard->getRecvStats();
+        total.numPacketsReceived += stats.numPacketsReceived;
+        total.numBytesReceived += stats.numBytesReceived;
+        total.numRecvCalls += stats.numRecvCalls;
+    }
+    return total;
+}
+
+void HyperCubeClientPool::setReconnectPolicy(const ReconnectPolicy& policy)
+{
+    reconnectPolicy = policy;
+    for (auto& rpshard : shards) rpshard->setReconnectPolicy(policy);
+}
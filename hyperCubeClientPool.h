@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+#include "hyperCubeClient.h"
+
+#define HYPERCUBE_POOL_MAXSHARDS 64
+
+/// N HyperCubeClient connections to the same server, each with its own socket, queues and
+/// threads (or event loop). Messages are routed to a shard by key, so everything sent with
+/// one key, a group name for instance, goes down one connection and stays in order, while
+/// different keys spread over all of them. There is no ordering between shards.
+class HyperCubeClientPool {
+    class Shard : public HyperCubeClient {
+    public:
+        Shard(int shardIndex);
+        using HyperCubeClientCore::sendMsgOut;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<uint32_t> nextRecvShard = 0;      // unsigned, so it wraps to 0 instead of going negative
+    HyperCubeSendQueueLimits sendQueueLimits;
+    ReconnectPolicy reconnectPolicy;
+
+public:
+    HyperCubeClientPool();
+    ~HyperCubeClientPool();
+
+    /// open numShards connections. Limits and policies set here before init() apply to every shard
+    bool init(std::string serverIpAddress, int numShards, HYPERCUBE_THREADINGMODE threadingMode = HYPERCUBE_THREADINGMODE::THREADED);
+    bool deinit(void);
+    int getNumShards(void) { return (int)shards.size(); }
+    /// every shard is connected
+    bool isConnected(void);
+    int getNumConnected(void);
+
+    /// FNV-1a, so a key lands on the same shard in every process
+    int shardFor(const std::string& key);
+    int shardFor(uint64_t key) { return (int)(key % (uint64_t)shards.size()); }
+    bool sendMsgOut(const std::string& key, Msg& msg) { return shards[shardFor(key)]->sendMsgOut(msg); }
+    bool sendMsgOut(uint64_t key, Msg& msg) { return shards[shardFor(key)]->sendMsgOut(msg); }
+
+    /// takes from the shards in turn, so a busy one does not starve the others
+    bool getPacket(Packet& packet);
+    int getPackets(Packet::UniquePtr* ppackets, int maxPackets);
+    /// the shard's own client, for its stats or to receive from it alone
+    HyperCubeClientCore& getShard(int shardIndex) { return *shards[shardIndex]; }
+
+    HyperCubeSendStats getSendStats(void);
+    HyperCubeRecvStats getRecvStats(void);
+    /// per shard. Set before init()
+    void setSendQueueLimits(const HyperCubeSendQueueLimits& limits) { sendQueueLimits = limits; }
+    void setReconnectPolicy(const ReconnectPolicy& policy);
+};
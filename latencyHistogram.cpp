@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <algorithm>
+
+#include "latencyHistogram.h"
+
+// ------------------------------------------------------------------------------------------------
+
+std::string LatencySnapshot::to_string(void) const
+{
+    char line[256];
+    snprintf(line, sizeof(line), "n %llu min %.1f p50 %.1f p99 %.1f p99.9 %.1f max %.1f mean %.1f (us)",
+        (unsigned long long)count, minNs / 1000.0, p50Ns / 1000.0, p99Ns / 1000.0, p999Ns / 1000.0,
+        maxNs / 1000.0, meanNs / 1000.0);
+    return line;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+int LatencyHistogram::bucketIndex(uint64_t valueNs)
+{
+    if (valueNs < (uint64_t)(2 * SUBBUCKETS)) return (int)valueNs;
+    int msb = 63;
+    while (!(valueNs & (1ULL << msb))) msb--;
+    if (msb >= LATENCY_MAXVALUEBITS) return NUMBUCKETS - 1;
+    int shift = msb - LATENCY_SUBBUCKETBITS;
+    // valueNs >> shift is in [SUBBUCKETS, 2*SUBBUCKETS), so consecutive powers of 2 follow on
+    return shift * SUBBUCKETS + (int)(valueNs >> shift);
+}
+
+uint64_t LatencyHistogram::bucketValue(int index)
+{
+    if (index < 2 * SUBBUCKETS) return (uint64_t)index;
+    int shift = index / SUBBUCKETS - 1;
+    uint64_t mantissa = (uint64_t)(SUBBUCKETS + index % SUBBUCKETS);
+    return (mantissa << shift) + (1ULL << shift) - 1;
+}
+
+void LatencyHistogram::add(const LatencyHistogram& other)
+{
+    for (int i = 0; i < NUMBUCKETS; i++) {
+        uint64_t count = other.counts[i].load(std::memory_order_relaxed);
+        if (count) bump(counts[i], count);
+    }
+    bump(totalCount, other.totalCount.load(std::memory_order_relaxed));
+    bump(totalNs, other.totalNs.load(std::memory_order_relaxed));
+    minNs.store(std::min(minNs.load(std::memory_order_relaxed), other.minNs.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+    maxNs.store(std::max(maxNs.load(std::memory_order_relaxed), other.maxNs.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+}
+
+void LatencyHistogram::reset(void)
+{
+    for (auto& rcount : counts) rcount.store(0, std::memory_order_relaxed);
+    totalCount.store(0, std::memory_order_relaxed);
+    totalNs.store(0, std::memory_order_relaxed);
+    minNs.store(UINT64_MAX, std::memory_order_relaxed);
+    maxNs.store(0, std::memory_order_relaxed);
+}
+
+/// percentile in [0, 100]. Returns the top of the bucket holding that sample, capped at max
+uint64_t LatencyHistogram::valueAtPercentile(double percentile) const
+{
+    uint64_t count = getCount();
+    if (count == 0) return 0;
+    uint64_t target = (uint64_t)((percentile / 100.0) * count + 0.5);
+    target = std::max(target, (uint64_t)1);
+    uint64_t seen = 0;
+    for (int i = 0; i < NUMBUCKETS; i++) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= target) return std::min(bucketValue(i), maxNs.load(std::memory_order_relaxed));
+    }
+    return maxNs.load(std::memory_order_relaxed);
+}
+
+LatencySnapshot LatencyHistogram::snapshot(void) const
+{
+    LatencySnapshot latencySnapshot;
+    latencySnapshot.count = getCount();
+    if (latencySnapshot.count == 0) return latencySnapshot;
+    latencySnapshot.minNs = minNs.load(std::memory_order_relaxed);
+    latencySnapshot.maxNs = maxNs.load(std::memory_order_relaxed);
+    latencySnapshot.p50Ns = valueAtPercentile(50.0);
+    latencySnapshot.p99Ns = valueAtPercentile(99.0);
+    latencySnapshot.p999Ns = valueAtPercentile(99.9);
+    latencySnapshot.meanNs = (double)totalNs.load(std::memory_order_relaxed) / (double)latencySnapshot.count;
+    return latencySnapshot;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+std::atomic<uint64_t> LatencyRecorder::nextSerial{ 1 };
+
+LatencyRecorder::LatencyRecorder() :
+    serial{ nextSerial.fetch_add(1) }
+{
+}
+
+/// thread cache miss. Reuse this thread's histogram if it has one, so cache slot collisions
+/// between recorders cost a lock but never grow the list
+LatencyHistogram& LatencyRecorder::findThreadHistogram(void)
+{
+    std::lock_guard<std::mutex> lock(threadHistogramsLock);
+    std::thread::id threadId = std::this_thread::get_id();
+    for (auto& rthreadHistogram : threadHistograms) {
+        if (rthreadHistogram.threadId == threadId) return *rthreadHistogram.phistogram;
+    }
+    threadHistograms.push_back({ threadId, std::unique_ptr<LatencyHistogram>(new LatencyHistogram()) });
+    return *threadHistograms.back().phistogram;
+}
+
+LatencySnapshot LatencyRecorder::snapshot(void)
+{
+    std::unique_ptr<LatencyHistogram> pmerged(new LatencyHistogram());
+    std::lock_guard<std::mutex> lock(threadHistogramsLock);
+    for (auto& rthreadHistogram : threadHistograms) pmerged->add(*rthreadHistogram.phistogram);
+    return pmerged->snapshot();
+}
+
+void LatencyRecorder::reset(void)
+{
+    std::lock_guard<std::mutex> lock(threadHistogramsLock);
+    for (auto& rthreadHistogram : threadHistograms) rthreadHistogram.phistogram->reset();
+}
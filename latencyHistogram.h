@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+#define LATENCY_SUBBUCKETBITS 5         // 32 linear sub buckets per power of 2, about 3% resolution
+#define LATENCY_MAXVALUEBITS 40         // values up to 2^40 ns (~18 minutes), larger ones go in the top bucket
+#define LATENCY_THREADCACHE_SIZE 16     // recorders each thread can reach without taking a lock
+
+inline int64_t latencyNowNs(void)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct LatencySnapshot {
+    uint64_t count = 0;
+    uint64_t minNs = 0;
+    uint64_t p50Ns = 0;
+    uint64_t p99Ns = 0;
+    uint64_t p999Ns = 0;
+    uint64_t maxNs = 0;
+    double meanNs = 0;
+    std::string to_string(void) const;      // in microseconds
+};
+
+// ------------------------------------------------------------------------------------------------
+
+/// Log linear histogram of nanosecond values, the HdrHistogram layout with fixed precision.
+/// Values below 2^(LATENCY_SUBBUCKETBITS+1) have a bucket each, above that every power of 2
+/// is split into 2^LATENCY_SUBBUCKETBITS equal buckets.
+/// record() is for a single writer thread and uses no read-modify-write instructions.
+/// Other threads may read it through add() and snapshot() at any time.
+class LatencyHistogram {
+public:
+    static const int SUBBUCKETS = 1 << LATENCY_SUBBUCKETBITS;
+    static const int NUMBUCKETS = (LATENCY_MAXVALUEBITS - LATENCY_SUBBUCKETBITS + 1) * SUBBUCKETS;
+
+private:
+    std::atomic<uint64_t> counts[NUMBUCKETS];
+    std::atomic<uint64_t> totalCount{ 0 };
+    std::atomic<uint64_t> totalNs{ 0 };
+    std::atomic<uint64_t> minNs{ UINT64_MAX };
+    std::atomic<uint64_t> maxNs{ 0 };
+
+    static void bump(std::atomic<uint64_t>& rcounter, uint64_t value) {
+        rcounter.store(rcounter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+public:
+    LatencyHistogram() { reset(); }
+
+    static int bucketIndex(uint64_t valueNs);
+    static uint64_t bucketValue(int index);     // highest value that lands in the bucket
+
+    void record(int64_t valueNs) {
+        uint64_t value = (valueNs > 0) ? (uint64_t)valueNs : 0;
+        bump(counts[bucketIndex(value)], 1);
+        bump(totalCount, 1);
+        bump(totalNs, value);
+        if (value < minNs.load(std::memory_order_relaxed)) minNs.store(value, std::memory_order_relaxed);
+        if (value > maxNs.load(std::memory_order_relaxed)) maxNs.store(value, std::memory_order_relaxed);
+    }
+
+    /// merge other into this one. this must not be recorded into at the same time
+    void add(const LatencyHistogram& other);
+    void reset(void);
+    uint64_t getCount(void) const { return totalCount.load(std::memory_order_relaxed); }
+    uint64_t valueAtPercentile(double percentile) const;
+    LatencySnapshot snapshot(void) const;
+};
+
+// ------------------------------------------------------------------------------------------------
+
+/// One latency metric recorded from any number of threads. Each thread records into its
+/// own LatencyHistogram, found through a small thread_local cache, and snapshot() merges them.
+/// Histograms of threads that have exited are kept, so their samples still count.
+class LatencyRecorder {
+    struct ThreadHistogram {
+        std::thread::id threadId;
+        std::unique_ptr<LatencyHistogram> phistogram;
+    };
+    struct ThreadCacheEntry {
+        uint64_t serial = 0;
+        LatencyHistogram* phistogram = 0;
+    };
+
+    static std::atomic<uint64_t> nextSerial;
+    const uint64_t serial;      // never reused, so a stale thread cache entry can not match
+    std::mutex threadHistogramsLock;
+    std::vector<ThreadHistogram> threadHistograms;
+
+    LatencyHistogram& findThreadHistogram(void);
+
+public:
+    LatencyRecorder();
+
+    LatencyHistogram& threadHistogram(void) {
+        static thread_local ThreadCacheEntry cache[LATENCY_THREADCACHE_SIZE];
+        ThreadCacheEntry& rentry = cache[serial % LATENCY_THREADCACHE_SIZE];
+        if (rentry.serial != serial) {
+            rentry.phistogram = &findThreadHistogram();
+            rentry.serial = serial;
+        }
+        return *rentry.phistogram;
+    }
+
+    void record(int64_t valueNs) { threadHistogram().record(valueNs); }
+    /// startNs from latencyNowNs(), 0 means not timed and records nothing
+    void recordSince(int64_t startNs) { if (startNs != 0) record(latencyNowNs() - startNs); }
+    LatencySnapshot snapshot(void);
+    /// clear every thread's histogram. Samples recorded while this runs may survive
+    void reset(void);
+};
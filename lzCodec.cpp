@@ -0,0 +1,126 @@
+#include <string.h>
+#include <algorithm>
+
+#include "lzCodec.h"
+
+// ------------------------------------------------------------------------------------------------
+
+static inline uint32_t read32(const uint8_t* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline int hash32(uint32_t sequence)
+{
+    return (int)((sequence * 2654435761U) >> (32 - LZCODEC_HASHBITS));
+}
+
+static void putLength(std::string& rdst, int length)
+{
+    while (length >= 255) {
+        rdst.push_back((char)255);
+        length -= 255;
+    }
+    rdst.push_back((char)length);
+}
+
+static void putSequence(std::string& rdst, const uint8_t* pliterals, int numLiterals, int offset, int matchLen)
+{
+    int matchCode = matchLen - LzCodec::LZCODEC_MINMATCH;
+    uint8_t token = (uint8_t)((std::min(numLiterals, 15) << 4) | std::min(matchCode, 15));
+    rdst.push_back((char)token);
+    if (numLiterals >= 15) putLength(rdst, numLiterals - 15);
+    rdst.append((const char*)pliterals, numLiterals);
+    if (offset == 0) return;
+    rdst.push_back((char)(offset & 0xff));
+    rdst.push_back((char)(offset >> 8));
+    if (matchCode >= 15) putLength(rdst, matchCode - 15);
+}
+
+/// greedy, one candidate per hash bucket. Runs with no match step further and further ahead,
+/// so incompressible data goes through quickly
+void LzCodec::compress(const char* psrc, int srcLen, std::string& rdst)
+{
+    const uint8_t* src = (const uint8_t*)psrc;
+    rdst.clear();
+    rdst.reserve(LZCODEC_HEADERSIZE + srcLen + srcLen / 255 + 16);
+    for (int i = 0; i < LZCODEC_HEADERSIZE; i++) rdst.push_back((char)((uint32_t)srcLen >> (8 * i)));
+
+    int table[1 << LZCODEC_HASHBITS];
+    std::fill(table, table + (1 << LZCODEC_HASHBITS), -1);
+    const int matchLimit = srcLen - LZCODEC_LASTLITERALS;
+    const int lastMatchStart = srcLen - LZCODEC_MFLIMIT;
+    int anchor = 0;
+    int pos = 0;
+    int misses = 0;
+    while (pos < lastMatchStart) {
+        uint32_t sequence = read32(src + pos);
+        int h = hash32(sequence);
+        int candidate = table[h];
+        table[h] = pos;
+        if ((candidate < 0) || (pos - candidate > 0xffff) || (read32(src + candidate) != sequence)) {
+            pos += 1 + (misses++ >> 6);
+            continue;
+        }
+        misses = 0;
+        int matchLen = LZCODEC_MINMATCH;
+        while ((pos + matchLen < matchLimit) && (src[candidate + matchLen] == src[pos + matchLen])) matchLen++;
+        putSequence(rdst, src + anchor, pos - anchor, pos - candidate, matchLen);
+        pos += matchLen;
+        anchor = pos;
+    }
+    putSequence(rdst, src + anchor, srcLen - anchor, 0, LZCODEC_MINMATCH);
+}
+
+static bool getLength(const uint8_t*& rp, const uint8_t* pend, int& rlength)
+{
+    uint8_t byte;
+    do {
+        if (rp >= pend) return false;
+        byte = *rp++;
+        rlength += byte;
+        if (rlength > LZCODEC_MAXSIZE) return false;
+    } while (byte == 255);
+    return true;
+}
+
+bool LzCodec::decompress(const std::string& src, std::string& rdst, int maxLen)
+{
+    if (src.size() < (size_t)LZCODEC_HEADERSIZE + 1) return false;
+    const uint8_t* p = (const uint8_t*)src.data();
+    const uint8_t* pend = p + src.size();
+    uint32_t dstLen = 0;
+    for (int i = 0; i < LZCODEC_HEADERSIZE; i++) dstLen |= (uint32_t)p[i] << (8 * i);
+    if ((dstLen > LZCODEC_MAXSIZE) || (dstLen > (uint32_t)std::max(maxLen, 0))) return false;
+    p += LZCODEC_HEADERSIZE;
+    rdst.resize(dstLen);
+    uint8_t* dst = (uint8_t*)&rdst[0];
+    uint32_t out = 0;
+
+    while (p < pend) {
+        uint8_t token = *p++;
+        int numLiterals = token >> 4;
+        if ((numLiterals == 15) && !getLength(p, pend, numLiterals)) return false;
+        if (((size_t)(pend - p) < (size_t)numLiterals) || (dstLen - out < (uint32_t)numLiterals)) return false;
+        memcpy(dst + out, p, numLiterals);
+        p += numLiterals;
+        out += numLiterals;
+        if (p == pend) break;
+
+        if (pend - p < 2) return false;
+        uint32_t offset = p[0] | ((uint32_t)p[1] << 8);
+        p += 2;
+        int matchLen = token & 15;
+        if ((matchLen == 15) && !getLength(p, pend, matchLen)) return false;
+        matchLen += LZCODEC_MINMATCH;
+        if ((offset == 0) || (offset > out) || (dstLen - out < (uint32_t)matchLen)) return false;
+        // the match may overlap what it is copying, as in a run of one byte
+        const uint8_t* pmatch = dst + out - offset;
+        if (offset >= (uint32_t)matchLen) memcpy(dst + out, pmatch, matchLen);
+        else for (int i = 0; i < matchLen; i++) dst[out + i] = pmatch[i];
+        out += matchLen;
+    }
+    return out == dstLen;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+#define LZCODEC_NAME "lz1"              // name exchanged in the connection setup capabilities
+#define LZCODEC_HASHBITS 12             // 4096 entry match finder, 16KB on the stack
+#define LZCODEC_MAXSIZE (64*1024*1024)  // refuse to decompress to more than this
+
+/// Small LZ77 byte codec in the LZ4 block layout, for message payloads. No dictionary or
+/// entropy stage, it is meant to cost a few hundred ns per KB rather than to compress hard.
+///
+///   byte 0..3   uncompressed length, little endian
+///   byte 4..    sequences: token (literal length << 4 | match length - 4), more literal
+///               length bytes while 255, the literals, 2 byte offset back, more match
+///               length bytes while 255. The last sequence is literals only
+///
+/// decompress() checks every length and offset, the input comes off the network.
+class LzCodec {
+public:
+    static const int LZCODEC_HEADERSIZE = 4;
+    static const int LZCODEC_MINMATCH = 4;
+    static const int LZCODEC_LASTLITERALS = 5;      // the last bytes are always literals
+    static const int LZCODEC_MFLIMIT = 12;          // no match starts closer than this to the end
+
+    static void compress(const char* psrc, int srcLen, std::string& rdst);
+    static void compress(const std::string& src, std::string& rdst) { compress(src.data(), (int)src.size(), rdst); }
+    /// false, before anything is allocated, if the header says more than maxLen bytes
+    static bool decompress(const std::string& src, std::string& rdst, int maxLen = LZCODEC_MAXSIZE);
+};
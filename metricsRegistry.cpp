@@ -0,0 +1,97 @@
+#include <stdio.h>
+
+#include "metricsRegistry.h"
+
+// ------------------------------------------------------------------------------------------------
+
+std::atomic<uint64_t> MetricsRegistry::nextSerial{ 1 };
+
+MetricsRegistry::MetricsRegistry() :
+    serial{ nextSerial++ }
+{
+    definitions.reserve(METRICS_MAX);
+}
+
+int MetricsRegistry::define(const std::string& name, const std::string& help, METRIC_TYPE type)
+{
+    if (definitions.size() >= METRICS_MAX) return -1;
+    Definition definition;
+    definition.name = name;
+    definition.help = help;
+    definition.type = type;
+    definitions.push_back(definition);
+    return (int)definitions.size() - 1;
+}
+
+MetricsRegistry::ThreadCounters& MetricsRegistry::findThreadCounters(void)
+{
+    std::thread::id threadId = std::this_thread::get_id();
+    std::lock_guard<std::mutex> lock(threadCountersLock);
+    for (auto& rpcounters : threadCounters) {
+        if (rpcounters->threadId == threadId) return *rpcounters;
+    }
+    threadCounters.emplace_back(new ThreadCounters());
+    threadCounters.back()->threadId = threadId;
+    return *threadCounters.back();
+}
+
+int64_t MetricsRegistry::get(int metric)
+{
+    if ((metric < 0) || (metric >= (int)definitions.size())) return 0;
+    if (definitions[metric].type == METRIC_TYPE::GAUGE) return gauges[metric].value.load(std::memory_order_relaxed);
+    uint64_t total = 0;
+    std::lock_guard<std::mutex> lock(threadCountersLock);
+    for (auto& rpcounters : threadCounters) total += rpcounters->values[metric].load(std::memory_order_relaxed);
+    return (int64_t)total;
+}
+
+std::vector<MetricValue> MetricsRegistry::snapshot(void)
+{
+    std::vector<MetricValue> values(definitions.size());
+    for (size_t i = 0; i < definitions.size(); i++) {
+        values[i].name = definitions[i].name;
+        values[i].type = definitions[i].type;
+        if (definitions[i].type == METRIC_TYPE::GAUGE) values[i].value = gauges[i].value.load(std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> lock(threadCountersLock);
+    for (auto& rpcounters : threadCounters) {
+        for (size_t i = 0; i < definitions.size(); i++) {
+            if (definitions[i].type == METRIC_TYPE::COUNTER) values[i].value += (int64_t)rpcounters->values[i].load(std::memory_order_relaxed);
+        }
+    }
+    return values;
+}
+
+std::string MetricsRegistry::prometheusText(void)
+{
+    std::vector<MetricValue> values = snapshot();
+    std::string text;
+    char sample[64];
+    for (size_t i = 0; i < values.size(); i++) {
+        const char* type = (values[i].type == METRIC_TYPE::GAUGE) ? "gauge" : "counter";
+        text += "# HELP " + values[i].name + " " + definitions[i].help + "\n";
+        text += "# TYPE " + values[i].name + " " + type + "\n";
+        snprintf(sample, sizeof(sample), " %lld\n", (long long)values[i].value);
+        text += values[i].name + sample;
+    }
+    return text;
+}
+
+bool MetricsRegistry::exportFile(const std::string& path)
+{
+    std::string text = prometheusText();
+    std::string tmpPath = path + ".tmp";
+    FILE* pfile = fopen(tmpPath.c_str(), "wb");
+    if (!pfile) return false;
+    bool stat = (fwrite(text.data(), 1, text.size(), pfile) == text.size());
+    stat = (fclose(pfile) == 0) && stat;
+    if (!stat) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+#ifdef _WIN64
+    // rename() will not replace an existing file on windows
+    remove(path.c_str());
+#endif
+    return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+#include "packetQ.h"
+
+#define METRICS_MAX 32                  // counters and gauges one registry can hold
+#define METRICS_THREADCACHE_SIZE 16     // registries each thread can reach without taking a lock
+
+enum class METRIC_TYPE {
+    COUNTER,        // only goes up, summed over every thread that counted it
+    GAUGE,          // a level, the last value set
+};
+
+struct MetricValue {
+    std::string name;
+    METRIC_TYPE type = METRIC_TYPE::COUNTER;
+    int64_t value = 0;
+};
+
+// ------------------------------------------------------------------------------------------------
+
+/// Named counters and gauges that are cheap enough for the per message path. Each thread counts
+/// into its own block of slots, found through a small thread_local cache like LatencyRecorder's,
+/// and the blocks are cache line aligned so threads never share a line. Counting is a relaxed
+/// load and store, no read-modify-write and no strings. Gauges are one padded atomic each.
+/// snapshot() and prometheusText() sum the blocks, from any thread, and are the only place names
+/// are looked at. Define every metric before anything counts.
+class MetricsRegistry {
+    struct alignas(HYPERCUBE_CACHELINE_SIZE) ThreadCounters {
+        std::thread::id threadId;
+        std::atomic<uint64_t> values[METRICS_MAX];
+        ThreadCounters() { for (auto& rvalue : values) rvalue.store(0, std::memory_order_relaxed); }
+    };
+    struct alignas(HYPERCUBE_CACHELINE_SIZE) Gauge {
+        std::atomic<int64_t> value{ 0 };
+    };
+    struct Definition {
+        std::string name;
+        std::string help;
+        METRIC_TYPE type = METRIC_TYPE::COUNTER;
+    };
+    struct ThreadCacheEntry {
+        uint64_t serial = 0;
+        ThreadCounters* pcounters = 0;
+    };
+
+    static std::atomic<uint64_t> nextSerial;
+    const uint64_t serial;      // never reused, so a stale thread cache entry can not match
+    std::vector<Definition> definitions;
+    Gauge gauges[METRICS_MAX];
+    std::mutex threadCountersLock;
+    std::vector<std::unique_ptr<ThreadCounters>> threadCounters;   // kept when a thread exits
+
+    ThreadCounters& findThreadCounters(void);
+    ThreadCounters& threadCountersFor(void) {
+        static thread_local ThreadCacheEntry cache[METRICS_THREADCACHE_SIZE];
+        ThreadCacheEntry& rentry = cache[serial % METRICS_THREADCACHE_SIZE];
+        if (rentry.serial != serial) {
+            rentry.pcounters = &findThreadCounters();
+            rentry.serial = serial;
+        }
+        return *rentry.pcounters;
+    }
+    int define(const std::string& name, const std::string& help, METRIC_TYPE type);
+
+public:
+    MetricsRegistry();
+
+    /// returns the metric's index, -1 once METRICS_MAX are defined. Prometheus naming,
+    /// counters end in _total
+    int addCounter(const std::string& name, const std::string& help) { return define(name, help, METRIC_TYPE::COUNTER); }
+    int addGauge(const std::string& name, const std::string& help) { return define(name, help, METRIC_TYPE::GAUGE); }
+
+    void add(int counter, uint64_t value = 1) {
+        std::atomic<uint64_t>& rvalue = threadCountersFor().values[counter];
+        rvalue.store(rvalue.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+    void set(int gauge, int64_t value) { gauges[gauge].value.store(value, std::memory_order_relaxed); }
+
+    int64_t get(int metric);
+    std::vector<MetricValue> snapshot(void);
+    /// text exposition format, one HELP, TYPE and sample line per metric
+    std::string prometheusText(void);
+    /// writes prometheusText() next to path and renames it over path, so a scraper never
+    /// reads half a file
+    bool exportFile(const std::string& path);
+};
@@ -0,0 +1,25 @@
+#include "msgDispatcher.h"
+
+// ------------------------------------------------------------------------------------------------
+
+MSerDes& msgDispatcherSerDes(void)
+{
+    static thread_local MSerDes mserdes;
+    return mserdes;
+}
+
+bool MsgDispatcher::addRoute(int subSys, int command, RouteHandler handler)
+{
+    if (((unsigned)subSys >= MSGDISPATCHER_MAXSUBSYS) || ((unsigned)command >= MSGDISPATCHER_MAXCOMMANDS)) return false;
+    if (!routes[subSys]) routes[subSys].reset(new RouteHandler[MSGDISPATCHER_MAXCOMMANDS]);
+    routes[subSys][command] = handler;
+    anyRoutes = true;
+    return true;
+}
+
+bool MsgDispatcher::addCommandHandler(HYPERCUBECOMMANDS command, CommandHandler handler)
+{
+    if ((unsigned)command >= MSGDISPATCHER_MAXCOMMANDS) return false;
+    commandHandlers[(unsigned)command] = handler;
+    return true;
+}
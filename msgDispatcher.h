@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+#include "Messages.h"
+#include "Packet.h"
+#include "mserdes.h"
+
+#define MSGDISPATCHER_MAXSUBSYS 16          // subSys values that can have handlers, 0 up to this
+#define MSGDISPATCHER_MAXCOMMANDS 256       // commands per subSys, and HYPERCUBECOMMANDS values
+
+/// How a packet's message is made before the packet is decoded into it. Specialize for message
+/// types that need constructor arguments
+template <class MSG>
+struct MsgDecodeTraits {
+    static MSG make(void) { return MSG(); }
+};
+template <>
+struct MsgDecodeTraits<MsgCmd> {
+    static MsgCmd make(void) { return MsgCmd(""); }
+};
+
+/// One MSerDes per thread for the typed handlers
+MSerDes& msgDispatcherSerDes(void);
+
+// ------------------------------------------------------------------------------------------------
+
+/// Routes received packets to handlers registered per (subSys, command), and signalling commands
+/// to handlers registered per HYPERCUBECOMMANDS value. Each lookup is one index into a flat
+/// table. Typed handlers get the packet decoded into their own message type, the decode is
+/// instantiated for that type when the handler is registered. Handlers run on the receive
+/// thread, or the event loop thread, before anything is queued. Register them before init()
+class MsgDispatcher {
+public:
+    /// takes the packet if it moves it out of rppacket, else it is reused once the handler returns
+    typedef std::function<void(Packet::UniquePtr& rppacket)> RouteHandler;
+    typedef std::function<void(HyperCubeCommand& rcommand)> CommandHandler;
+
+private:
+    std::unique_ptr<RouteHandler[]> routes[MSGDISPATCHER_MAXSUBSYS];     // a subSys's table is made with its first handler
+    CommandHandler commandHandlers[MSGDISPATCHER_MAXCOMMANDS];
+    bool anyRoutes = false;
+    std::atomic<uint64_t> numDispatched{ 0 };
+    std::atomic<uint64_t> numDecodeFailures{ 0 };
+
+public:
+    /// false if subSys or command is out of the table's range
+    bool addRoute(int subSys, int command, RouteHandler handler);
+    /// msg is only valid during the call
+    template <class MSG>
+    bool addMsgRoute(int subSys, int command, std::function<void(MSG& msg)> handler) {
+        return addRoute(subSys, command, [this, handler](Packet::UniquePtr& rppacket) {
+            MSG msg = MsgDecodeTraits<MSG>::make();
+            if (!msgDispatcherSerDes().packetToMsg(rppacket.get(), msg)) {
+                numDecodeFailures.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            handler(msg);
+        });
+    }
+    /// called after the client's own handling of the command
+    bool addCommandHandler(HYPERCUBECOMMANDS command, CommandHandler handler);
+    /// the command's jsonData as the CommonInfoBase type it carries, GroupInfo for SUBSCRIBER say
+    template <class INFO>
+    bool addCommandHandler(HYPERCUBECOMMANDS command, std::function<void(INFO& info, HyperCubeCommand& rcommand)> handler) {
+        return addCommandHandler(command, [handler](HyperCubeCommand& rcommand) {
+            INFO info;
+            info.from_json(rcommand.getJsonData());
+            handler(info, rcommand);
+        });
+    }
+
+    bool hasRoutes(void) const { return anyRoutes; }
+    /// the handler registered for the pair, 0 if none
+    RouteHandler* findRoute(int subSys, int command) {
+        if (((unsigned)subSys >= MSGDISPATCHER_MAXSUBSYS) || ((unsigned)command >= MSGDISPATCHER_MAXCOMMANDS)) return 0;
+        RouteHandler* proutes = routes[subSys].get();
+        if (!proutes || !proutes[command]) return 0;
+        return &proutes[command];
+    }
+    void dispatch(RouteHandler& rroute, Packet::UniquePtr& rppacket) {
+        numDispatched.fetch_add(1, std::memory_order_relaxed);
+        rroute(rppacket);
+    }
+    bool dispatchCommand(HyperCubeCommand& rcommand) {
+        unsigned command = (unsigned)rcommand.command;
+        if ((command >= MSGDISPATCHER_MAXCOMMANDS) || !commandHandlers[command]) return false;
+        commandHandlers[command](rcommand);
+        return true;
+    }
+    uint64_t getNumDispatched(void) const { return numDispatched.load(std::memory_order_relaxed); }
+    uint64_t getNumDecodeFailures(void) const { return numDecodeFailures.load(std::memory_order_relaxed); }
+};
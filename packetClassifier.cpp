@@ -0,0 +1,69 @@
+#include <algorithm>
+
+#include "Logger.h"
+#include "mserdes.h"
+#include "packetClassifier.h"
+
+// ------------------------------------------------------------------------------------------------
+
+PacketClassifier::PacketClassifier()
+{
+    headerOnly = calibrate();
+    if (!headerOnly) LOG_WARNING("PacketClassifier::PacketClassifier()", "Msg header not found, decoding packets to classify them", 0);
+}
+
+PacketClassifier& PacketClassifier::instance(void)
+{
+    static PacketClassifier packetClassifier;
+    return packetClassifier;
+}
+
+/// offset of the first copy of value in the start of the packet, -1 if there is none
+template <typename T>
+static int findField(const Packet& packet, T value)
+{
+    int searchLen = std::min(packet.getLength(), PACKETCLASSIFIER_MAXHEADER) - (int)sizeof(T);
+    for (int offset = 0; offset <= searchLen; offset++) {
+        if (memcmp(packet.getpData() + offset, &value, sizeof(T)) == 0) return offset;
+    }
+    return -1;
+}
+
+/// field values no real header byte pattern is likely to repeat, and two pairs of them, so a
+/// coincidental match in the first probe is caught by the second
+bool PacketClassifier::calibrate(void)
+{
+    static const SubSys probeSubSys[] = { (SubSys)0x5A3C, (SubSys)0x3CA5 };
+    static const Command probeCommand[] = { (Command)0x6B4D, (Command)0x4DB6 };
+    MSerDes mserdes;
+    for (int i = 0; i < 2; i++) {
+        MsgJson probe("");
+        probe.subSys = probeSubSys[i];
+        probe.command = probeCommand[i];
+        Packet::UniquePtr ppacket = Packet::create();
+        if (!mserdes.msgToPacket(probe, ppacket)) return false;
+        int subSysAt = findField(*ppacket, probeSubSys[i]);
+        int commandAt = findField(*ppacket, probeCommand[i]);
+        if ((subSysAt < 0) || (commandAt < 0)) return false;
+        if (i == 0) {
+            subSysOffset = subSysAt;
+            commandOffset = commandAt;
+        }
+        else if ((subSysAt != subSysOffset) || (commandAt != commandOffset)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PacketClassifier::decode(const Packet& packet, int& rsubSys, int& rcommand)
+{
+    // MSerDes keeps no state between calls, but is not documented as safe to share
+    static thread_local MSerDes mserdes;
+    Msg msg;
+    numDecoded.fetch_add(1, std::memory_order_relaxed);
+    if (!mserdes.packetToMsg(&packet, msg)) return false;
+    rsubSys = (int)msg.subSys;
+    rcommand = (int)msg.command;
+    return true;
+}
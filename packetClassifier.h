@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string.h>
+#include <atomic>
+#include <cstdint>
+
+#include "Messages.h"
+#include "Packet.h"
+
+#define PACKETCLASSIFIER_MAXHEADER 64       // bytes searched for the Msg header fields
+
+/// Reads a packet's subSys and command straight from its bytes, without deserializing it into
+/// a Msg. Where the two fields sit is not hard coded. The first instance() serializes probe
+/// messages through MSerDes and finds them, and checks a second probe agrees. If MSerDes ever
+/// lays them out some other way, or converts them, classify() falls back to packetToMsg(),
+/// slower but still right
+class PacketClassifier {
+    typedef decltype(Msg::subSys) SubSys;
+    typedef decltype(Msg::command) Command;
+
+    int subSysOffset = -1;
+    int commandOffset = -1;
+    bool headerOnly = false;
+    std::atomic<uint64_t> numDecoded{ 0 };      // packets classified the slow way
+
+    PacketClassifier();
+    bool calibrate(void);
+    bool decode(const Packet& packet, int& rsubSys, int& rcommand);
+
+public:
+    static PacketClassifier& instance(void);
+
+    /// false if the packet is too short or does not decode
+    bool classify(const Packet& packet, int& rsubSys, int& rcommand) {
+        if (!headerOnly) return decode(packet, rsubSys, rcommand);
+        const int length = packet.getLength();
+        if ((length < subSysOffset + (int)sizeof(SubSys)) || (length < commandOffset + (int)sizeof(Command))) return false;
+        SubSys subSys;
+        Command command;
+        memcpy(&subSys, packet.getpData() + subSysOffset, sizeof(subSys));
+        memcpy(&command, packet.getpData() + commandOffset, sizeof(command));
+        rsubSys = (int)subSys;
+        rcommand = (int)command;
+        return true;
+    }
+
+    bool isHeaderOnly(void) const { return headerOnly; }
+    uint64_t getNumDecoded(void) const { return numDecoded.load(std::memory_order_relaxed); }
+};
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <algorithm>
+
+#include "packetPool.h"
+
+// ------------------------------------------------------------------------------------------------
+
+PacketPool::ThreadCache::ThreadCache()
+{
+    for (auto& rfreeList : freeList) rfreeList.reserve(PACKETPOOL_THREADCACHE_SIZE);
+}
+
+PacketPool::ThreadCache::~ThreadCache()
+{
+    // thread exiting, hand everything back to the shared lists
+    PacketPool& pool = PacketPool::instance();
+    for (int i = 0; i < PACKETPOOL_NUMSIZECLASSES; i++) {
+        while (!freeList[i].empty()) pool.spill(*this, i);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+
+PacketPool::PacketPool()
+{
+    for (auto& rsizeClass : sizeClasses) rsizeClass.freeList.reserve(PACKETPOOL_SHARED_SIZE);
+}
+
+PacketPool& PacketPool::instance(void)
+{
+    // never destroyed, so thread caches can still return packets during process exit
+    static PacketPool* ppacketPool = new PacketPool();
+    return *ppacketPool;
+}
+
+int PacketPool::sizeClass(int length)
+{
+    if (length <= 256) return 0;
+    if (length <= 4096) return 1;
+    return 2;
+}
+
+PacketPool::ThreadCache& PacketPool::threadCache(void)
+{
+    static thread_local ThreadCache cache;
+    return cache;
+}
+
+/// move up to half a thread cache from the shared list
+void PacketPool::refill(ThreadCache& rcache, int sizeClassIndex)
+{
+    SizeClass& rsizeClass = sizeClasses[sizeClassIndex];
+    std::vector<Packet*>& rfreeList = rcache.freeList[sizeClassIndex];
+    std::lock_guard<std::mutex> lock(rsizeClass.lock);
+    size_t numToMove = std::min(rsizeClass.freeList.size(), (size_t)PACKETPOOL_THREADCACHE_SIZE / 2);
+    while (numToMove-- > 0) {
+        rfreeList.push_back(rsizeClass.freeList.back());
+        rsizeClass.freeList.pop_back();
+    }
+}
+
+/// move half a thread cache to the shared list, deleting what does not fit
+void PacketPool::spill(ThreadCache& rcache, int sizeClassIndex)
+{
+    SizeClass& rsizeClass = sizeClasses[sizeClassIndex];
+    std::vector<Packet*>& rfreeList = rcache.freeList[sizeClassIndex];
+    size_t numToMove = std::max(rfreeList.size() / 2, (size_t)1);
+    std::lock_guard<std::mutex> lock(rsizeClass.lock);
+    while ((numToMove-- > 0) && !rfreeList.empty()) {
+        Packet* packet = rfreeList.back();
+        rfreeList.pop_back();
+        if (rsizeClass.freeList.size() < PACKETPOOL_SHARED_SIZE) {
+            rsizeClass.freeList.push_back(packet);
+        }
+        else {
+            delete packet;
+            freed.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+void PacketPool::onAcquired(bool hit)
+{
+    if (hit) hits.fetch_add(1, std::memory_order_relaxed);
+    else misses.fetch_add(1, std::memory_order_relaxed);
+    int64_t numInUse = inUse.fetch_add(1, std::memory_order_relaxed) + 1;
+    int64_t maxInUse = highWater.load(std::memory_order_relaxed);
+    while ((numInUse > maxInUse) && !highWater.compare_exchange_weak(maxInUse, numInUse, std::memory_order_relaxed)) {}
+}
+
+/// take a packet from one size class, the thread cache first then the shared list. 0 if both are empty
+Packet* PacketPool::take(ThreadCache& rcache, int sizeClassIndex)
+{
+    std::vector<Packet*>& rfreeList = rcache.freeList[sizeClassIndex];
+    if (rfreeList.empty()) refill(rcache, sizeClassIndex);
+    if (rfreeList.empty()) return 0;
+    Packet* packet = rfreeList.back();
+    rfreeList.pop_back();
+    return packet;
+}
+
+/// sizeHint is the expected packet length. A free packet of that size class or larger is
+/// preferred, then a smaller one, whose buffer grows as it is filled. Only an empty pool allocates
+Packet::UniquePtr PacketPool::acquire(int sizeHint)
+{
+    ThreadCache& rcache = threadCache();
+    const int hintClass = sizeClass(sizeHint);
+    for (int i = hintClass; i < PACKETPOOL_NUMSIZECLASSES; i++) {
+        Packet* packet = take(rcache, i);
+        if (packet) {
+            onAcquired(true);
+            return Packet::UniquePtr(packet);
+        }
+    }
+    for (int i = hintClass - 1; i >= 0; i--) {
+        Packet* packet = take(rcache, i);
+        if (packet) {
+            onAcquired(true);
+            return Packet::UniquePtr(packet);
+        }
+    }
+    onAcquired(false);
+    return Packet::create();
+}
+
+/// take ownership of a retired packet. Packet does not expose its capacity, so the size class
+/// follows the last length it carried, which is why acquire() also falls back to smaller classes
+void PacketPool::recycle(Packet::UniquePtr& rppacket)
+{
+    Packet* packet = rppacket.release();
+    if (!packet) return;
+    inUse.fetch_sub(1, std::memory_order_relaxed);
+    int sizeClassIndex = sizeClass(packet->getLength());
+    ThreadCache& rcache = threadCache();
+    rcache.freeList[sizeClassIndex].push_back(packet);
+    if (rcache.freeList[sizeClassIndex].size() >= PACKETPOOL_THREADCACHE_SIZE) spill(rcache, sizeClassIndex);
+}
+
+PacketPoolStats PacketPool::getStats(void)
+{
+    PacketPoolStats stats;
+    stats.hits = hits.load(std::memory_order_relaxed);
+    stats.misses = misses.load(std::memory_order_relaxed);
+    stats.freed = freed.load(std::memory_order_relaxed);
+    int64_t numInUse = inUse.load(std::memory_order_relaxed);
+    stats.inUse = (numInUse > 0) ? (uint64_t)numInUse : 0;
+    stats.highWater = (uint64_t)highWater.load(std::memory_order_relaxed);
+    return stats;
+}
+
+/// free every packet in the shared lists. Thread caches are left alone
+void PacketPool::trim(void)
+{
+    for (auto& rsizeClass : sizeClasses) {
+        std::lock_guard<std::mutex> lock(rsizeClass.lock);
+        for (Packet* packet : rsizeClass.freeList) delete packet;
+        rsizeClass.freeList.clear();
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+#include "Packet.h"
+#include "packetQ.h"
+
+#define PACKETPOOL_NUMSIZECLASSES 3         // <= 256, <= 4096, larger
+#define PACKETPOOL_THREADCACHE_SIZE 64      // packets per size class cached by each thread
+#define PACKETPOOL_SHARED_SIZE 4096         // packets per size class kept in the shared free lists
+
+struct PacketPoolStats {
+    uint64_t hits = 0;          // acquire() served from a free list
+    uint64_t misses = 0;        // acquire() had to allocate
+    uint64_t freed = 0;         // recycle() found the pool full and deleted the packet
+    uint64_t inUse = 0;         // acquired and not yet recycled
+    uint64_t highWater = 0;     // max inUse seen
+};
+
+/// Process wide pool of Packet objects.
+/// Each thread keeps a small cache per size class and only takes the shared lock to move
+/// half a cache at a time to or from the shared free lists, so packets created on one
+/// thread and retired on another (sendMsgOut -> SendActivity) flow back without a malloc.
+/// Packets are handed out as plain Packet::UniquePtr, so the owner that retires a packet
+/// must call recycle(); a packet that is simply destroyed is only lost to the pool.
+class PacketPool {
+    struct SizeClass {
+        std::mutex lock;
+        std::vector<Packet*> freeList;
+    };
+
+    class ThreadCache {
+    public:
+        std::vector<Packet*> freeList[PACKETPOOL_NUMSIZECLASSES];
+        ThreadCache();
+        ~ThreadCache();
+    };
+
+    SizeClass sizeClasses[PACKETPOOL_NUMSIZECLASSES];
+
+    alignas(HYPERCUBE_CACHELINE_SIZE) std::atomic<uint64_t> hits{ 0 };
+    alignas(HYPERCUBE_CACHELINE_SIZE) std::atomic<uint64_t> misses{ 0 };
+    alignas(HYPERCUBE_CACHELINE_SIZE) std::atomic<uint64_t> freed{ 0 };
+    alignas(HYPERCUBE_CACHELINE_SIZE) std::atomic<int64_t> inUse{ 0 };
+    std::atomic<int64_t> highWater{ 0 };
+
+    PacketPool();
+    static int sizeClass(int length);
+    static ThreadCache& threadCache(void);
+    void refill(ThreadCache& rcache, int sizeClassIndex);
+    Packet* take(ThreadCache& rcache, int sizeClassIndex);
+    void spill(ThreadCache& rcache, int sizeClassIndex);
+    void onAcquired(bool hit);
+
+public:
+    static PacketPool& instance(void);
+
+    Packet::UniquePtr acquire(int sizeHint = 0);
+    void recycle(Packet::UniquePtr& rppacket);
+    PacketPoolStats getStats(void);
+    void trim(void);
+};
@@ -0,0 +1,58 @@
+#include <stdio.h>
+
+#include "packetQ.h"
+#include "packetPool.h"
+
+// ------------------------------------------------------------------------------------------------
+
+void recyclePacket(std::unique_ptr<Packet>& rppacket)
+{
+    PacketPool::instance().recycle(rppacket);
+}
+
+// ------------------------------------------------------------------------------------------------
+
+void PacketQWithLock::init(void) 
+{
+    deinit();
+}
+
+void PacketQWithLock::deinit(void) {
+    std::lock_guard<std::mutex> lock(qLock);
+    while (std::deque<TimedPacket>::size() > 0) {
+        recyclePacket(std::deque<TimedPacket>::front().ppacket);
+        pop_front();
+    }
+}
+
+bool PacketQWithLock::push(std::unique_ptr<Packet>& rpacket, int64_t queuedNs) {
+    std::lock_guard<std::mutex> lock(qLock);
+    push_back(TimedPacket{ std::move(rpacket), queuedNs });
+    return true;
+}
+
+bool PacketQWithLock::pop(std::unique_ptr<Packet>& rpacket, int64_t* pqueuedNs) {
+    std::lock_guard<std::mutex> lock(qLock);
+    if (empty()) return false;
+    rpacket = std::move(std::deque<TimedPacket>::front().ppacket);
+    if (pqueuedNs) *pqueuedNs = std::deque<TimedPacket>::front().queuedNs;
+    pop_front();
+    return true;
+}
+
+int PacketQWithLock::popMany(std::unique_ptr<Packet>* ppackets, int maxPackets, int64_t* pqueuedNs) {
+    std::lock_guard<std::mutex> lock(qLock);
+    int numPackets = 0;
+    while ((numPackets < maxPackets) && !empty()) {
+        if (pqueuedNs) pqueuedNs[numPackets] = std::deque<TimedPacket>::front().queuedNs;
+        ppackets[numPackets++] = std::move(std::deque<TimedPacket>::front().ppacket);
+        pop_front();
+    }
+    return numPackets;
+}
+
+bool PacketQWithLock::isEmpty(void) 
+{
+    std::lock_guard<std::mutex> lock(qLock);
+    return empty();
+}
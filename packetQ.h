@@ -0,0 +1,232 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "Packet.h"
+
+#define HYPERCUBE_CACHELINE_SIZE 64         // padding for indices shared between threads
+#define HYPERCUBE_INPACKETQ_SIZE 4096       // max packets waiting for getPacket(), must be a power of 2
+#define HYPERCUBE_OUTPACKETQ_SIZE 4096      // max packets waiting for SendActivity, must be a power of 2
+
+// ------------------------------------------------------------------------------------------------
+
+/// Queue entry. queuedNs is when the packet was queued, from latencyNowNs(), or 0 if not timed
+struct TimedPacket {
+    Packet::UniquePtr ppacket = 0;
+    int64_t queuedNs = 0;
+};
+
+/// hands a packet left in a queue at deinit() back to PacketPool, so its inUse count stays right
+void recyclePacket(std::unique_ptr<Packet>& rppacket);
+
+// ------------------------------------------------------------------------------------------------
+
+/// Mutex protected deque. Unbounded, any number of producers and consumers.
+class PacketQWithLock : std::deque<TimedPacket> {
+    std::mutex qLock;
+public:
+    void init(void);
+    void deinit(void);
+    bool push(std::unique_ptr<Packet>& rpacket, int64_t queuedNs = 0);
+    bool pop(std::unique_ptr<Packet>& rpacket, int64_t* pqueuedNs = 0);
+    int popMany(std::unique_ptr<Packet>* ppackets, int maxPackets, int64_t* pqueuedNs = 0);
+    bool isEmpty(void);
+};
+
+// ------------------------------------------------------------------------------------------------
+
+/// Bounded lock free ring for exactly one producer thread and one consumer thread.
+/// The producer only writes tail and the consumer only writes head, each on its own cache line.
+/// Each side keeps a cached copy of the other side's index, so the shared line is only
+/// read when the ring looks full (producer) or empty (consumer).
+template <typename T, size_t SIZE>
+class SpscRing {
+    static_assert((SIZE & (SIZE - 1)) == 0, "SpscRing SIZE must be a power of 2");
+    static const size_t MASK = SIZE - 1;
+
+    alignas(HYPERCUBE_CACHELINE_SIZE) std::atomic<size_t> head{ 0 };   // consumer
+    size_t cachedTail = 0;
+    alignas(HYPERCUBE_CACHELINE_SIZE) std::atomic<size_t> tail{ 0 };   // producer
+    size_t cachedHead = 0;
+    alignas(HYPERCUBE_CACHELINE_SIZE) T slots[SIZE];
+
+public:
+    /// producer side. Moves from ritem only on success
+    bool push(T& ritem) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - cachedHead == SIZE) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (t - cachedHead == SIZE) return false;
+        }
+        slots[t & MASK] = std::move(ritem);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// consumer side
+    bool pop(T& ritem) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == cachedTail) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (h == cachedTail) return false;
+        }
+        ritem = std::move(slots[h & MASK]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// consumer side. Hands up to maxItems to onItem(T&) with one acquire of tail and one release of head
+    template <class ONITEM>
+    int popMany(int maxItems, ONITEM onItem) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if ((size_t)maxItems > cachedTail - h) cachedTail = tail.load(std::memory_order_acquire);
+        size_t numItems = std::min((size_t)maxItems, cachedTail - h);
+        for (size_t i = 0; i < numItems; i++) onItem(slots[(h + i) & MASK]);
+        if (numItems > 0) head.store(h + numItems, std::memory_order_release);
+        return (int)numItems;
+    }
+
+    bool isEmpty(void) const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    size_t size(void) const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    static size_t capacity(void) { return SIZE; }
+};
+
+// ------------------------------------------------------------------------------------------------
+
+/// Bounded lock free ring for any number of producer threads and one consumer thread.
+/// Producers claim a slot with a CAS on enqueuePos, then publish it through the slot's
+/// sequence number, so the consumer never sees a half written slot.
+template <typename T, size_t SIZE>
+class MpscRing {
+    static_assert((SIZE & (SIZE - 1)) == 0, "MpscRing SIZE must be a power of 2");
+    static const size_t MASK = SIZE - 1;
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    alignas(HYPERCUBE_CACHELINE_SIZE) std::atomic<size_t> enqueuePos{ 0 };     // producers
+    alignas(HYPERCUBE_CACHELINE_SIZE) std::atomic<size_t> dequeuePos{ 0 };     // consumer
+    alignas(HYPERCUBE_CACHELINE_SIZE) Cell cells[SIZE];
+
+public:
+    MpscRing() {
+        for (size_t i = 0; i < SIZE; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    /// producer side, any thread. Moves from ritem only on success
+    bool push(T& ritem) {
+        Cell* cell = 0;
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells[pos & MASK];
+            const size_t seq = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0) {
+                return false;   // full
+            }
+            else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(ritem);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// consumer side
+    bool pop(T& ritem) {
+        const size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        Cell* cell = &cells[pos & MASK];
+        if (cell->sequence.load(std::memory_order_acquire) != pos + 1) return false;
+        ritem = std::move(cell->data);
+        cell->sequence.store(pos + SIZE, std::memory_order_release);
+        dequeuePos.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// consumer side. Each slot still has to be checked, but dequeuePos is published once
+    template <class ONITEM>
+    int popMany(int maxItems, ONITEM onItem) {
+        const size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        int numItems = 0;
+        while (numItems < maxItems) {
+            Cell* cell = &cells[(pos + numItems) & MASK];
+            if (cell->sequence.load(std::memory_order_acquire) != pos + numItems + 1) break;
+            onItem(cell->data);
+            cell->sequence.store(pos + numItems + SIZE, std::memory_order_release);
+            numItems++;
+        }
+        if (numItems > 0) dequeuePos.store(pos + numItems, std::memory_order_release);
+        return numItems;
+    }
+
+    /// exact on the consumer side, a hint elsewhere
+    bool isEmpty(void) const {
+        const size_t pos = dequeuePos.load(std::memory_order_acquire);
+        return cells[pos & MASK].sequence.load(std::memory_order_acquire) != pos + 1;
+    }
+
+    size_t size(void) const {
+        const size_t enq = enqueuePos.load(std::memory_order_acquire);
+        const size_t deq = dequeuePos.load(std::memory_order_acquire);
+        return (enq > deq) ? enq - deq : 0;
+    }
+
+    static size_t capacity(void) { return SIZE; }
+};
+
+// ------------------------------------------------------------------------------------------------
+
+/// Same interface as PacketQWithLock over one of the lock free rings above.
+/// deinit() drains from the consumer side, so it must not race with pop().
+template <class RING>
+class PacketQLockFree {
+    RING ring;
+public:
+    void init(void) { deinit(); }
+    void deinit(void) {
+        TimedPacket timedPacket;
+        while (ring.pop(timedPacket)) recyclePacket(timedPacket.ppacket);
+    }
+    bool push(std::unique_ptr<Packet>& rpacket, int64_t queuedNs = 0) {
+        TimedPacket timedPacket{ std::move(rpacket), queuedNs };
+        if (ring.push(timedPacket)) return true;
+        rpacket = std::move(timedPacket.ppacket);
+        return false;
+    }
+    bool pop(std::unique_ptr<Packet>& rpacket, int64_t* pqueuedNs = 0) {
+        TimedPacket timedPacket;
+        if (!ring.pop(timedPacket)) return false;
+        rpacket = std::move(timedPacket.ppacket);
+        if (pqueuedNs) *pqueuedNs = timedPacket.queuedNs;
+        return true;
+    }
+    /// pqueuedNs, if given, is an array of maxPackets that gets each packet's queue time
+    int popMany(std::unique_ptr<Packet>* ppackets, int maxPackets, int64_t* pqueuedNs = 0) {
+        int numPackets = 0;
+        return ring.popMany(maxPackets, [&](TimedPacket& rtimedPacket) {
+            if (pqueuedNs) pqueuedNs[numPackets] = rtimedPacket.queuedNs;
+            ppackets[numPackets++] = std::move(rtimedPacket.ppacket);
+        });
+    }
+    bool isEmpty(void) { return ring.isEmpty(); }
+};
+
+typedef PacketQLockFree<SpscRing<TimedPacket, HYPERCUBE_INPACKETQ_SIZE>> PacketQSpsc;
+typedef PacketQLockFree<MpscRing<TimedPacket, HYPERCUBE_OUTPACKETQ_SIZE>> PacketQMpsc;
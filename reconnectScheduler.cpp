@@ -0,0 +1,89 @@
+#include <algorithm>
+
+#include "latencyHistogram.h"
+#include "reconnectScheduler.h"
+
+// ------------------------------------------------------------------------------------------------
+
+ReconnectScheduler::ReconnectScheduler() :
+    random{ std::random_device{}() }
+{
+}
+
+void ReconnectScheduler::setPolicy(const ReconnectPolicy& _policy)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    policy = _policy;
+    policy.baseDelayMs = std::max(policy.baseDelayMs, 1);
+    policy.maxDelayMs = std::max(policy.maxDelayMs, policy.baseDelayMs);
+    policy.multiplier = std::max(policy.multiplier, 1.0);
+}
+
+ReconnectPolicy ReconnectScheduler::getPolicy(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return policy;
+}
+
+/// called with lock held. delayMs is the previous wait, 0 right after a disconnect
+int ReconnectScheduler::nextDelayMs(void)
+{
+    if (delayMs == 0) return policy.baseDelayMs;
+    double upper = std::max((double)delayMs * policy.multiplier, (double)policy.baseDelayMs);
+    double next = upper;
+    if (policy.jitter) {
+        std::uniform_real_distribution<double> distribution(policy.baseDelayMs, upper);
+        next = distribution(random);
+    }
+    return (int)std::min(next, (double)policy.maxDelayMs);
+}
+
+void ReconnectScheduler::onDisconnected(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    stats.numDisconnects++;
+    int64_t nowNs = latencyNowNs();
+    disconnectedNs = nowNs;
+    delayMs = 0;
+    if (!policy.immediateFirstRetry) delayMs = nextDelayMs();
+    nextAttemptNs = nowNs + (int64_t)delayMs * 1000000;
+}
+
+void ReconnectScheduler::onAttemptFailed(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    stats.numFailedAttempts++;
+    delayMs = nextDelayMs();
+    nextAttemptNs = latencyNowNs() + (int64_t)delayMs * 1000000;
+}
+
+int64_t ReconnectScheduler::onConnected(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    int64_t reconnectNs = 0;
+    if (disconnectedNs) {
+        reconnectNs = latencyNowNs() - disconnectedNs;
+        stats.numReconnects++;
+        stats.lastReconnectNs = reconnectNs;
+    }
+    disconnectedNs = 0;
+    delayMs = 0;
+    nextAttemptNs = 0;
+    return reconnectNs;
+}
+
+int ReconnectScheduler::msUntilNextAttempt(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    int64_t waitNs = nextAttemptNs - latencyNowNs();
+    // round up, a wait cut short by a millisecond would just come back here
+    return (waitNs > 0) ? (int)((waitNs + 999999) / 1000000) : 0;
+}
+
+ReconnectStats ReconnectScheduler::getStats(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    ReconnectStats currentStats = stats;
+    currentStats.currentDelayMs = delayMs;
+    return currentStats;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <mutex>
+#include <random>
+#include <cstdint>
+
+#define RECONNECT_BASEDELAY_MS 100          // shortest wait after a failed attempt
+#define RECONNECT_MAXDELAY_MS 8000          // longest wait between attempts
+#define RECONNECT_CONNECTTIMEOUT_MS 2000    // an attempt that has not connected by then has failed
+
+/// How soon to try again after losing the server.
+/// With jitter each wait is drawn uniformly from [baseDelayMs, previous wait * multiplier]
+/// ("decorrelated jitter"), so clients dropped together do not come back in step.
+/// Without it the waits are baseDelayMs * multiplier^n. Both are capped at maxDelayMs.
+struct ReconnectPolicy {
+    bool immediateFirstRetry = true;    // first attempt after a disconnect goes straight away
+    int baseDelayMs = RECONNECT_BASEDELAY_MS;
+    int maxDelayMs = RECONNECT_MAXDELAY_MS;
+    double multiplier = 3.0;
+    bool jitter = true;
+    /// Ctcp::Client::connect() makes its socket and connects it in one blocking call, so it cannot
+    /// be bounded itself. Instead each attempt first makes a throwaway non-blocking connection
+    /// that has to succeed within this long. That costs an extra handshake round trip per
+    /// attempt, and the server sees a connection that closes straight away. The real connect
+    /// after it can still block if the server goes away in between. 0 skips the probe and
+    /// leaves it all to the blocking connect()
+    int connectTimeoutMs = RECONNECT_CONNECTTIMEOUT_MS;
+};
+
+struct ReconnectStats {
+    uint64_t numDisconnects = 0;
+    uint64_t numReconnects = 0;         // successful connects after a disconnect
+    uint64_t numFailedAttempts = 0;
+    int64_t lastReconnectNs = 0;        // disconnect to connected, for the last reconnect
+    int currentDelayMs = 0;             // wait before the next attempt, while disconnected
+};
+
+/// Decides when the next connection attempt is due. Driven by the thread that connects,
+/// onDisconnected() may be called from any thread
+class ReconnectScheduler {
+    std::mutex lock;
+    ReconnectPolicy policy;
+    std::mt19937 random;
+    int delayMs = 0;
+    int64_t nextAttemptNs = 0;
+    int64_t disconnectedNs = 0;         // 0 until the first disconnect, so the first connect is not a reconnect
+    ReconnectStats stats;
+
+    int nextDelayMs(void);
+public:
+    ReconnectScheduler();
+    void setPolicy(const ReconnectPolicy& _policy);
+    ReconnectPolicy getPolicy(void);
+    /// the connection went away. Starts the reconnect clock and resets the backoff
+    void onDisconnected(void);
+    /// an attempt failed, backs off
+    void onAttemptFailed(void);
+    /// returns how long the reconnect took in ns, 0 if this was not a reconnect
+    int64_t onConnected(void);
+    /// 0 when an attempt is due now
+    int msUntilNextAttempt(void);
+    ReconnectStats getStats(void);
+};
@@ -0,0 +1,107 @@
+#include "packetPool.h"
+#include "replayBuffer.h"
+
+// ------------------------------------------------------------------------------------------------
+
+void ReplayBuffer::reserve(int length)
+{
+    bufferedPackets++;
+    bufferedBytes += length;
+}
+
+void ReplayBuffer::retain(uint64_t seq, Packet::UniquePtr& rppacket)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    // the ack can beat the sender back from the send call
+    if (seq <= ackedSeq) {
+        bufferedPackets--;
+        bufferedBytes -= rppacket->getLength();
+        PacketPool::instance().recycle(rppacket);
+        return;
+    }
+    Entry entry;
+    entry.seq = seq;
+    entry.ppacket = std::move(rppacket);
+    sent.push_back(std::move(entry));
+}
+
+/// called with lock held
+void ReplayBuffer::release(std::deque<Entry>& rentries, uint64_t seq)
+{
+    while (!rentries.empty() && (rentries.front().seq <= seq)) {
+        bufferedPackets--;
+        bufferedBytes -= rentries.front().ppacket->getLength();
+        PacketPool::instance().recycle(rentries.front().ppacket);
+        rentries.pop_front();
+    }
+}
+
+void ReplayBuffer::ack(uint64_t seq)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (seq <= ackedSeq) return;
+    ackedSeq = seq;
+    release(sent, seq);
+    release(resend, seq);
+    hasResend = !resend.empty();
+}
+
+void ReplayBuffer::resume(uint64_t receivedSeq)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (receivedSeq > ackedSeq) {
+        ackedSeq = receivedSeq;
+        release(sent, receivedSeq);
+        release(resend, receivedSeq);
+    }
+    // what was resent before this reconnect comes before what was still waiting to be
+    while (!sent.empty()) {
+        resend.push_front(std::move(sent.back()));
+        sent.pop_back();
+    }
+    hasResend = !resend.empty();
+}
+
+bool ReplayBuffer::popResend(uint64_t& rseq, Packet::UniquePtr& rppacket)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (resend.empty()) return false;
+    rseq = resend.front().seq;
+    rppacket = std::move(resend.front().ppacket);
+    resend.pop_front();
+    hasResend = !resend.empty();
+    stats.numRetransmitted++;
+    stats.retransmittedBytes += rppacket->getLength();
+    return true;
+}
+
+void ReplayBuffer::clear(bool lost)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (lost) stats.numLost += sent.size() + resend.size();
+    for (auto& rentry : sent) PacketPool::instance().recycle(rentry.ppacket);
+    for (auto& rentry : resend) PacketPool::instance().recycle(rentry.ppacket);
+    sent.clear();
+    resend.clear();
+    hasResend = false;
+    ackedSeq = 0;
+    bufferedPackets = 0;
+    bufferedBytes = 0;
+}
+
+uint64_t ReplayBuffer::getAckedSeq(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return ackedSeq;
+}
+
+ReplayBufferStats ReplayBuffer::getStats(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    ReplayBufferStats currentStats = stats;
+    int64_t numPackets = bufferedPackets;
+    int64_t numBytes = bufferedBytes;
+    currentStats.bufferedPackets = (numPackets > 0) ? (uint64_t)numPackets : 0;
+    currentStats.bufferedBytes = (numBytes > 0) ? (uint64_t)numBytes : 0;
+    return currentStats;
+}
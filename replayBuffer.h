@@ -0,0 +1,69 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <cstdint>
+
+#include "Packet.h"
+
+#define REPLAYBUFFER_MAXPACKETS 4096            // DATA packets kept for the server to ack
+#define REPLAYBUFFER_MAXBYTES (8*1024*1024)
+
+struct ReplayBufferLimits {
+    int maxPackets = REPLAYBUFFER_MAXPACKETS;
+    int64_t maxBytes = REPLAYBUFFER_MAXBYTES;
+};
+
+struct ReplayBufferStats {
+    uint64_t bufferedPackets = 0;       // numbered and not yet acked, sent or not
+    uint64_t bufferedBytes = 0;
+    uint64_t numRetransmitted = 0;      // packets handed out again after a resume
+    uint64_t retransmittedBytes = 0;
+    uint64_t numLost = 0;               // thrown away unacked, the server did not resume the session
+};
+
+/// The DATA packets of a reliable session that the server has not acked yet. Packets are
+/// numbered in the order they go out, and kept here, the packets themselves, not copies,
+/// once they have been sent. An ack releases everything up to its sequence number back to
+/// the PacketPool. After a reconnect, resume() lines the rest up to be sent again in order.
+/// Sequence numbers are implicit on the wire, the server counts DATA packets as they arrive.
+///
+/// The limits are checked by the sender before it numbers another packet, so what is in
+/// flight is counted from reserve() on. Any thread may ack
+class ReplayBuffer {
+    struct Entry {
+        uint64_t seq = 0;
+        Packet::UniquePtr ppacket = 0;
+    };
+
+    std::mutex lock;
+    std::deque<Entry> sent;             // waiting for an ack, in seq order
+    std::deque<Entry> resend;           // to go out again, in seq order, all after sent
+    uint64_t ackedSeq = 0;
+    ReplayBufferLimits limits;
+    std::atomic<int64_t> bufferedPackets = 0;
+    std::atomic<int64_t> bufferedBytes = 0;
+    std::atomic<bool> hasResend = false;
+    ReplayBufferStats stats;
+
+    void release(std::deque<Entry>& rentries, uint64_t seq);
+public:
+    void setLimits(const ReplayBufferLimits& _limits) { limits = _limits; }
+    /// no room for another packet until the server acks some
+    bool isFull(void) { return (bufferedPackets >= limits.maxPackets) || (bufferedBytes >= limits.maxBytes); }
+    bool isResendPending(void) { return hasResend; }
+    /// count a packet about to be numbered and sent
+    void reserve(int length);
+    /// keep a packet that has been sent, or was part way out when the connection went
+    void retain(uint64_t seq, Packet::UniquePtr& rppacket);
+    /// the server has every packet up to and including seq
+    void ack(uint64_t seq);
+    /// reconnected, the server has everything up to receivedSeq. The rest is to be sent again
+    void resume(uint64_t receivedSeq);
+    bool popResend(uint64_t& rseq, Packet::UniquePtr& rppacket);
+    /// drop everything, counting what was still unacked as lost. Numbering starts again
+    void clear(bool lost);
+    uint64_t getAckedSeq(void);
+    ReplayBufferStats getStats(void);
+};
@@ -0,0 +1,129 @@
+#include <algorithm>
+
+#include "latencyHistogram.h"
+#include "requestTracker.h"
+
+// ------------------------------------------------------------------------------------------------
+
+uint32_t RequestTracker::add(int ackCommand, int timeoutMs, ReplyHandler handler, bool& rwakeExpiry)
+{
+    Request request;
+    request.ackCommand = ackCommand;
+    request.sentNs = latencyNowNs();
+    request.deadlineNs = request.sentNs + (int64_t)std::max(timeoutMs, 1) * 1000000;
+    request.handler = std::move(handler);
+    std::lock_guard<std::mutex> guard(lock);
+    uint32_t correlationId = nextCorrelationId++;
+    if (nextCorrelationId == 0) nextCorrelationId = 1;
+    rwakeExpiry = request.deadlineNs < expireNs;
+    if (rwakeExpiry) expireNs = request.deadlineNs;
+    requests[correlationId] = std::move(request);
+    stats.numRequests++;
+    stats.maxOutstanding = std::max(stats.maxOutstanding, (uint64_t)requests.size());
+    return correlationId;
+}
+
+/// outside the lock
+void RequestTracker::complete(std::vector<std::pair<Request, RequestReply>>& rdone)
+{
+    for (auto& rrequestReply : rdone) {
+        if (rrequestReply.first.handler) rrequestReply.first.handler(rrequestReply.second);
+    }
+}
+
+bool RequestTracker::onAck(uint32_t correlationId, int ackCommand, bool status, const json& jsonData, int64_t& rrttNs)
+{
+    std::vector<std::pair<Request, RequestReply>> done;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = requests.end();
+        if (correlationId != 0) it = requests.find(correlationId);
+        else it = std::find_if(requests.begin(), requests.end(), [ackCommand](const std::pair<const uint32_t, Request>& rentry) {
+            return rentry.second.ackCommand == ackCommand;
+        });
+        if (it == requests.end()) {
+            stats.numUnmatched++;
+            return false;
+        }
+        RequestReply reply;
+        reply.acked = true;
+        reply.status = status;
+        reply.jsonData = jsonData;
+        reply.rttNs = latencyNowNs() - it->second.sentNs;
+        rrttNs = reply.rttNs;
+        stats.numAcked++;
+        if (!status) stats.numFailed++;
+        done.emplace_back(std::move(it->second), std::move(reply));
+        requests.erase(it);
+    }
+    complete(done);
+    return true;
+}
+
+void RequestTracker::cancel(uint32_t correlationId)
+{
+    std::vector<std::pair<Request, RequestReply>> done;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = requests.find(correlationId);
+        if (it == requests.end()) return;
+        stats.numCancelled++;
+        done.emplace_back(std::move(it->second), RequestReply());
+        requests.erase(it);
+    }
+    complete(done);
+}
+
+void RequestTracker::cancelAll(void)
+{
+    std::vector<std::pair<Request, RequestReply>> done;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stats.numCancelled += requests.size();
+        for (auto& rentry : requests) done.emplace_back(std::move(rentry.second), RequestReply());
+        requests.clear();
+        expireNs = INT64_MAX;
+    }
+    complete(done);
+}
+
+int RequestTracker::expire(void)
+{
+    std::vector<std::pair<Request, RequestReply>> done;
+    int64_t waitNs = 0;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        int64_t nowNs = latencyNowNs();
+        // expireNs may belong to a request acked since, then the scan below just finds the next
+        if (nowNs < expireNs) {
+            if (expireNs == INT64_MAX) return -1;
+            waitNs = expireNs - nowNs;
+        }
+        else {
+            expireNs = INT64_MAX;
+            for (auto it = requests.begin(); it != requests.end();) {
+                if (it->second.deadlineNs > nowNs) {
+                    expireNs = std::min(expireNs, it->second.deadlineNs);
+                    ++it;
+                    continue;
+                }
+                stats.numTimedOut++;
+                done.emplace_back(std::move(it->second), RequestReply());
+                it = requests.erase(it);
+            }
+            waitNs = (expireNs == INT64_MAX) ? -1 : expireNs - nowNs;
+        }
+    }
+    complete(done);
+    if (waitNs < 0) return -1;
+    // round up, a wait cut short would just come back here early
+    return (int)((waitNs + 999999) / 1000000);
+}
+
+RequestStats RequestTracker::getStats(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    RequestStats currentStats = stats;
+    currentStats.outstanding = requests.size();
+    return currentStats;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <mutex>
+#include <map>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+#include "Messages.h"
+
+#define REQUEST_TIMEOUT_MS 5000         // default wait for a signalling command's ack
+
+/// What a signalling request got back. Handed to the request's handler exactly once
+struct RequestReply {
+    bool acked = false;         // false if it timed out or the connection went first
+    bool status = false;        // the ack's status
+    json jsonData;              // the ack's payload
+    int64_t rttNs = 0;          // sent until acked
+};
+
+typedef std::function<void(const RequestReply& rreply)> ReplyHandler;
+
+struct RequestStats {
+    uint64_t numRequests = 0;
+    uint64_t numAcked = 0;
+    uint64_t numFailed = 0;         // acked with a failed status
+    uint64_t numTimedOut = 0;
+    uint64_t numCancelled = 0;      // the connection went before the ack
+    uint64_t numUnmatched = 0;      // acks with no request waiting for them
+    uint64_t outstanding = 0;
+    uint64_t maxOutstanding = 0;
+};
+
+/// Signalling commands waiting for their acks. Each gets a correlation id, sent with the command
+/// and echoed in the ack. Acks from servers that do not echo it are matched to the oldest
+/// request waiting for that ack command, which is right as long as the server acks in order.
+/// Handlers run on the thread that completes the request, the receive thread for acks, and
+/// never with the lock held
+class RequestTracker {
+    struct Request {
+        int ackCommand = 0;
+        int64_t sentNs = 0;
+        int64_t deadlineNs = 0;
+        ReplyHandler handler;
+    };
+
+    std::mutex lock;
+    uint32_t nextCorrelationId = 1;
+    std::map<uint32_t, Request> requests;       // ids only go up, so the oldest comes first
+    int64_t expireNs = INT64_MAX;               // no request is due before this
+    RequestStats stats;
+
+    void complete(std::vector<std::pair<Request, RequestReply>>& rdone);
+public:
+    /// returns the correlation id to send. rwakeExpiry is set when this request is due before
+    /// the last expire() said to come back
+    uint32_t add(int ackCommand, int timeoutMs, ReplyHandler handler, bool& rwakeExpiry);
+    /// correlationId 0 when the ack did not carry one. False if no request was waiting
+    bool onAck(uint32_t correlationId, int ackCommand, bool status, const json& jsonData, int64_t& rrttNs);
+    /// the command never went out
+    void cancel(uint32_t correlationId);
+    /// the connection went, nothing outstanding will be acked
+    void cancelAll(void);
+    /// time out what is past its deadline. ms until the next deadline, -1 if none.
+    /// Only looks through the requests once one is due
+    int expire(void);
+    RequestStats getStats(void);
+};
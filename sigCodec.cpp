@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <vector>
+
+#include "sigCodec.h"
+
+// ------------------------------------------------------------------------------------------------
+
+static void putHeader(std::string& rdata, HYPERCUBECOMMANDS command, SigCodec::PAYLOAD payloadType, bool ack, bool status, uint32_t correlationId, size_t payloadSize)
+{
+    uint16_t commandValue = (uint16_t)command;
+    uint8_t flags = (ack ? SigCodec::SIGCODEC_FLAG_ACK : 0) | (status ? SigCodec::SIGCODEC_FLAG_STATUS : 0)
+        | ((correlationId != 0) ? SigCodec::SIGCODEC_FLAG_CORRELATION : 0);
+
+    rdata.clear();
+    rdata.reserve(SigCodec::SIGCODEC_HEADERSIZE + SigCodec::SIGCODEC_CORRELATIONSIZE + payloadSize);
+    rdata.push_back((char)SIGCODEC_MAGIC);
+    rdata.push_back((char)SIGCODEC_VERSION);
+    rdata.push_back((char)(commandValue & 0xff));
+    rdata.push_back((char)(commandValue >> 8));
+    rdata.push_back((char)flags);
+    rdata.push_back((char)payloadType);
+    if (correlationId != 0) {
+        for (int i = 0; i < SigCodec::SIGCODEC_CORRELATIONSIZE; i++) rdata.push_back((char)(correlationId >> (8 * i)));
+    }
+}
+
+bool SigCodec::encode(HYPERCUBECOMMANDS command, CommonInfoBase& commonInfoBase, bool ack, bool status, std::string& rdata, uint32_t correlationId)
+{
+    StringInfo* pstringInfo = dynamic_cast<StringInfo*>(&commonInfoBase);
+    if (pstringInfo) {
+        putHeader(rdata, command, PAYLOAD::STRING, ack, status, correlationId, pstringInfo->data.size());
+        rdata.append(pstringInfo->data);
+    }
+    else {
+        std::vector<uint8_t> msgpack = json::to_msgpack(commonInfoBase.to_json());
+        putHeader(rdata, command, PAYLOAD::MSGPACK, ack, status, correlationId, msgpack.size());
+        rdata.append((const char*)msgpack.data(), msgpack.size());
+    }
+    return true;
+}
+
+bool SigCodec::encode(HYPERCUBECOMMANDS command, const json& payload, PAYLOAD payloadType, bool ack, bool status, std::string& rdata, uint32_t correlationId)
+{
+    switch (payloadType) {
+        case PAYLOAD::NONE:
+            putHeader(rdata, command, payloadType, ack, status, correlationId, 0);
+            break;
+        case PAYLOAD::STRING:
+        {
+            StringInfo stringInfo;
+            stringInfo.from_json(payload);
+            putHeader(rdata, command, payloadType, ack, status, correlationId, stringInfo.data.size());
+            rdata.append(stringInfo.data);
+        }
+        break;
+        case PAYLOAD::MSGPACK:
+        {
+            std::vector<uint8_t> msgpack = json::to_msgpack(payload);
+            putHeader(rdata, command, payloadType, ack, status, correlationId, msgpack.size());
+            rdata.append((const char*)msgpack.data(), msgpack.size());
+        }
+        break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+bool SigCodec::decode(const std::string& data, HyperCubeCommand& rhyperCubeCommand, uint32_t& rcorrelationId)
+{
+    if (!isBinary(data)) return false;
+    if ((uint8_t)data[1] != SIGCODEC_VERSION) return false;
+
+    const uint8_t* pdata = (const uint8_t*)data.data();
+    HYPERCUBECOMMANDS command = (HYPERCUBECOMMANDS)(pdata[2] | (pdata[3] << 8));
+    uint8_t flags = pdata[4];
+    PAYLOAD payloadType = (PAYLOAD)pdata[5];
+    size_t payloadStart = SIGCODEC_HEADERSIZE;
+    rcorrelationId = 0;
+    if (flags & SIGCODEC_FLAG_CORRELATION) {
+        if (data.size() < (size_t)SIGCODEC_HEADERSIZE + SIGCODEC_CORRELATIONSIZE) return false;
+        for (int i = 0; i < SIGCODEC_CORRELATIONSIZE; i++) rcorrelationId |= (uint32_t)pdata[SIGCODEC_HEADERSIZE + i] << (8 * i);
+        payloadStart += SIGCODEC_CORRELATIONSIZE;
+    }
+
+    json payload;
+    switch (payloadType) {
+        case PAYLOAD::NONE:
+            break;
+        case PAYLOAD::STRING:
+        {
+            StringInfo stringInfo;
+            stringInfo.data.assign(data, payloadStart, std::string::npos);
+            payload = stringInfo.to_json();
+        }
+        break;
+        case PAYLOAD::MSGPACK:
+            payload = json::from_msgpack(pdata + payloadStart, pdata + data.size(), true, false);
+            if (payload.is_discarded()) return false;
+            break;
+        default:
+            return false;
+    }
+
+    rhyperCubeCommand = HyperCubeCommand(command, payload, (flags & SIGCODEC_FLAG_STATUS) != 0);
+    rhyperCubeCommand.ack = (flags & SIGCODEC_FLAG_ACK) != 0;
+    return true;
+}
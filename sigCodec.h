@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+#include "Messages.h"
+
+#define SIGCODEC_MAGIC 0xB1             // first byte of a binary command. JSON commands start with '{'
+#define SIGCODEC_VERSION 1
+#define SIGCODEC_NAME "bin1"            // name exchanged in the connection setup capabilities
+
+/// Compact binary encoding of HyperCubeCommand, carried in the same SigMsg string as the JSON form.
+///
+///   byte 0      SIGCODEC_MAGIC
+///   byte 1      SIGCODEC_VERSION
+///   byte 2..3   command, little endian
+///   byte 4      flags, SIGCODEC_FLAG_*
+///   byte 5      payload type, SigCodec::PAYLOAD
+///   byte 6..9   correlation id, little endian, only with SIGCODEC_FLAG_CORRELATION
+///   then        payload, to the end of the string
+///
+/// StringInfo payloads (pings, echoes) are the raw string. Every other CommonInfoBase payload
+/// is its JSON converted to MessagePack, so new info types need no codec changes.
+class SigCodec {
+public:
+    enum class PAYLOAD : uint8_t {
+        NONE = 0,
+        STRING = 1,
+        MSGPACK = 2,
+    };
+    static const uint8_t SIGCODEC_FLAG_ACK = 0x01;
+    static const uint8_t SIGCODEC_FLAG_STATUS = 0x02;
+    static const uint8_t SIGCODEC_FLAG_CORRELATION = 0x04;     // sent once the server takes correlationIds
+    static const int SIGCODEC_CORRELATIONSIZE = 4;
+    static const int SIGCODEC_HEADERSIZE = 6;
+
+    static bool isBinary(const std::string& data) {
+        return (data.size() >= SIGCODEC_HEADERSIZE) && ((uint8_t)data[0] == SIGCODEC_MAGIC);
+    }
+    /// correlationId 0 leaves it out
+    static bool encode(HYPERCUBECOMMANDS command, CommonInfoBase& commonInfoBase, bool ack, bool status, std::string& rdata, uint32_t correlationId = 0);
+    /// same, for a payload that is already JSON, as a server relays it. A STRING payload is
+    /// the StringInfo the JSON holds
+    static bool encode(HYPERCUBECOMMANDS command, const json& payload, PAYLOAD payloadType, bool ack, bool status, std::string& rdata, uint32_t correlationId = 0);
+    /// rcorrelationId is 0 if the command did not carry one
+    static bool decode(const std::string& data, HyperCubeCommand& rhyperCubeCommand, uint32_t& rcorrelationId);
+};